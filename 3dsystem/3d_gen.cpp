@@ -26,8 +26,17 @@
 #include "3dsystem/phd_math.h"
 #include "3dsystem/scalespr.h"
 #include "specific/hwr.h"
+#include "specific/winmain.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_PROFILER
+#include "modding/profiler.h"
+#endif // FEATURE_PROFILER
+
+#ifdef FEATURE_RENDER_IMPROVED
+#include <emmintrin.h>
+#endif // FEATURE_RENDER_IMPROVED
+
 // related to POLYTYPE enum
 static void (__cdecl *PolyDrawRoutines[])(__int16 *) = {
 	draw_poly_gtmap,		// gouraud shaded poly (texture)
@@ -41,7 +50,11 @@ static void (__cdecl *PolyDrawRoutines[])(__int16 *) = {
 	draw_scaled_spriteC		// scaled sprite (texture + colorkey)
 };
 
-#if defined(FEATURE_EXTENDED_LIMITS) || defined(FEATURE_VIEW_IMPROVED)
+#if defined(FEATURE_RENDER_IMPROVED)
+static SORT_ITEM SortBufferBase[16000];
+SORT_ITEM *SortBuffer = SortBufferBase;
+__int16 Info3dBuffer[480000];
+#elif defined(FEATURE_EXTENDED_LIMITS) || defined(FEATURE_VIEW_IMPROVED)
 SORT_ITEM SortBuffer[16000];
 __int16 Info3dBuffer[480000];
 #endif // defined(FEATURE_EXTENDED_LIMITS) || defined(FEATURE_VIEW_IMPROVED)
@@ -51,6 +64,541 @@ PHD_SPRITE PhdSpriteInfo[2048];
 D3DTLVERTEX HWR_VertexBuffer[0x8000];
 #endif // FEATURE_EXTENDED_LIMITS
 
+#ifdef FEATURE_RENDER_IMPROVED
+bool RadixSortEnabled = true;
+
+// scratch buffer for the radix sort passes
+static SORT_ITEM *SortScratch = NULL;
+static DWORD SortScratchSize = 0;
+
+// The poly list grows, if it is required by the frame. The sort list must be
+// contiguous for sorting, so it is reallocated (nothing points into it).
+// Info3d and HWR vertices are referenced by pointers from already inserted
+// items, so they are never moved: the next chunk is just added instead.
+#define POLYLIST_CHUNKS			(64)
+#define POLYLIST_INFO3D_MARGIN	(0x200) // more than any primitive takes in Info3d
+#define POLYLIST_VERTEX_MARGIN	(0x40) // more than any primitive takes in HWR vertex buffer
+
+static DWORD SortBufferSize = ARRAY_SIZE(SortBufferBase);
+static __int16 *Info3dChunks[POLYLIST_CHUNKS] = {Info3dBuffer};
+static D3DTLVERTEX *VertexChunks[POLYLIST_CHUNKS] = {HWR_VertexBuffer};
+static DWORD Info3dChunkIndex = 0;
+static DWORD VertexChunkIndex = 0;
+static DWORD Info3dChunksUsed = 0; // Info3d words in the chunks before the current one
+static DWORD VertexChunksUsed = 0; // HWR vertices in the chunks before the current one
+
+bool SimdEnabled = true;
+
+bool IsSimdAvailable() {
+	static int isSse2 = -1;
+	if( isSse2 < 0 ) {
+		isSse2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? 1 : 0;
+	}
+	return SimdEnabled && isSse2;
+}
+
+static void GrowSortBuffer() {
+	DWORD size = SortBufferSize * 2;
+	SORT_ITEM *buffer = (SORT_ITEM *)malloc(sizeof(SORT_ITEM) * size);
+	if( buffer == NULL ) {
+		S_ExitSystem("phd_ReservePolyList(): OUT OF MEMORY");
+	}
+	memcpy(buffer, SortBuffer, sizeof(SORT_ITEM) * SortBufferSize);
+	Sort3dPtr = buffer + (Sort3dPtr - SortBuffer);
+	if( SortBuffer != SortBufferBase ) {
+		free(SortBuffer);
+	}
+	SortBuffer = buffer;
+	SortBufferSize = size;
+}
+
+static void NextInfo3dChunk() {
+	Info3dChunksUsed += Info3dPtr - Info3dChunks[Info3dChunkIndex];
+	if( ++Info3dChunkIndex >= POLYLIST_CHUNKS ) {
+		S_ExitSystem("phd_ReservePolyList(): too many Info3d chunks");
+	}
+	if( Info3dChunks[Info3dChunkIndex] == NULL ) {
+		Info3dChunks[Info3dChunkIndex] = (__int16 *)malloc(sizeof(Info3dBuffer));
+		if( Info3dChunks[Info3dChunkIndex] == NULL ) {
+			S_ExitSystem("phd_ReservePolyList(): OUT OF MEMORY");
+		}
+	}
+	Info3dPtr = Info3dChunks[Info3dChunkIndex];
+}
+
+static void NextVertexChunk() {
+	VertexChunksUsed += HWR_VertexPtr - VertexChunks[VertexChunkIndex];
+	if( ++VertexChunkIndex >= POLYLIST_CHUNKS ) {
+		S_ExitSystem("phd_ReservePolyList(): too many vertex chunks");
+	}
+	if( VertexChunks[VertexChunkIndex] == NULL ) {
+		VertexChunks[VertexChunkIndex] = (D3DTLVERTEX *)malloc(sizeof(HWR_VertexBuffer));
+		if( VertexChunks[VertexChunkIndex] == NULL ) {
+			S_ExitSystem("phd_ReservePolyList(): OUT OF MEMORY");
+		}
+	}
+	HWR_VertexPtr = VertexChunks[VertexChunkIndex];
+}
+
+void phd_GetPolyListUsage(POLYLIST_USAGE *usage) {
+	usage->surfaces = SurfaceCount;
+	usage->surfacesSize = SortBufferSize;
+	usage->info3d = Info3dChunksUsed + (Info3dPtr - Info3dChunks[Info3dChunkIndex]);
+	usage->info3dSize = ARRAY_SIZE(Info3dBuffer) * (Info3dChunkIndex + 1);
+	usage->vertices = 0;
+	usage->verticesSize = ARRAY_SIZE(HWR_VertexBuffer) * (VertexChunkIndex + 1);
+	if( SavedAppSettings.RenderMode == RM_Hardware ) {
+		usage->vertices = VertexChunksUsed + (HWR_VertexPtr - VertexChunks[VertexChunkIndex]);
+	}
+}
+
+// NOTE: this function is not presented in the original game.
+// It must be called before any primitive is inserted into the poly list
+void phd_ReservePolyList() {
+	if( SurfaceCount >= SortBufferSize ) {
+		GrowSortBuffer();
+	}
+	if( Info3dPtr + POLYLIST_INFO3D_MARGIN > Info3dChunks[Info3dChunkIndex] + ARRAY_SIZE(Info3dBuffer) ) {
+		NextInfo3dChunk();
+	}
+	if( SavedAppSettings.RenderMode == RM_Hardware &&
+		HWR_VertexPtr + POLYLIST_VERTEX_MARGIN > VertexChunks[VertexChunkIndex] + ARRAY_SIZE(HWR_VertexBuffer) )
+	{
+		NextVertexChunk();
+	}
+}
+
+#ifdef FEATURE_VIEW_IMPROVED
+extern int CalculateFogShade(int depth);
+#endif // FEATURE_VIEW_IMPROVED
+
+// SSE2 has no 32-bit multiplication, so it is combined from two 32x32->64 ones
+static inline SSE2_FUNC __m128i mullo_epi32(__m128i a, __m128i b) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+// Transforms up to 4 vertices from the packed mesh stream by PhdMatrixPtr.
+// The integer math wraps around exactly like the scalar code does
+static inline SSE2_FUNC void TransformBatchSSE2(__int16 *ptrObj, int stride, int count, __m128i *x, __m128i *y, __m128i *z) {
+	int idx[4];
+	for( int i = 0; i < 4; ++i ) {
+		idx[i] = stride * ((i < count) ? i : count - 1);
+	}
+	__m128i vx = _mm_setr_epi32(ptrObj[idx[0]+0], ptrObj[idx[1]+0], ptrObj[idx[2]+0], ptrObj[idx[3]+0]);
+	__m128i vy = _mm_setr_epi32(ptrObj[idx[0]+1], ptrObj[idx[1]+1], ptrObj[idx[2]+1], ptrObj[idx[3]+1]);
+	__m128i vz = _mm_setr_epi32(ptrObj[idx[0]+2], ptrObj[idx[1]+2], ptrObj[idx[2]+2], ptrObj[idx[3]+2]);
+	PHD_MATRIX *m = PhdMatrixPtr;
+
+	*x = _mm_add_epi32(_mm_add_epi32(mullo_epi32(vx, _mm_set1_epi32(m->_00)), mullo_epi32(vy, _mm_set1_epi32(m->_01))),
+					   _mm_add_epi32(mullo_epi32(vz, _mm_set1_epi32(m->_02)), _mm_set1_epi32(m->_03)));
+	*y = _mm_add_epi32(_mm_add_epi32(mullo_epi32(vx, _mm_set1_epi32(m->_10)), mullo_epi32(vy, _mm_set1_epi32(m->_11))),
+					   _mm_add_epi32(mullo_epi32(vz, _mm_set1_epi32(m->_12)), _mm_set1_epi32(m->_13)));
+	*z = _mm_add_epi32(_mm_add_epi32(mullo_epi32(vx, _mm_set1_epi32(m->_20)), mullo_epi32(vy, _mm_set1_epi32(m->_21))),
+					   _mm_add_epi32(mullo_epi32(vz, _mm_set1_epi32(m->_22)), _mm_set1_epi32(m->_23)));
+}
+
+// Projects 2 vertices in double precision. The scalar code runs on x87 under
+// the Direct3D precision control, so the last bits of the results may differ
+static inline SSE2_FUNC void ProjectPairSSE2(__m128d xv, __m128d yv, __m128d zv, __m128 *xs, __m128 *ys, __m128 *rhw) {
+	__m128d persp = _mm_div_pd(_mm_set1_pd(FltPersp), zv);
+	*xs = _mm_cvtpd_ps(_mm_add_pd(_mm_mul_pd(persp, xv), _mm_set1_pd(FltWinCenterX)));
+	*ys = _mm_cvtpd_ps(_mm_add_pd(_mm_mul_pd(persp, yv), _mm_set1_pd(FltWinCenterY)));
+	*rhw = _mm_cvtpd_ps(_mm_mul_pd(persp, _mm_set1_pd(FltRhwOPersp)));
+}
+
+// Projects 4 vertices. Near clipped ones get some garbage, so they must be skipped
+static inline SSE2_FUNC void ProjectBatchSSE2(__m128i x, __m128i y, __m128i z, bool farClamp, double baseZ,
+											  float *zv, float *xs, float *ys, float *rhw, int *clip)
+{
+	__m128 xsLo, xsHi, ysLo, ysHi, rhwLo, rhwHi, zvLo, zvHi;
+	for( int half = 0; half < 2; ++half ) {
+		__m128d xd = _mm_cvtepi32_pd(x);
+		__m128d yd = _mm_cvtepi32_pd(y);
+		__m128d zd = _mm_cvtepi32_pd(z);
+		__m128d zOut = _mm_add_pd(zd, _mm_set1_pd(baseZ));
+		if( farClamp ) {
+			__m128d farZ = _mm_set1_pd(FltFarZ);
+			__m128d isFar = _mm_cmpge_pd(zd, farZ);
+			zd = _mm_min_pd(zd, farZ);
+			zOut = _mm_or_pd(_mm_and_pd(isFar, farZ), _mm_andnot_pd(isFar, zOut));
+		}
+		__m128d isNear = _mm_cmplt_pd(_mm_cvtepi32_pd(z), _mm_set1_pd(FltNearZ));
+		zOut = _mm_or_pd(_mm_and_pd(isNear, _mm_cvtepi32_pd(z)), _mm_andnot_pd(isNear, zOut));
+		zd = _mm_or_pd(_mm_and_pd(isNear, _mm_set1_pd(1.0)), _mm_andnot_pd(isNear, zd)); // avoid zero divide
+		if( half == 0 ) {
+			ProjectPairSSE2(xd, yd, zd, &xsLo, &ysLo, &rhwLo);
+			zvLo = _mm_cvtpd_ps(zOut);
+		} else {
+			ProjectPairSSE2(xd, yd, zd, &xsHi, &ysHi, &rhwHi);
+			zvHi = _mm_cvtpd_ps(zOut);
+		}
+		x = _mm_srli_si128(x, 8);
+		y = _mm_srli_si128(y, 8);
+		z = _mm_srli_si128(z, 8);
+	}
+	__m128 vxs = _mm_movelh_ps(xsLo, xsHi);
+	__m128 vys = _mm_movelh_ps(ysLo, ysHi);
+	_mm_storeu_ps(xs, vxs);
+	_mm_storeu_ps(ys, vys);
+	_mm_storeu_ps(rhw, _mm_movelh_ps(rhwLo, rhwHi));
+	_mm_storeu_ps(zv, _mm_movelh_ps(zvLo, zvHi));
+
+	// the screen clip flags are calculated using the stored float values
+	__m128 isLeft = _mm_cmplt_ps(vxs, _mm_set1_ps(FltWinLeft));
+	__m128 isRight = _mm_andnot_ps(isLeft, _mm_cmpgt_ps(vxs, _mm_set1_ps(FltWinRight)));
+	__m128 isTop = _mm_cmplt_ps(vys, _mm_set1_ps(FltWinTop));
+	__m128 isBottom = _mm_andnot_ps(isTop, _mm_cmpgt_ps(vys, _mm_set1_ps(FltWinBottom)));
+	__m128i flags = _mm_or_si128(
+		_mm_or_si128(_mm_and_si128(_mm_castps_si128(isLeft), _mm_set1_epi32(0x01)),
+					 _mm_and_si128(_mm_castps_si128(isRight), _mm_set1_epi32(0x02))),
+		_mm_or_si128(_mm_and_si128(_mm_castps_si128(isTop), _mm_set1_epi32(0x04)),
+					 _mm_and_si128(_mm_castps_si128(isBottom), _mm_set1_epi32(0x08))));
+	_mm_storeu_si128((__m128i *)clip, flags);
+}
+
+static SSE2_FUNC __int16 *calc_object_vertices_SSE2(__int16 *ptrObj, int vtxCount, double baseZ) {
+	__m128i x, y, z;
+	float xv[4], yv[4], zv[4], xs[4], ys[4], rhw[4];
+	int zi[4], clip[4];
+	BYTE totalClip = 0xFF;
+
+	for( int i = 0; i < vtxCount; i += 4 ) {
+		int batch = MIN(4, vtxCount - i);
+		TransformBatchSSE2(ptrObj, 3, batch, &x, &y, &z);
+		_mm_storeu_ps(xv, _mm_movelh_ps(_mm_cvtpd_ps(_mm_cvtepi32_pd(x)), _mm_cvtpd_ps(_mm_cvtepi32_pd(_mm_srli_si128(x, 8)))));
+		_mm_storeu_ps(yv, _mm_movelh_ps(_mm_cvtpd_ps(_mm_cvtepi32_pd(y)), _mm_cvtpd_ps(_mm_cvtepi32_pd(_mm_srli_si128(y, 8)))));
+		_mm_storeu_si128((__m128i *)zi, z);
+		ProjectBatchSSE2(x, y, z, true, baseZ, zv, xs, ys, rhw, clip);
+
+		for( int j = 0; j < batch; ++j ) {
+			PHD_VBUF *vbuf = &PhdVBuf[i+j];
+			BYTE clipFlags;
+			vbuf->xv = xv[j];
+			vbuf->yv = yv[j];
+			vbuf->zv = zv[j];
+			if( (double)zi[j] < FltNearZ ) {
+				clipFlags = 0x80;
+			} else {
+				clipFlags = clip[j];
+				vbuf->xs = xs[j];
+				vbuf->ys = ys[j];
+				vbuf->rhw = rhw[j];
+			}
+			vbuf->clip = clipFlags;
+			totalClip &= clipFlags;
+		}
+		ptrObj += 3 * batch;
+	}
+	return ( totalClip == 0 ) ? ptrObj : NULL;
+}
+
+static SSE2_FUNC __int16 *calc_roomvert_SSE2(__int16 *ptrObj, int vtxCount, BYTE farClip, double baseZ) {
+	__m128i x, y, z;
+	float xv[4], yv[4], zv[4], xs[4], ys[4], rhw[4];
+	int zi[4], clip[4];
+
+	for( int i = 0; i < vtxCount; i += 4 ) {
+		int batch = MIN(4, vtxCount - i);
+		TransformBatchSSE2(ptrObj, 6, batch, &x, &y, &z);
+		_mm_storeu_ps(xv, _mm_movelh_ps(_mm_cvtpd_ps(_mm_cvtepi32_pd(x)), _mm_cvtpd_ps(_mm_cvtepi32_pd(_mm_srli_si128(x, 8)))));
+		_mm_storeu_ps(yv, _mm_movelh_ps(_mm_cvtpd_ps(_mm_cvtepi32_pd(y)), _mm_cvtpd_ps(_mm_cvtepi32_pd(_mm_srli_si128(y, 8)))));
+		_mm_storeu_si128((__m128i *)zi, z);
+		ProjectBatchSSE2(x, y, z, false, baseZ, zv, xs, ys, rhw, clip);
+
+		// fog, wibble and water effects are taken from the scalar code as is
+		for( int j = 0; j < batch; ++j, ptrObj += 6 ) {
+			PHD_VBUF *vbuf = &PhdVBuf[i+j];
+			int depth;
+			vbuf->xv = xv[j];
+			vbuf->yv = yv[j];
+			vbuf->zv = zv[j];
+
+			vbuf->g = ptrObj[5];
+			if( IsWaterEffect != 0 )
+				vbuf->g += ShadesTable[(WibbleOffset + (BYTE)RandomTable[(vtxCount - i - j) % WIBBLE_SIZE]) % WIBBLE_SIZE];
+
+			if( (double)zi[j] < FltNearZ ) {
+				vbuf->clip = 0xFF80;
+			} else {
+				depth = zi[j] >> W2V_SHIFT;
+#ifdef FEATURE_VIEW_IMPROVED
+				if( depth >= PhdViewDistance ) {
+					vbuf->rhw = rhw[j];
+#else // !FEATURE_VIEW_IMPROVED
+				if( depth >= DEPTHQ_END ) { // fog end
+					vbuf->rhw = 0.0; // NOTE: zero RHW is an invalid value, but the original game sets it.
+					vbuf->zv = FltFarZ;
+#endif // FEATURE_VIEW_IMPROVED
+					vbuf->g = 0x1FFF;
+					vbuf->clip = farClip;
+				} else {
+#ifdef FEATURE_VIEW_IMPROVED
+					vbuf->g += CalculateFogShade(depth);
+#else // !FEATURE_VIEW_IMPROVED
+					if( depth > DEPTHQ_START ) { // fog begin
+						vbuf->g += depth - DEPTHQ_START;
+					}
+#endif // FEATURE_VIEW_IMPROVED
+					vbuf->rhw = rhw[j];
+					vbuf->clip = 0;
+				}
+
+				vbuf->xs = xs[j];
+				vbuf->ys = ys[j];
+
+				if( IsWibbleEffect && ptrObj[4] >= 0 ) {
+					vbuf->xs += WibbleTable[(WibbleOffset + (BYTE)vbuf->ys) % WIBBLE_SIZE];
+					vbuf->ys += WibbleTable[(WibbleOffset + (BYTE)vbuf->xs) % WIBBLE_SIZE];
+					// screen clip flags must be recalculated after the wibble
+					clip[j] = 0;
+					if( vbuf->xs < FltWinLeft )
+						clip[j] |= 0x01;
+					else if( vbuf->xs > FltWinRight )
+						clip[j] |= 0x02;
+
+					if( vbuf->ys < FltWinTop )
+						clip[j] |= 0x04;
+					else if( vbuf->ys > FltWinBottom )
+						clip[j] |= 0x08;
+				}
+				vbuf->clip |= clip[j];
+				vbuf->clip |= ~(BYTE)(vbuf->zv / 0x155555.p0) << 8;
+			}
+			CLAMP(vbuf->g, 0, 0x1FFF);
+		}
+	}
+	return ptrObj;
+}
+
+// Stores 8 vertex shades, the same as the scalar code does: the shade is
+// truncated to 16 bits first, and then it is clamped to 0..0x1FFF
+static inline SSE2_FUNC void StoreShadesSSE2(PHD_VBUF *vbuf, __m128i lo, __m128i hi) {
+	__int16 shades[8];
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+	__m128i g = _mm_packs_epi32(lo, hi);
+	g = _mm_min_epi16(_mm_max_epi16(g, _mm_setzero_si128()), _mm_set1_epi16(0x1FFF));
+	_mm_storeu_si128((__m128i *)shades, g);
+	for( int j = 0; j < 8; ++j ) {
+		vbuf[j].g = shades[j];
+	}
+}
+
+static SSE2_FUNC __int16 *calc_vertice_light_SSE2(__int16 *ptrObj, int vtxCount, int xv, int yv, int zv) {
+	__m128i adder = _mm_set1_epi32(LsAdder);
+	int i = 0;
+
+	if( vtxCount > 0 ) {
+		// 16-bit multiply-add is exact only if the light vector fits 16 bits
+		if( xv == (__int16)xv && yv == (__int16)yv && zv == (__int16)zv ) {
+			__m128i xy = _mm_set1_epi32((xv & 0xFFFF) | ((DWORD)(yv & 0xFFFF) << 16));
+			__m128i z0 = _mm_set1_epi32(zv & 0xFFFF);
+			for( ; i + 8 <= vtxCount; i += 8, ptrObj += 24 ) {
+				__m128i nx = _mm_setr_epi16(ptrObj[0], ptrObj[3], ptrObj[6], ptrObj[9], ptrObj[12], ptrObj[15], ptrObj[18], ptrObj[21]);
+				__m128i ny = _mm_setr_epi16(ptrObj[1], ptrObj[4], ptrObj[7], ptrObj[10], ptrObj[13], ptrObj[16], ptrObj[19], ptrObj[22]);
+				__m128i nz = _mm_setr_epi16(ptrObj[2], ptrObj[5], ptrObj[8], ptrObj[11], ptrObj[14], ptrObj[17], ptrObj[20], ptrObj[23]);
+				__m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(nx, ny), xy), _mm_madd_epi16(_mm_unpacklo_epi16(nz, _mm_setzero_si128()), z0));
+				__m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(nx, ny), xy), _mm_madd_epi16(_mm_unpackhi_epi16(nz, _mm_setzero_si128()), z0));
+				lo = _mm_add_epi32(adder, _mm_srai_epi32(lo, 16));
+				hi = _mm_add_epi32(adder, _mm_srai_epi32(hi, 16));
+				StoreShadesSSE2(&PhdVBuf[i], lo, hi);
+			}
+		}
+		for( ; i < vtxCount; ++i, ptrObj += 3 ) {
+			__int16 shade = LsAdder + ((ptrObj[0]*xv + ptrObj[1]*yv + ptrObj[2]*zv) >> 16);
+			CLAMP(shade, 0, 0x1FFF);
+			PhdVBuf[i].g = shade;
+		}
+	} else {
+		vtxCount = -vtxCount;
+		for( ; i + 8 <= vtxCount; i += 8, ptrObj += 8 ) {
+			__m128i shades = _mm_loadu_si128((__m128i *)ptrObj);
+			__m128i lo = _mm_add_epi32(adder, _mm_srai_epi32(_mm_unpacklo_epi16(shades, shades), 16));
+			__m128i hi = _mm_add_epi32(adder, _mm_srai_epi32(_mm_unpackhi_epi16(shades, shades), 16));
+			StoreShadesSSE2(&PhdVBuf[i], lo, hi);
+		}
+		for( ; i < vtxCount; ++i, ++ptrObj ) {
+			__int16 shade = LsAdder + *ptrObj;
+			CLAMP(shade, 0, 0x1FFF);
+			PhdVBuf[i].g = shade;
+		}
+	}
+	return ptrObj;
+}
+
+// Room geometry is static, so the projected room vertices are retained
+// between frames. They are reused while the view of the room is unchanged,
+// and only the vertex shades (lighting, water and fog) are updated.
+typedef struct {
+	__int16 *data; // flipped rooms swap their meshes
+	PHD_MATRIX matrix;
+	float winLeft;
+	float winTop;
+	float winRight;
+	float winBottom;
+	float winCenterX;
+	float winCenterY;
+	float persp;
+	float rhwOPersp;
+	float nearZ;
+	float farZ;
+	DWORD midSort;
+	int viewDistance;
+	int farClip;
+} ROOM_VIEW_KEY;
+
+typedef struct {
+	ROOM_VIEW_KEY key;
+	int vtxCount;
+	PHD_VBUF *vbuf;
+	int *depth;
+	bool isValid;
+} ROOM_VERTEX_CACHE;
+
+bool RoomVertexCacheEnabled = true;
+
+static ROOM_VERTEX_CACHE *RoomVertexCaches = NULL;
+static int RoomVertexCachesCount = 0;
+static int RoomVertexCacheIndex = -1;
+
+void ResetRoomVertexCache() {
+	if( RoomVertexCaches != NULL ) {
+		for( int i = 0; i < RoomVertexCachesCount; ++i ) {
+			free(RoomVertexCaches[i].vbuf);
+			free(RoomVertexCaches[i].depth);
+		}
+		free(RoomVertexCaches);
+		RoomVertexCaches = NULL;
+	}
+	RoomVertexCachesCount = 0;
+	RoomVertexCacheIndex = -1;
+}
+
+void SelectRoomVertexCache(int roomNumber) {
+	RoomVertexCacheIndex = roomNumber;
+}
+
+static ROOM_VERTEX_CACHE *GetRoomVertexCache(int vtxCount) {
+	int index = RoomVertexCacheIndex;
+	RoomVertexCacheIndex = -1;
+
+	if( !RoomVertexCacheEnabled || index < 0 || index >= RoomCount
+		|| SavedAppSettings.RenderMode != RM_Hardware
+		|| vtxCount <= 0 || vtxCount > (int)ARRAY_SIZE(PhdVBuf) )
+	{
+		return NULL;
+	}
+
+	if( RoomVertexCaches == NULL ) {
+		RoomVertexCaches = (ROOM_VERTEX_CACHE *)calloc(RoomCount, sizeof(ROOM_VERTEX_CACHE));
+		if( RoomVertexCaches == NULL ) {
+			return NULL;
+		}
+		RoomVertexCachesCount = RoomCount;
+	}
+
+	ROOM_VERTEX_CACHE *cache = &RoomVertexCaches[index];
+	if( cache->vtxCount != vtxCount ) {
+		PHD_VBUF *vbuf = (PHD_VBUF *)realloc(cache->vbuf, sizeof(PHD_VBUF) * vtxCount);
+		if( vbuf != NULL ) cache->vbuf = vbuf;
+		int *depth = (int *)realloc(cache->depth, sizeof(int) * vtxCount);
+		if( depth != NULL ) cache->depth = depth;
+		if( vbuf == NULL || depth == NULL ) {
+			cache->vtxCount = 0;
+			cache->isValid = false;
+			return NULL;
+		}
+		cache->vtxCount = vtxCount;
+		cache->isValid = false;
+	}
+	return cache;
+}
+
+static void GetRoomViewKey(ROOM_VIEW_KEY *key, __int16 *ptrObj, BYTE farClip) {
+	// the key is compared as a whole, so the padding must be zeroed too
+	memset(key, 0, sizeof(ROOM_VIEW_KEY));
+	key->data = ptrObj;
+	key->matrix = *PhdMatrixPtr;
+	key->winLeft = FltWinLeft;
+	key->winTop = FltWinTop;
+	key->winRight = FltWinRight;
+	key->winBottom = FltWinBottom;
+	key->winCenterX = FltWinCenterX;
+	key->winCenterY = FltWinCenterY;
+	key->persp = FltPersp;
+	key->rhwOPersp = FltRhwOPersp;
+	key->nearZ = FltNearZ;
+	key->farZ = FltFarZ;
+	key->midSort = MidSort;
+	key->viewDistance = PhdViewDistance;
+	key->farClip = farClip;
+}
+
+static void ShadeRetainedRoomVertices(ROOM_VERTEX_CACHE *cache, __int16 *ptrObj) {
+	int vtxCount = cache->vtxCount;
+
+	for( int i = 0; i < vtxCount; ++i, ptrObj += 6 ) {
+		PHD_VBUF *vbuf = &PhdVBuf[i];
+		int depth = cache->depth[i];
+
+		vbuf->g = ptrObj[5];
+		if( IsWaterEffect != 0 )
+			vbuf->g += ShadesTable[(WibbleOffset + (BYTE)RandomTable[(vtxCount - i) % WIBBLE_SIZE]) % WIBBLE_SIZE];
+
+		if( !CHK_ANY(vbuf->clip, 0x80) ) {
+#ifdef FEATURE_VIEW_IMPROVED
+			if( depth >= PhdViewDistance ) {
+#else // !FEATURE_VIEW_IMPROVED
+			if( depth >= DEPTHQ_END ) { // fog end
+#endif // FEATURE_VIEW_IMPROVED
+				vbuf->g = 0x1FFF;
+			} else {
+#ifdef FEATURE_VIEW_IMPROVED
+				vbuf->g += CalculateFogShade(depth);
+#else // !FEATURE_VIEW_IMPROVED
+				if( depth > DEPTHQ_START ) { // fog begin
+					vbuf->g += depth - DEPTHQ_START;
+				}
+#endif // FEATURE_VIEW_IMPROVED
+			}
+		}
+		CLAMP(vbuf->g, 0, 0x1FFF);
+	}
+}
+
+static __int16 *calc_roomvert_retained(__int16 *ptrObj, BYTE farClip) {
+	ROOM_VERTEX_CACHE *cache = GetRoomVertexCache(*ptrObj);
+	ROOM_VIEW_KEY key;
+
+	// wibble moves the projected vertices every frame, so nothing is retained
+	if( cache == NULL || IsWibbleEffect ) {
+		return calc_roomvert(ptrObj, farClip);
+	}
+
+	GetRoomViewKey(&key, ptrObj, farClip);
+	if( cache->isValid && !memcmp(&cache->key, &key, sizeof(key)) ) {
+		memcpy(PhdVBuf, cache->vbuf, sizeof(PHD_VBUF) * cache->vtxCount);
+		ShadeRetainedRoomVertices(cache, ptrObj + 1);
+		return ptrObj + 1 + 6 * cache->vtxCount;
+	}
+
+	__int16 *result = calc_roomvert(ptrObj, farClip);
+	++ptrObj;
+	for( int i = 0; i < cache->vtxCount; ++i, ptrObj += 6 ) {
+		cache->depth[i] = (PhdMatrixPtr->_20 * ptrObj[0] +
+						   PhdMatrixPtr->_21 * ptrObj[1] +
+						   PhdMatrixPtr->_22 * ptrObj[2] +
+						   PhdMatrixPtr->_23) >> W2V_SHIFT;
+	}
+	memcpy(cache->vbuf, PhdVBuf, sizeof(PHD_VBUF) * cache->vtxCount);
+	cache->key = key;
+	cache->isValid = true;
+	return result;
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 #ifdef FEATURE_VIEW_IMPROVED
 bool PsxFovEnabled;
 
@@ -581,7 +1129,11 @@ void __cdecl S_InsertRoom(__int16 *ptrObj, BOOL isOutside) {
 	FltWinCenterX = (float)(PhdWinMinX + PhdWinCenterX);
 	FltWinCenterY = (float)(PhdWinMinY + PhdWinCenterY);
 
+#ifdef FEATURE_RENDER_IMPROVED
+	ptrObj = calc_roomvert_retained(ptrObj, isOutside?0x00:0x10);
+#else // FEATURE_RENDER_IMPROVED
 	ptrObj = calc_roomvert(ptrObj, isOutside?0x00:0x10);
+#endif // FEATURE_RENDER_IMPROVED
 	ptrObj = ins_objectGT4(ptrObj+1, *ptrObj, ST_MaxZ);
 	ptrObj = ins_objectGT3(ptrObj+1, *ptrObj, ST_MaxZ);
 	ptrObj = ins_room_sprite(ptrObj+1, *ptrObj);
@@ -671,6 +1223,12 @@ __int16 *__cdecl calc_object_vertices(__int16 *ptrObj) {
 		printf("vtxCount=%d", vtxCount);
 	}
 
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsSimdAvailable() && vtxCount <= (int)ARRAY_SIZE(PhdVBuf) ) {
+		return calc_object_vertices_SSE2(ptrObj, vtxCount, baseZ);
+	}
+#endif // FEATURE_RENDER_IMPROVED
+
 	for( int i = 0; i < vtxCount; ++i ) {
 		xv = (double)(PhdMatrixPtr->_00 * ptrObj[0] +
 					  PhdMatrixPtr->_01 * ptrObj[1] +
@@ -744,6 +1302,11 @@ __int16 *__cdecl calc_vertice_light(__int16 *ptrObj) {
 				  PhdMatrixPtr->_12 * LsVectorView.y +
 				  PhdMatrixPtr->_22 * LsVectorView.z) / LsDivider;
 
+#ifdef FEATURE_RENDER_IMPROVED
+			if( IsSimdAvailable() && vtxCount <= (int)ARRAY_SIZE(PhdVBuf) ) {
+				return calc_vertice_light_SSE2(ptrObj, vtxCount, xv, yv, zv);
+			}
+#endif // FEATURE_RENDER_IMPROVED
 			for( i = 0; i < vtxCount; ++i ) {
 				shade = LsAdder + ((ptrObj[0]*xv + ptrObj[1]*yv + ptrObj[2]*zv) >> 16);
 				CLAMP(shade, 0, 0x1FFF);
@@ -759,6 +1322,11 @@ __int16 *__cdecl calc_vertice_light(__int16 *ptrObj) {
 			ptrObj += 3*vtxCount;
 		}
 	} else {
+#ifdef FEATURE_RENDER_IMPROVED
+		if( IsSimdAvailable() && -vtxCount <= (int)ARRAY_SIZE(PhdVBuf) ) {
+			return calc_vertice_light_SSE2(ptrObj, vtxCount, 0, 0, 0);
+		}
+#endif // FEATURE_RENDER_IMPROVED
 		for( i = 0; i < -vtxCount; ++i ) {
 			shade = LsAdder + *ptrObj;
 			CLAMP(shade, 0, 0x1FFF);
@@ -782,6 +1350,12 @@ __int16 *__cdecl calc_roomvert(__int16 *ptrObj, BYTE farClip) {
 
 	vtxCount = *(ptrObj++);
 
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsSimdAvailable() && vtxCount <= (int)ARRAY_SIZE(PhdVBuf) ) {
+		return calc_roomvert_SSE2(ptrObj, vtxCount, farClip, baseZ);
+	}
+#endif // FEATURE_RENDER_IMPROVED
+
 	for( int i = 0; i < vtxCount; ++i ) {
 		xv = (double)(PhdMatrixPtr->_00 * ptrObj[0] +
 					  PhdMatrixPtr->_01 * ptrObj[1] +
@@ -889,11 +1463,23 @@ void __cdecl phd_InitPolyList() {
 	SurfaceCount = 0;
 	Sort3dPtr = SortBuffer;
 	Info3dPtr = Info3dBuffer;
+#ifdef FEATURE_RENDER_IMPROVED
+	// the chunks are kept allocated for the next frames
+	Info3dChunkIndex = 0;
+	Info3dChunksUsed = 0;
+	if( SavedAppSettings.RenderMode == RM_Hardware ) {
+		VertexChunkIndex = 0;
+		VertexChunksUsed = 0;
+	}
+#endif // FEATURE_RENDER_IMPROVED
 	if( SavedAppSettings.RenderMode == RM_Hardware )
 		HWR_VertexPtr = HWR_VertexBuffer;
 }
 
 void __cdecl phd_SortPolyList() {
+#ifdef FEATURE_PROFILER
+	PROFILER_SCOPE(PROF_SortPolyList);
+#endif // FEATURE_PROFILER
 	if( SurfaceCount ) {
 		for( DWORD i=0; i<SurfaceCount; ++i ) {
 #ifdef FEATURE_VIEW_IMPROVED
@@ -901,6 +1487,12 @@ void __cdecl phd_SortPolyList() {
 #endif // FEATURE_VIEW_IMPROVED
 			SortBuffer[i]._1 += i;
 		}
+#ifdef FEATURE_RENDER_IMPROVED
+		if( RadixSortEnabled ) {
+			do_radixsorty(SortBuffer, SurfaceCount);
+			return;
+		}
+#endif // FEATURE_RENDER_IMPROVED
 		do_quickysorty(0, SurfaceCount-1);
 	}
 }
@@ -931,7 +1523,83 @@ void __cdecl do_quickysorty(int left, int right) {
 		do_quickysorty(i, right);
 }
 
+#ifdef FEATURE_RENDER_IMPROVED
+// NOTE: this function is not presented in the original game.
+// It sorts items by key in descending order like do_quickysorty(),
+// but it is stable and does not degrade on nearly sorted lists
+void do_radixsorty(SORT_ITEM *items, DWORD count) {
+	DWORD histogram[sizeof(items->_1)][256];
+	SORT_ITEM *src, *dst, *swapBuf;
+	DWORD i, j, pass, shift, offset, digits;
+
+	if( count < 2 ) return;
+	if( count > SortScratchSize ) {
+		SORT_ITEM *scratch = NULL;
+		if( count <= SortBufferSize ) {
+			scratch = (SORT_ITEM *)realloc(SortScratch, sizeof(SORT_ITEM) * SortBufferSize);
+		}
+		if( scratch == NULL ) {
+			do_quickysorty(0, count-1); // NOTE: this never happens with SortBuffer
+			return;
+		}
+		SortScratch = scratch;
+		SortScratchSize = SortBufferSize;
+	}
+
+	// count all digits in a single pass over the keys
+	memset(histogram, 0, sizeof(histogram));
+	for( i=0; i<count; ++i ) {
+		UINT64 key = items[i]._1;
+		for( pass=0; pass<sizeof(items->_1); ++pass ) {
+			++histogram[pass][(key >> (pass*8)) & 0xFF];
+		}
+	}
+
+	src = items;
+	dst = SortScratch;
+	for( pass=0; pass<sizeof(items->_1); ++pass ) {
+		shift = pass*8;
+		// skip the pass if all keys have the same digit here
+		if( histogram[pass][((UINT64)src[0]._1 >> shift) & 0xFF] == count ) {
+			continue;
+		}
+		// greater digits go first, since the list is sorted from far to near
+		offset = 0;
+		for( j=256; j>0; --j ) {
+			digits = histogram[pass][j-1];
+			histogram[pass][j-1] = offset;
+			offset += digits;
+		}
+		for( i=0; i<count; ++i ) {
+			dst[histogram[pass][((UINT64)src[i]._1 >> shift) & 0xFF]++] = src[i];
+		}
+		SWAP(src, dst, swapBuf);
+	}
+
+	if( src != items ) {
+		memcpy(items, src, sizeof(SORT_ITEM) * count);
+	}
+}
+#endif // FEATURE_RENDER_IMPROVED
+
+#ifdef FEATURE_RENDER_IMPROVED
+static void PrintPolyListBand() {
+	__int16 polyType, *bufPtr;
+
+	for( DWORD i=0; i<SurfaceCount; ++i ) {
+		bufPtr = (__int16 *)SortBuffer[i]._0;
+		polyType = *(bufPtr++); // poly has type as routine index in first word
+		PolyDrawRoutines[polyType](bufPtr); // send poly data as parameter to routine
+	}
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl phd_PrintPolyList(BYTE *surfacePtr) {
+#ifdef FEATURE_RENDER_IMPROVED
+	PrintSurfacePtr = surfacePtr;
+	// the framebuffer is split into bands, each one is drawn by its own thread
+	DrawBandsSWR(PrintPolyListBand);
+#else // FEATURE_RENDER_IMPROVED
 	__int16 polyType, *bufPtr;
 	PrintSurfacePtr = surfacePtr;
 
@@ -940,6 +1608,7 @@ void __cdecl phd_PrintPolyList(BYTE *surfacePtr) {
 		polyType = *(bufPtr++); // poly has type as routine index in first word
 		PolyDrawRoutines[polyType](bufPtr); // send poly data as parameter to routine
 	}
+#endif // FEATURE_RENDER_IMPROVED
 }
 
 void __cdecl AlterFOV(__int16 fov) {
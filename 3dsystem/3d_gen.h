@@ -32,6 +32,23 @@ void ClearMeshReflectState();
 void SetMeshReflectState(int objID, int meshIdx);
 #endif // FEATURE_VIDEOFX_IMPROVED
 
+#ifdef FEATURE_RENDER_IMPROVED
+typedef struct {
+	DWORD surfaces;
+	DWORD surfacesSize;
+	DWORD info3d;
+	DWORD info3dSize;
+	DWORD vertices;
+	DWORD verticesSize;
+} POLYLIST_USAGE;
+
+bool IsSimdAvailable();
+void phd_GetPolyListUsage(POLYLIST_USAGE *usage);
+void phd_ReservePolyList();
+void ResetRoomVertexCache();
+void SelectRoomVertexCache(int roomNumber);
+#endif // FEATURE_RENDER_IMPROVED
+
 void phd_GenerateW2V(PHD_3DPOS *viewPos); // 0x00401000
 void __cdecl phd_LookAt(int xsrc, int ysrc, int zsrc, int xtar, int ytar, int ztar, __int16 roll); // 0x004011D0
 void __cdecl phd_GetVectorAngles(int x, int y, int z, VECTOR_ANGLES *angles); // 0x00401250
@@ -54,6 +71,9 @@ void __cdecl phd_RotateLight(__int16 pitch, __int16 yaw); // 0x00402320
 void __cdecl phd_InitPolyList(); // 0x004023F0
 void __cdecl phd_SortPolyList(); // 0x00402420
 void __cdecl do_quickysorty(int left, int right); // 0x00402460
+#ifdef FEATURE_RENDER_IMPROVED
+void do_radixsorty(SORT_ITEM *items, DWORD count);
+#endif // FEATURE_RENDER_IMPROVED
 void __cdecl phd_PrintPolyList(BYTE *surfacePtr); // 0x00402530
 void __cdecl AlterFOV(__int16 fov); // 0x00402570
 void __cdecl phd_SetNearZ(int nearZ); // 0x00402680
@@ -23,6 +23,12 @@
 #include "3dsystem/3d_out.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_RENDER_IMPROVED
+#include "3dsystem/3d_gen.h"
+#include <emmintrin.h>
+#include <float.h>
+#endif // FEATURE_RENDER_IMPROVED
+
 #pragma pack(push, 1)
 
 typedef struct {
@@ -91,10 +97,44 @@ typedef struct {
 
 #pragma pack(pop)
 
+#ifdef FEATURE_RENDER_IMPROVED
+#define SWR_MAX_THREADS		(16)
+#define SWR_MIN_BAND_SIZE	(16)
+
+typedef struct {
+	void *xBuffer; // edge buffer filled by xgen functions
+	int xBufferLines;
+	int y0; // first polygon line after xgen function
+	int y1; // last polygon line after xgen function
+	int bandY0; // first line this context may draw
+	int bandY1; // last line this context may draw
+	HANDLE hThread;
+	HANDLE hStartEvent;
+	HANDLE hDoneEvent;
+	unsigned int fpuControl; // the main thread FPU precision and rounding
+} SWR_CONTEXT;
+
+DWORD SwrThreadsCount = 0; // 0 means autodetect
+
+static SWR_CONTEXT SwrContexts[SWR_MAX_THREADS];
+static __thread SWR_CONTEXT *SwrContext = &SwrContexts[0];
+static void (*SwrBandFunc)() = NULL;
+static volatile bool SwrBandStop = false;
+
+// the rasterizer state is kept per thread, so the polygon list can be drawn by several threads
+#undef XGen_y0
+#undef XGen_y1
+#define XGen_y0 (SwrContext->y0)
+#define XGen_y1 (SwrContext->y1)
+#define XBuffer (SwrContext->xBuffer)
+#endif // FEATURE_RENDER_IMPROVED
+
 #ifdef FEATURE_NOLEGACY_OPTIONS
 static int SwrPitch = 0;
 static int SwrHeight = 0;
+#ifndef FEATURE_RENDER_IMPROVED
 static void *XBuffer = NULL;
+#endif // !FEATURE_RENDER_IMPROVED
 
 int GetPitchSWR() {
     return SwrPitch;
@@ -104,17 +144,180 @@ void PrepareSWR(int pitch, int height) {
 	if( pitch != 0 ) {
 		SwrPitch = pitch;
 	}
+#ifdef FEATURE_RENDER_IMPROVED
+	// edge buffers are reserved by each context right before drawing
+	if( height != 0 ) {
+		SwrHeight = height;
+	}
+#else // FEATURE_RENDER_IMPROVED
     if( height != 0 && (XBuffer == NULL || SwrHeight != height) ) {
 		SwrHeight = height;
 		if( XBuffer != NULL ) free(XBuffer);
 		XBuffer = malloc(sizeof(XBUF_XGUVP) * height);
 	}
+#endif // FEATURE_RENDER_IMPROVED
 }
 #else // FEATURE_NOLEGACY_OPTIONS
 #define SwrPitch PhdScreenWidth // NOTE: this is the original game bug!
+#ifdef FEATURE_RENDER_IMPROVED
+#define SwrHeight PhdScreenHeight // edge buffers are not limited by 1200 lines anymore
+#else // FEATURE_RENDER_IMPROVED
 static int XBuffer[1200 * sizeof(XBUF_XGUVP) / sizeof(int)]; // maximum safe resolution is 1200 pixels
+#endif // FEATURE_RENDER_IMPROVED
 #endif // FEATURE_NOLEGACY_OPTIONS
 
+#ifdef FEATURE_RENDER_IMPROVED
+static bool ReserveContextSWR(SWR_CONTEXT *ctx, int lines) {
+	if( ctx->xBuffer != NULL && ctx->xBufferLines >= lines ) {
+		return true;
+	}
+	void *xBuffer = realloc(ctx->xBuffer, sizeof(XBUF_XGUVP) * lines);
+	if( xBuffer == NULL ) {
+		return false;
+	}
+	ctx->xBuffer = xBuffer;
+	ctx->xBufferLines = lines;
+	return true;
+}
+
+static DWORD WINAPI BandTaskSWR(LPVOID lpParameter) {
+	SwrContext = (SWR_CONTEXT *)lpParameter;
+	for( ;; ) {
+		WaitForSingleObject(SwrContext->hStartEvent, INFINITE);
+		if( SwrBandStop ) break;
+		// Direct3D may change the main thread FPU precision, so all bands must use the same
+		_control87(SwrContext->fpuControl, _MCW_PC|_MCW_RC);
+		SwrBandFunc();
+		SetEvent(SwrContext->hDoneEvent);
+	}
+	return 0;
+}
+
+static bool StartBandTaskSWR(SWR_CONTEXT *ctx) {
+	if( ctx->hThread != NULL ) {
+		return true;
+	}
+	ctx->hStartEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	ctx->hDoneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if( ctx->hStartEvent != NULL && ctx->hDoneEvent != NULL ) {
+		ctx->hThread = CreateThread(NULL, 0, BandTaskSWR, ctx, 0, NULL);
+	}
+	if( ctx->hThread == NULL ) {
+		if( ctx->hStartEvent != NULL ) CloseHandle(ctx->hStartEvent);
+		if( ctx->hDoneEvent != NULL ) CloseHandle(ctx->hDoneEvent);
+		ctx->hStartEvent = ctx->hDoneEvent = NULL;
+		return false;
+	}
+	return true;
+}
+
+// The thread is waiting for the start event between the drawings, so it
+// is woken up with the stop flag set, and it quits instead of drawing
+static void StopBandTaskSWR(SWR_CONTEXT *ctx) {
+	if( ctx->hThread == NULL ) {
+		return;
+	}
+	SwrBandStop = true;
+	SetEvent(ctx->hStartEvent);
+	WaitForSingleObject(ctx->hThread, INFINITE);
+	SwrBandStop = false;
+	CloseHandle(ctx->hThread);
+	CloseHandle(ctx->hStartEvent);
+	CloseHandle(ctx->hDoneEvent);
+	ctx->hThread = ctx->hStartEvent = ctx->hDoneEvent = NULL;
+}
+
+static int GetThreadsCountSWR(int height) {
+	int count = SwrThreadsCount;
+	if( count == 0 ) {
+		SYSTEM_INFO sysInfo;
+		GetSystemInfo(&sysInfo);
+		count = sysInfo.dwNumberOfProcessors;
+	}
+	CLAMPG(count, height / SWR_MIN_BAND_SIZE);
+	CLAMP(count, 1, SWR_MAX_THREADS);
+	return count;
+}
+
+// Checks if polygon lines intersect the band. The line range is not calculated
+// by xgen functions here, so their edge tracing is not wasted for other bands
+static bool IsPolyInBandSWR(__int16 *bufPtr, int stride) {
+	int ptCount = *bufPtr++;
+	int yMin = bufPtr[1];
+	int yMax = bufPtr[1];
+	for( int i = 1; i < ptCount; ++i ) {
+		int y = bufPtr[i * stride + 1];
+		CLAMPG(yMin, y);
+		CLAMPL(yMax, y);
+	}
+	return yMax > SwrContext->bandY0 && yMin < SwrContext->bandY1;
+}
+
+// Clips lines produced by xgen function to the band
+static bool ClipPolyBandSWR() {
+	CLAMPL(SwrContext->y0, SwrContext->bandY0);
+	CLAMPG(SwrContext->y1, SwrContext->bandY1);
+	return SwrContext->y0 < SwrContext->y1;
+}
+
+void GetBandSWR(int *y0, int *y1) {
+	*y0 = SwrContext->bandY0;
+	*y1 = SwrContext->bandY1;
+}
+
+void DrawBandsSWR(void (*drawFunc)()) {
+	HANDLE doneEvents[SWR_MAX_THREADS];
+	int i, count, bandSize, lines;
+	int height = SwrHeight;
+
+	// edge buffers must cover both the surface and the viewport lines,
+	// they grow with the resolution, so there is no fixed lines limit
+	lines = MAX(height, PhdWinMinY + PhdWinMaxY + 1);
+	if( height <= 0 || !ReserveContextSWR(&SwrContexts[0], lines) ) {
+		return;
+	}
+
+	count = GetThreadsCountSWR(height);
+	for( i = 1; i < count; ++i ) {
+		if( !ReserveContextSWR(&SwrContexts[i], lines) || !StartBandTaskSWR(&SwrContexts[i]) ) {
+			break;
+		}
+	}
+	count = i;
+	// the threads are not needed anymore, if the threads count is reduced
+	for( ; i < SWR_MAX_THREADS; ++i ) {
+		StopBandTaskSWR(&SwrContexts[i]);
+	}
+
+	// each context draws the whole sorted list into its own band,
+	// so the painter's order is preserved in every band
+	bandSize = (height + count - 1) / count;
+	SwrBandFunc = drawFunc;
+	for( i = 0; i < count; ++i ) {
+		SwrContexts[i].bandY0 = bandSize * i;
+		SwrContexts[i].bandY1 = MIN(bandSize * (i + 1), height);
+	}
+	for( i = 1; i < count; ++i ) {
+		doneEvents[i - 1] = SwrContexts[i].hDoneEvent;
+		SwrContexts[i].fpuControl = _control87(0, 0);
+		SetEvent(SwrContexts[i].hStartEvent);
+	}
+	drawFunc();
+	if( count > 1 ) {
+		WaitForMultipleObjects(count - 1, doneEvents, TRUE, INFINITE);
+	}
+}
+
+void FreeBandsSWR() {
+	for( int i = 0; i < SWR_MAX_THREADS; ++i ) {
+		StopBandTaskSWR(&SwrContexts[i]);
+		free(SwrContexts[i].xBuffer);
+		SwrContexts[i].xBuffer = NULL;
+		SwrContexts[i].xBufferLines = 0;
+	}
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl draw_poly_line(__int16 *bufPtr) {
 	int i, j;
 	int x0, y0, x1, y1;
@@ -171,6 +374,9 @@ void __cdecl draw_poly_line(__int16 *bufPtr) {
 	ySize = y1 - y0;
 
 	if( (xSize|ySize) == 0 ) {
+#ifdef FEATURE_RENDER_IMPROVED
+		if( y0 >= SwrContext->bandY0 && y0 < SwrContext->bandY1 )
+#endif // FEATURE_RENDER_IMPROVED
 		*drawPtr = colorIdx;
 		return;
 	}
@@ -204,8 +410,16 @@ void __cdecl draw_poly_line(__int16 *bufPtr) {
 	partTotal = 0;
 	part = PHD_ONE * j / i;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	BYTE *bandPtr0 = PrintSurfacePtr + SwrContext->bandY0 * SwrPitch;
+	BYTE *bandPtr1 = PrintSurfacePtr + SwrContext->bandY1 * SwrPitch;
+#endif // FEATURE_RENDER_IMPROVED
+
 	while( i-- ) {
 		partTotal += part;
+#ifdef FEATURE_RENDER_IMPROVED
+		if( drawPtr >= bandPtr0 && drawPtr < bandPtr1 )
+#endif // FEATURE_RENDER_IMPROVED
 		*drawPtr = colorIdx;
 		drawPtr += colAdd;
 		if( partTotal >= PHD_ONE ) {
@@ -216,27 +430,47 @@ void __cdecl draw_poly_line(__int16 *bufPtr) {
 }
 
 void __cdecl draw_poly_flat(__int16 *bufPtr) {
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsPolyInBandSWR(bufPtr + 1, sizeof(XGEN_X)/sizeof(__int16)) && xgen_x(bufPtr + 1) && ClipPolyBandSWR() )
+#else // FEATURE_RENDER_IMPROVED
 	if( xgen_x(bufPtr + 1) )
+#endif // FEATURE_RENDER_IMPROVED
 		flatA(XGen_y0, XGen_y1, *bufPtr);
 }
 
 void __cdecl draw_poly_trans(__int16 *bufPtr) {
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsPolyInBandSWR(bufPtr + 1, sizeof(XGEN_X)/sizeof(__int16)) && xgen_x(bufPtr + 1) && ClipPolyBandSWR() )
+#else // FEATURE_RENDER_IMPROVED
 	if( xgen_x(bufPtr + 1) )
+#endif // FEATURE_RENDER_IMPROVED
 		transA(XGen_y0, XGen_y1, *bufPtr);
 }
 
 void __cdecl draw_poly_gouraud(__int16 *bufPtr) {
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsPolyInBandSWR(bufPtr + 1, sizeof(XGEN_XG)/sizeof(__int16)) && xgen_xg(bufPtr + 1) && ClipPolyBandSWR() )
+#else // FEATURE_RENDER_IMPROVED
 	if( xgen_xg(bufPtr + 1) )
+#endif // FEATURE_RENDER_IMPROVED
 		gourA(XGen_y0, XGen_y1, *bufPtr);
 }
 
 void __cdecl draw_poly_gtmap(__int16 *bufPtr) {
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsPolyInBandSWR(bufPtr + 1, sizeof(XGEN_XGUV)/sizeof(__int16)) && xgen_xguv(bufPtr + 1) && ClipPolyBandSWR() )
+#else // FEATURE_RENDER_IMPROVED
 	if( xgen_xguv(bufPtr + 1) )
+#endif // FEATURE_RENDER_IMPROVED
 		gtmapA(XGen_y0, XGen_y1, TexturePageBuffer8[*bufPtr]);
 }
 
 void __cdecl draw_poly_wgtmap(__int16 *bufPtr) {
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsPolyInBandSWR(bufPtr + 1, sizeof(XGEN_XGUV)/sizeof(__int16)) && xgen_xguv(bufPtr + 1) && ClipPolyBandSWR() )
+#else // FEATURE_RENDER_IMPROVED
 	if( xgen_xguv(bufPtr + 1) )
+#endif // FEATURE_RENDER_IMPROVED
 		wgtmapA(XGen_y0, XGen_y1, TexturePageBuffer8[*bufPtr]);
 }
 
@@ -561,6 +795,156 @@ BOOL __cdecl xgen_xguvpersp_fp(__int16 *bufPtr) {
 	return TRUE;
 }
 
+#ifdef FEATURE_RENDER_IMPROVED
+#define SPAN_BATCH_SIZE		(32)
+#define SPAN_MAX_BATCHES	(256) // up to 8192 pixels per span
+
+// Draws pixels of the span segment. If isDouble is set, each texel is drawn twice
+template <bool isDouble, bool colorKey>
+static inline __attribute__((always_inline)) void DrawSpanSegment(BYTE *linePtr, int pixCount, BYTE *texPage,
+								   int &gRef, int gAdd, int u0, int u0Add, int v0, int v0Add)
+{
+	BYTE colorIdx;
+	const int step = isDouble ? 2 : 1;
+	int g = gRef; // local copy, so it is not reloaded after each store
+	gAdd *= step;
+	u0Add *= step;
+	v0Add *= step;
+
+	for( ; pixCount > 0; pixCount -= step, linePtr += step ) {
+		colorIdx = texPage[BYTE2(v0)*256 + BYTE2(u0)];
+		if( !colorKey || colorIdx != 0 ) {
+			colorIdx = DepthQTable[BYTE2(g)].index[colorIdx];
+			linePtr[0] = colorIdx;
+			if( isDouble ) linePtr[1] = colorIdx;
+		}
+		g += gAdd;
+		u0 += u0Add;
+		v0 += v0Add;
+	}
+	gRef = g;
+}
+
+template <bool colorKey>
+static inline __attribute__((always_inline)) void DrawSpanSegment(BYTE *linePtr, int pixCount, BYTE *texPage,
+								   int &g, int gAdd, int u0, int u0Add, int v0, int v0Add)
+{
+	// the texels are doubled if they are changed slowly
+	if( (ABS(u0Add) + ABS(v0Add)) < (PHD_ONE / 2) ) {
+		DrawSpanSegment<true, colorKey>(linePtr, pixCount, texPage, g, gAdd, u0, u0Add, v0, v0Add);
+	} else {
+		DrawSpanSegment<false, colorKey>(linePtr, pixCount, texPage, g, gAdd, u0, u0Add, v0, v0Add);
+	}
+}
+
+// The same algorithm as gtmap_persp32_fp/wgtmap_persp32_fp, but perspective
+// divides for all 32 pixels batches of the span are done first by SSE2 pairs.
+// The divides are exact, but done in doubles, while the scalar code is built
+// for x87, so rarely a texel may differ. Run "-spanbench" to count them
+template <bool colorKey>
+static SSE2_FUNC bool gtmap_persp32_SSE2(int y0, int y1, BYTE *texPage) {
+	double uArr[SPAN_MAX_BATCHES + 3], vArr[SPAN_MAX_BATCHES + 3], rhwArr[SPAN_MAX_BATCHES + 3];
+	int uDiv[SPAN_MAX_BATCHES + 3], vDiv[SPAN_MAX_BATCHES + 3];
+	int i, x, xSize, ySize, batchCount, divCount;
+	int g, gAdd, u0Add, v0Add;
+	double u, v, rhw, uAdd, vAdd, rhwAdd;
+	BYTE *drawPtr, *linePtr;
+	XBUF_XGUVP *xbuf;
+
+	ySize = y1 - y0;
+	if( ySize <= 0 )
+		return true;
+
+	xbuf = (XBUF_XGUVP *)XBuffer + y0;
+	drawPtr = PrintSurfacePtr + y0 * SwrPitch;
+
+	// too wide spans are left for the scalar code
+	for( i = 0; i < ySize; ++i ) {
+		if( (xbuf[i].x1 / PHD_ONE - xbuf[i].x0 / PHD_ONE) / SPAN_BATCH_SIZE > SPAN_MAX_BATCHES )
+			return false;
+	}
+
+	for( ; ySize > 0; --ySize, ++xbuf, drawPtr += SwrPitch ) {
+		x = xbuf->x0 / PHD_ONE;
+		xSize = (xbuf->x1 / PHD_ONE) - x;
+		if( xSize <= 0 )
+			continue;
+		batchCount = xSize / SPAN_BATCH_SIZE;
+
+		g = xbuf->g0;
+		u = xbuf->u0;
+		v = xbuf->v0;
+		rhw = xbuf->rhw0;
+		gAdd = (xbuf->g1 - g) / xSize;
+		linePtr = drawPtr + x;
+
+		// collect u/v/rhw at the batch bounds, the last one is the span end
+		uArr[0] = u;
+		vArr[0] = v;
+		rhwArr[0] = rhw;
+		if( batchCount > 0 ) {
+			uAdd = (xbuf->u1 - u) / (double)xSize * double(SPAN_BATCH_SIZE);
+			vAdd = (xbuf->v1 - v) / (double)xSize * double(SPAN_BATCH_SIZE);
+			rhwAdd = (xbuf->rhw1 - rhw) / (double)xSize * double(SPAN_BATCH_SIZE);
+			for( i = 1; i <= batchCount; ++i ) {
+				uArr[i] = (u += uAdd);
+				vArr[i] = (v += vAdd);
+				rhwArr[i] = (rhw += rhwAdd);
+			}
+		}
+		divCount = batchCount + 1;
+		uArr[divCount] = xbuf->u1;
+		vArr[divCount] = xbuf->v1;
+		rhwArr[divCount] = xbuf->rhw1;
+		++divCount;
+		if( divCount & 1 ) { // pad the last pair
+			uArr[divCount] = vArr[divCount] = 0.0;
+			rhwArr[divCount] = 1.0;
+		}
+
+		// do all perspective divides of the span
+		for( i = 0; i < divCount; i += 2 ) {
+			__m128d half = _mm_set1_pd(PHD_HALF);
+			__m128d rhwPair = _mm_loadu_pd(&rhwArr[i]);
+			__m128i uPair = _mm_cvttpd_epi32(_mm_div_pd(_mm_mul_pd(half, _mm_loadu_pd(&uArr[i])), rhwPair));
+			__m128i vPair = _mm_cvttpd_epi32(_mm_div_pd(_mm_mul_pd(half, _mm_loadu_pd(&vArr[i])), rhwPair));
+			_mm_storel_epi64((__m128i *)&uDiv[i], uPair);
+			_mm_storel_epi64((__m128i *)&vDiv[i], vPair);
+		}
+
+		// draw 32 pixels batches
+		for( i = 0; i < batchCount; ++i ) {
+			u0Add = (uDiv[i+1] - uDiv[i]) / SPAN_BATCH_SIZE;
+			v0Add = (vDiv[i+1] - vDiv[i]) / SPAN_BATCH_SIZE;
+			DrawSpanSegment<colorKey>(linePtr, SPAN_BATCH_SIZE, texPage, g, gAdd, uDiv[i], u0Add, vDiv[i], v0Add);
+			linePtr += SPAN_BATCH_SIZE;
+		}
+		xSize -= batchCount * SPAN_BATCH_SIZE;
+
+		// draw the rest of the span
+		int u0 = uDiv[batchCount];
+		int v0 = vDiv[batchCount];
+		if( xSize > 1 ) {
+			u0Add = (uDiv[batchCount+1] - u0) / xSize;
+			v0Add = (vDiv[batchCount+1] - v0) / xSize;
+			int pixCount = xSize & ~1;
+			DrawSpanSegment<colorKey>(linePtr, pixCount, texPage, g, gAdd, u0, u0Add, v0, v0Add);
+			u0 += u0Add * pixCount;
+			v0 += v0Add * pixCount;
+			linePtr += pixCount;
+			xSize -= pixCount;
+		}
+		if( xSize != 0 ) { // xSize == 1
+			BYTE colorIdx = texPage[BYTE2(v0)*256 + BYTE2(u0)];
+			if( !colorKey || colorIdx != 0 ) {
+				*linePtr = DepthQTable[BYTE2(g)].index[colorIdx];
+			}
+		}
+	}
+	return true;
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl gtmap_persp32_fp(int y0, int y1, BYTE *texPage) {
 	int batchSize, batchCounter;
 	int x, xSize, ySize;
@@ -574,6 +958,11 @@ void __cdecl gtmap_persp32_fp(int y0, int y1, BYTE *texPage) {
 	if( ySize <= 0 )
 		return;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsSimdAvailable() && gtmap_persp32_SSE2<false>(y0, y1, texPage) )
+		return;
+#endif // FEATURE_RENDER_IMPROVED
+
 	xbuf = (XBUF_XGUVP *)XBuffer + y0;
 	drawPtr = PrintSurfacePtr + y0 * SwrPitch;
 
@@ -692,6 +1081,11 @@ void __cdecl wgtmap_persp32_fp(int y0, int y1, BYTE *texPage) {
 	if( ySize <= 0 )
 		return;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsSimdAvailable() && gtmap_persp32_SSE2<true>(y0, y1, texPage) )
+		return;
+#endif // FEATURE_RENDER_IMPROVED
+
 	xbuf = (XBUF_XGUVP *)XBuffer + y0;
 	drawPtr = PrintSurfacePtr + y0 * SwrPitch;
 
@@ -812,12 +1206,20 @@ void __cdecl wgtmap_persp32_fp(int y0, int y1, BYTE *texPage) {
 }
 
 void __cdecl draw_poly_gtmap_persp(__int16 *bufPtr) {
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsPolyInBandSWR(bufPtr + 1, sizeof(XGEN_XGUVP)/sizeof(__int16)) && xgen_xguvpersp_fp(bufPtr + 1) && ClipPolyBandSWR() )
+#else // FEATURE_RENDER_IMPROVED
 	if( xgen_xguvpersp_fp(bufPtr + 1) )
+#endif // FEATURE_RENDER_IMPROVED
 		gtmap_persp32_fp(XGen_y0, XGen_y1, TexturePageBuffer8[*bufPtr]);
 }
 
 void __cdecl draw_poly_wgtmap_persp(__int16 *bufPtr) {
+#ifdef FEATURE_RENDER_IMPROVED
+	if( IsPolyInBandSWR(bufPtr + 1, sizeof(XGEN_XGUVP)/sizeof(__int16)) && xgen_xguvpersp_fp(bufPtr + 1) && ClipPolyBandSWR() )
+#else // FEATURE_RENDER_IMPROVED
 	if( xgen_xguvpersp_fp(bufPtr + 1) )
+#endif // FEATURE_RENDER_IMPROVED
 		wgtmap_persp32_fp(XGen_y0, XGen_y1, TexturePageBuffer8[*bufPtr]);
 }
 
@@ -27,6 +27,12 @@
 /*
  * Function list
  */
+#ifdef FEATURE_RENDER_IMPROVED
+void GetBandSWR(int *y0, int *y1);
+void DrawBandsSWR(void (*drawFunc)());
+void FreeBandsSWR();
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl draw_poly_line(__int16 *bufPtr); // 0x00402960
 void __cdecl draw_poly_flat(__int16 *bufPtr); // 0x00402B00
 void __cdecl draw_poly_trans(__int16 *bufPtr); // 0x00402B40
@@ -21,6 +21,7 @@
 
 #include "global/precompiled.h"
 #include "3dsystem/3dinsert.h"
+#include "3dsystem/3d_gen.h"
 #include "specific/hwr.h"
 #include "global/vars.h"
 
@@ -167,6 +168,9 @@ bool InsertObjectEM(__int16 *ptrObj, int vtxCount, D3DCOLOR tint, PHD_UV *em_uv)
 void __cdecl InsertGourQuad(int x0, int y0, int x1, int y1, int z, D3DCOLOR color0, D3DCOLOR color1, D3DCOLOR color2, D3DCOLOR color3) {
 	double rhw, sz;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -390,6 +394,9 @@ __int16 *__cdecl InsertObjectGT4(__int16 *ptrObj, int number, SORTTYPE sortType)
 
 			if( clipOR == 0 ) {
 				zv = CalculatePolyZ(sortType, vtx0->zv, vtx1->zv, vtx2->zv, vtx3->zv);
+#ifdef FEATURE_RENDER_IMPROVED
+				phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 				Sort3dPtr->_0 = (DWORD)Info3dPtr;
 				Sort3dPtr->_1 = MAKE_ZSORT(zv);
 				++Sort3dPtr;
@@ -551,6 +558,9 @@ __int16 *__cdecl InsertObjectGT4(__int16 *ptrObj, int number, SORTTYPE sortType)
 		if( nPoints == 0 ) continue;
 
 		zv = CalculatePolyZ(sortType, vtx0->zv, vtx1->zv, vtx2->zv, vtx3->zv);
+#ifdef FEATURE_RENDER_IMPROVED
+		phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 		Sort3dPtr->_0 = (DWORD)Info3dPtr;
 		Sort3dPtr->_1 = MAKE_ZSORT(zv);
 		++Sort3dPtr;
@@ -621,6 +631,9 @@ __int16 *__cdecl InsertObjectGT3(__int16 *ptrObj, int number, SORTTYPE sortType)
 
 			if( clipOR == 0 ) {
 				zv = CalculatePolyZ(sortType, vtx0->zv, vtx1->zv, vtx2->zv);
+#ifdef FEATURE_RENDER_IMPROVED
+				phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 				Sort3dPtr->_0 = (DWORD)Info3dPtr;
 				Sort3dPtr->_1 = MAKE_ZSORT(zv);
 				++Sort3dPtr;
@@ -749,6 +762,9 @@ __int16 *__cdecl InsertObjectGT3(__int16 *ptrObj, int number, SORTTYPE sortType)
 		if( nPoints == 0 ) continue;
 
 		zv = CalculatePolyZ(sortType, vtx0->zv, vtx1->zv, vtx2->zv);
+#ifdef FEATURE_RENDER_IMPROVED
+		phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 		Sort3dPtr->_0 = (DWORD)Info3dPtr;
 		Sort3dPtr->_1 = MAKE_ZSORT(zv);
 		++Sort3dPtr;
@@ -987,6 +1003,9 @@ __int16 *__cdecl InsertObjectG4(__int16 *ptrObj, int number, SORTTYPE sortType)
 			continue;
 
 		zv = CalculatePolyZ(sortType, vtx0->zv, vtx1->zv, vtx2->zv, vtx3->zv);
+#ifdef FEATURE_RENDER_IMPROVED
+		phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 		Sort3dPtr->_0 = (DWORD)Info3dPtr;
 		Sort3dPtr->_1 = MAKE_ZSORT(zv);
 		++Sort3dPtr;
@@ -1087,6 +1106,9 @@ __int16 *__cdecl InsertObjectG3(__int16 *ptrObj, int number, SORTTYPE sortType)
 			continue;
 
 		zv = CalculatePolyZ(sortType, vtx0->zv, vtx1->zv, vtx2->zv);
+#ifdef FEATURE_RENDER_IMPROVED
+		phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 		Sort3dPtr->_0 = (DWORD)Info3dPtr;
 		Sort3dPtr->_1 = MAKE_ZSORT(zv);
 		++Sort3dPtr;
@@ -1260,6 +1282,9 @@ void __cdecl InsertTrans8(PHD_VBUF *vbuf, __int16 shade) {
 	polyZ /= nVtx;
 #endif // FEATURE_VIDEOFX_IMPROVED
 
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(polyZ);
 	++Sort3dPtr;
@@ -1277,6 +1302,9 @@ void __cdecl InsertTrans8(PHD_VBUF *vbuf, __int16 shade) {
 }
 
 void __cdecl InsertTransQuad(int x, int y, int width, int height, int z) {
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(PhdNearZ + 8*z);
 	++Sort3dPtr;
@@ -1303,6 +1331,9 @@ void __cdecl InsertTransQuad(int x, int y, int width, int height, int z) {
 }
 
 void __cdecl InsertFlatRect(int x0, int y0, int x1, int y1, int z, BYTE colorIdx) {
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -1323,6 +1354,9 @@ void __cdecl InsertFlatRect(int x0, int y0, int x1, int y1, int z, BYTE colorIdx
 }
 
 void __cdecl InsertLine(int x0, int y0, int x1, int y1, int z, BYTE colorIdx) {
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -1337,6 +1371,40 @@ void __cdecl InsertLine(int x0, int y0, int x1, int y1, int z, BYTE colorIdx) {
 	++SurfaceCount;
 }
 
+static void SetClippedPolyVertices(int vtxCount) {
+	D3DCOLOR color;
+	double tu, tv;
+
+	for( int i = 0; i < vtxCount; ++i ) {
+		color = shadeColor(0xFF, 0xFF, 0xFF, 0xFF, (DWORD)VBuffer[i].g, true);
+
+		tu = VBuffer[i].u / VBuffer[i].rhw / (double)PHD_ONE;
+		tv = VBuffer[i].v / VBuffer[i].rhw / (double)PHD_ONE;
+		CLAMP(tu, 0.0, 1.0);
+		CLAMP(tv, 0.0, 1.0);
+
+		VBufferD3D[i].sx = VBuffer[i].x;
+		VBufferD3D[i].sy = VBuffer[i].y;
+		VBufferD3D[i].sz = FltResZBuf - FltResZORhw * VBuffer[i].rhw;
+		VBufferD3D[i].rhw = VBuffer[i].rhw;
+		VBufferD3D[i].color = color;
+		VBufferD3D[i].tu = tu;
+		VBufferD3D[i].tv = tv;
+	}
+}
+
+#ifdef FEATURE_RENDER_IMPROVED
+static void DrawTexturedZBuffered(PHD_TEXTURE *texture, int vtxCount) {
+#ifdef FEATURE_VIDEOFX_IMPROVED
+	HWR_TEXHANDLE texSource = texture->tpage == (UINT16)~0 ? GetEnvmapTextureHandle() : HWR_PageHandles[texture->tpage];
+#else // !FEATURE_VIDEOFX_IMPROVED
+	HWR_TEXHANDLE texSource = HWR_PageHandles[texture->tpage];
+#endif // !FEATURE_VIDEOFX_IMPROVED
+	// opaque ones are drawn front-to-back later, if it's possible
+	HWR_DrawTexturedPoly(texSource, texture->drawtype != DRAW_Opaque, VBufferD3D, vtxCount);
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl InsertGT3_ZBuffered(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2, PHD_TEXTURE *texture, PHD_UV *uv0, PHD_UV *uv1, PHD_UV *uv2) {
 	char clipOR, clipAND;
 	POINT_INFO points[3];
@@ -1377,6 +1445,9 @@ void __cdecl InsertGT3_ZBuffered(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2,
 			VBufferD3D[2].tu = (double)uv2->u / (double)PHD_ONE;
 			VBufferD3D[2].tv = (double)uv2->v / (double)PHD_ONE;
 
+#ifdef FEATURE_RENDER_IMPROVED
+			DrawTexturedZBuffered(texture, 3);
+#else // FEATURE_RENDER_IMPROVED
 #ifdef FEATURE_VIDEOFX_IMPROVED
 			HWR_TexSource(texture->tpage == (UINT16)~0 ? GetEnvmapTextureHandle() : HWR_PageHandles[texture->tpage]);
 #else // !FEATURE_VIDEOFX_IMPROVED
@@ -1385,6 +1456,7 @@ void __cdecl InsertGT3_ZBuffered(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2,
 			HWR_EnableColorKey(texture->drawtype != DRAW_Opaque);
 
 			HWR_DrawPrimitive(D3DPT_TRIANGLELIST, VBufferD3D, 3, true);
+#endif // FEATURE_RENDER_IMPROVED
 			return;
 		}
 
@@ -1450,6 +1522,10 @@ void __cdecl InsertGT3_ZBuffered(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2,
 	nPoints = XYGUVClipper(nPoints, VBuffer);
 	if( nPoints == 0 ) return;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	SetClippedPolyVertices(nPoints);
+	DrawTexturedZBuffered(texture, nPoints);
+#else // FEATURE_RENDER_IMPROVED
 #ifdef FEATURE_VIDEOFX_IMPROVED
 	HWR_TexSource(texture->tpage == (UINT16)~0 ? GetEnvmapTextureHandle() : HWR_PageHandles[texture->tpage]);
 #else // !FEATURE_VIDEOFX_IMPROVED
@@ -1457,32 +1533,14 @@ void __cdecl InsertGT3_ZBuffered(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2,
 #endif // !FEATURE_VIDEOFX_IMPROVED
 	HWR_EnableColorKey(texture->drawtype != DRAW_Opaque);
 	DrawClippedPoly_Textured(nPoints);
+#endif // FEATURE_RENDER_IMPROVED
 }
 
 void __cdecl DrawClippedPoly_Textured(int vtxCount) {
-	D3DCOLOR color;
-	double tu, tv;
-
 	if( vtxCount == 0 )
 		return;
 
-	for( int i = 0; i < vtxCount; ++i ) {
-		color = shadeColor(0xFF, 0xFF, 0xFF, 0xFF, (DWORD)VBuffer[i].g, true);
-
-		tu = VBuffer[i].u / VBuffer[i].rhw / (double)PHD_ONE;
-		tv = VBuffer[i].v / VBuffer[i].rhw / (double)PHD_ONE;
-		CLAMP(tu, 0.0, 1.0);
-		CLAMP(tv, 0.0, 1.0);
-
-		VBufferD3D[i].sx = VBuffer[i].x;
-		VBufferD3D[i].sy = VBuffer[i].y;
-		VBufferD3D[i].sz = FltResZBuf - FltResZORhw * VBuffer[i].rhw;
-		VBufferD3D[i].rhw = VBuffer[i].rhw;
-		VBufferD3D[i].color = color;
-		VBufferD3D[i].tu = tu;
-		VBufferD3D[i].tv = tv;
-	}
-
+	SetClippedPolyVertices(vtxCount);
 	HWR_DrawPrimitive(D3DPT_TRIANGLEFAN, VBufferD3D, vtxCount, true);
 }
 
@@ -1528,6 +1586,9 @@ void __cdecl InsertGT4_ZBuffered(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2,
 		VBufferD3D[3].tu = (double)texture->uv[3].u / (double)PHD_ONE;
 		VBufferD3D[3].tv = (double)texture->uv[3].v / (double)PHD_ONE;
 
+#ifdef FEATURE_RENDER_IMPROVED
+		DrawTexturedZBuffered(texture, 4);
+#else // FEATURE_RENDER_IMPROVED
 #ifdef FEATURE_VIDEOFX_IMPROVED
 		HWR_TexSource(texture->tpage == (UINT16)~0 ? GetEnvmapTextureHandle() : HWR_PageHandles[texture->tpage]);
 #else // !FEATURE_VIDEOFX_IMPROVED
@@ -1536,6 +1597,7 @@ void __cdecl InsertGT4_ZBuffered(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2,
 		HWR_EnableColorKey(texture->drawtype != DRAW_Opaque);
 
 		HWR_DrawPrimitive(D3DPT_TRIANGLEFAN, VBufferD3D, 4, true);
+#endif // FEATURE_RENDER_IMPROVED
 	}
 	else if( (clipOR < 0 && visible_zclip(vtx0, vtx1, vtx2)) ||
 			 (clipOR > 0 && VBUF_VISIBLE(*vtx0, *vtx1, *vtx2)) )
@@ -1908,6 +1970,9 @@ void __cdecl InsertGT3_Sorted(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2, PH
 
 		if( clipOR == 0 ) {
 			zv = CalculatePolyZ(sortType, vtx0->zv, vtx1->zv, vtx2->zv);
+#ifdef FEATURE_RENDER_IMPROVED
+			phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 			Sort3dPtr->_0 = (DWORD)Info3dPtr;
 			Sort3dPtr->_1 = MAKE_ZSORT(zv);
 			++Sort3dPtr;
@@ -2024,6 +2089,9 @@ void __cdecl InsertGT3_Sorted(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2, PH
 void __cdecl InsertClippedPoly_Textured(int vtxCount, float z, __int16 polyType, __int16 texPage) {
 	double tu, tv;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -2065,6 +2133,9 @@ void __cdecl InsertGT4_Sorted(PHD_VBUF *vtx0, PHD_VBUF *vtx1, PHD_VBUF *vtx2, PH
 
 	if( clipOR == 0 && VBUF_VISIBLE(*vtx0, *vtx1, *vtx2) ) {
 		zv = CalculatePolyZ(sortType, vtx0->zv, vtx1->zv, vtx2->zv, vtx3->zv);
+#ifdef FEATURE_RENDER_IMPROVED
+		phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 		Sort3dPtr->_0 = (DWORD)Info3dPtr;
 		Sort3dPtr->_1 = MAKE_ZSORT(zv);
 		++Sort3dPtr;
@@ -2286,6 +2357,9 @@ __int16 *__cdecl InsertObjectG4_Sorted(__int16 *ptrObj, int number, SORTTYPE sor
 void __cdecl InsertPoly_Gouraud(int vtxCount, float z, int red, int green, int blue, __int16 polyType) {
 	BYTE alpha = ( polyType == POLY_HWR_trans ) ? 0x80 : 0xFF;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -2529,6 +2603,9 @@ void __cdecl InsertFlatRect_Sorted(int x0, int y0, int x1, int y1, int z, BYTE c
 	if( y1 > PhdWinMinY + PhdWinHeight )
 		x1 = PhdWinMinY + PhdWinHeight;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -2565,6 +2642,9 @@ void __cdecl InsertLine_Sorted(int x0, int y0, int x1, int y1, int z, BYTE color
 	double rhw, sz;
 	D3DCOLOR color;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -2650,6 +2730,9 @@ void __cdecl InsertTransQuad_Sorted(int x, int y, int width, int height, int z)
 	float x0, y0, x1, y1;
 	double rhw, sz;
 
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -2692,6 +2775,9 @@ void __cdecl InsertSprite(int z, int x0, int y0, int x1, int y1, int spriteIdx,
 #else // FEATURE_VIDEOFX_IMPROVED
 void __cdecl InsertSprite(int z, int x0, int y0, int x1, int y1, int spriteIdx, __int16 shade) {
 #endif // FEATURE_VIDEOFX_IMPROVED
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = MAKE_ZSORT(z);
 	++Sort3dPtr;
@@ -21,6 +21,7 @@
 
 #include "global/precompiled.h"
 #include "3dsystem/scalespr.h"
+#include "3dsystem/3d_out.h"
 #include "specific/output.h"
 #include "global/vars.h"
 
@@ -285,6 +286,21 @@ void __cdecl draw_scaled_spriteC(__int16 *ptrObj) {
 	CLAMPG(x2, PhdWinMaxX + 1);
 	CLAMPG(y2, PhdWinMaxY + 1);
 
+#ifdef FEATURE_RENDER_IMPROVED
+	// the sprite may be drawn by several threads, each one in its own band
+	int bandY0, bandY1;
+	GetBandSWR(&bandY0, &bandY1);
+	bandY0 -= PhdWinMinY;
+	bandY1 -= PhdWinMinY;
+	if( y1 < bandY0 ) {
+		vBase += vAdd * (bandY0 - y1);
+		y1 = bandY0;
+	}
+	CLAMPG(y2, bandY1);
+	if( y1 >= y2 )
+		return;
+#endif // FEATURE_RENDER_IMPROVED
+
 	width = x2 - x1;
 	height = y2 - y1;
 
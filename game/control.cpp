@@ -34,10 +34,18 @@
 #include "specific/sndpc.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_PROFILER
+#include "modding/profiler.h"
+#endif // FEATURE_PROFILER
+
 #ifdef FEATURE_BACKGROUND_IMPROVED
 #include "modding/pause.h"
 #endif // FEATURE_BACKGROUND_IMPROVED
 
+#ifdef FEATURE_DEMO_IMPROVED
+#include "modding/demo_stream.h"
+#endif // FEATURE_DEMO_IMPROVED
+
 #ifdef FEATURE_INPUT_IMPROVED
 #include "modding/joy_output.h"
 #endif // FEATURE_INPUT_IMPROVED
@@ -47,6 +55,9 @@ int __cdecl ControlPhase(int nTicks, BOOL demoMode) {
 	int id = -1;
 	int next = -1;
 	int result = 0;
+#ifdef FEATURE_PROFILER
+	PROFILER_SCOPE(PROF_ControlPhase);
+#endif // FEATURE_PROFILER
 
 	CLAMPG(nTicks, 5 * TICKS_PER_FRAME);
 	for( tickCount += nTicks; tickCount > 0; tickCount -= TICKS_PER_FRAME ) {
@@ -67,12 +78,23 @@ int __cdecl ControlPhase(int nTicks, BOOL demoMode) {
 			if( InputStatus ) {
 				return GF_GameFlow.onDemo_Interrupt;
 			}
+#ifdef FEATURE_DEMO_IMPROVED
+			if( IsDemoStreamPlaying() ) {
+				InputStatus = DemoStreamGetInput();
+			} else {
+				GetDemoInput();
+			}
+#else // FEATURE_DEMO_IMPROVED
 			GetDemoInput();
+#endif // FEATURE_DEMO_IMPROVED
 			if( InputStatus == (DWORD)~0 ) {
 				InputStatus = 0;
 				return GF_GameFlow.onDemo_End;
 			}
 		} else {
+#ifdef FEATURE_DEMO_IMPROVED
+			InputStatus = DemoStreamRecordInput(InputStatus);
+#endif // FEATURE_DEMO_IMPROVED
 			if( CHK_ANY(GF_GameFlow.flags, GFF_NoInputTimeout) ) {
 				if( InputStatus ) {
 					NoInputCounter = 0;
@@ -141,6 +163,9 @@ int __cdecl ControlPhase(int nTicks, BOOL demoMode) {
 
 		DynamicLightCount = 0;
 
+#ifdef FEATURE_PROFILER
+		PROFILER_BEGIN(PROF_ItemControl);
+#endif // FEATURE_PROFILER
 		for( id = NextItemActive; id >= 0; id = next ) {
 			next = Items[id].nextActive;
 			// NOTE: there is no IFL_CLEARBODY check in the original code
@@ -148,6 +173,9 @@ int __cdecl ControlPhase(int nTicks, BOOL demoMode) {
 				Objects[Items[id].objectID].control(id);
 			}
 		}
+#ifdef FEATURE_PROFILER
+		PROFILER_END(PROF_ItemControl);
+#endif // FEATURE_PROFILER
 
 		for( id = NextEffectActive; id >= 0; id = next ) {
 			next = Effects[id].next_active;
@@ -156,7 +184,13 @@ int __cdecl ControlPhase(int nTicks, BOOL demoMode) {
 			}
 		}
 
+#ifdef FEATURE_PROFILER
+		PROFILER_BEGIN(PROF_LaraControl);
+#endif // FEATURE_PROFILER
 		LaraControl(0);
+#ifdef FEATURE_PROFILER
+		PROFILER_END(PROF_LaraControl);
+#endif // FEATURE_PROFILER
 		HairControl(0);
 		CalculateCamera();
 		SoundEffects();
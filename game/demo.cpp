@@ -26,17 +26,74 @@
 #include "game/text.h"
 #include "specific/frontend.h"
 #include "specific/game.h"
+#include "specific/utils.h"
 #include "specific/winmain.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_DEMO_IMPROVED
+#include "modding/demo_stream.h"
+#endif // FEATURE_DEMO_IMPROVED
+
 #ifdef FEATURE_HUD_IMPROVED
 extern bool PsxBarPosEnabled;
 DWORD DemoTextMode = 0;
 #endif // FEATURE_HUD_IMPROVED
 
+#ifdef FEATURE_DEMO_IMPROVED
+// NOTE: this function is absent in the original code
+static int StartDemoStream(LPCSTR fileName) {
+	START_INFO streamStart;
+	int levelID = DemoStreamOpen(fileName, &streamStart);
+
+	if( levelID < 0 || levelID >= GF_GameFlow.num_Levels ) {
+		DemoStreamClose();
+		return GF_EXIT_TO_TITLE;
+	}
+
+	// the level is started just like it was started on recording
+	START_INFO *start = &SaveGame.start[levelID];
+	START_INFO startBackup = *start;
+	*start = streamStart;
+	IsTitleLoaded = FALSE;
+
+	if( !InitialiseLevel(levelID, GFL_NORMAL) ) {
+		DemoStreamClose();
+		*start = startBackup;
+		return GF_EXIT_GAME;
+	}
+
+	IsLevelComplete = FALSE;
+	DemoStreamSeed();
+
+	TEXT_STR_INFO *bottomText = T_Print(0, -16, 0, GF_SpecificStringTable[SSI_DemoMode]);
+	T_FlashText(bottomText, 1, 20);
+	T_BottomAlign(bottomText, 1);
+	T_CentreH(bottomText, 1);
+
+	InvDemoMode = TRUE;
+	int result = GameLoop(1);
+	InvDemoMode = FALSE;
+
+	T_RemovePrint(bottomText);
+	S_FadeToBlack();
+	DemoStreamClose();
+
+	*start = startBackup;
+	return result;
+}
+#endif // FEATURE_DEMO_IMPROVED
+
 int __cdecl StartDemo(int levelID) {
 	static int DemoLevelID = 0;
 
+#ifdef FEATURE_DEMO_IMPROVED
+	// NOTE: the streamed demo replaces all demo levels, if it's set in the command line
+	LPCSTR streamName = UT_FindArg("-demoplay");
+	if( streamName != NULL && streamName[0] == ':' ) {
+		return StartDemoStream(streamName + 1);
+	}
+#endif // FEATURE_DEMO_IMPROVED
+
 	if( levelID < 0 && !GF_GameFlow.num_Demos ) {
 		return GF_EXIT_TO_TITLE;
 	}
@@ -28,6 +28,15 @@
 #include "specific/output.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_PROFILER
+#include "modding/profiler.h"
+#endif // FEATURE_PROFILER
+
+#ifdef FEATURE_RENDER_IMPROVED
+#include "modding/anim_cache.h"
+#include "modding/room_pvs.h"
+#endif // FEATURE_RENDER_IMPROVED
+
 #ifdef FEATURE_EXTENDED_LIMITS
 LIGHT_INFO DynamicLights[64];
 int BoundRooms[1024];
@@ -46,6 +55,9 @@ void ResetGoldenLaraAlpha() {
 
 void __cdecl DrawRooms(__int16 currentRoom) {
 	ROOM_INFO *room = &RoomInfo[currentRoom];
+#ifdef FEATURE_PROFILER
+	PROFILER_SCOPE(PROF_DrawRooms);
+#endif // FEATURE_PROFILER
 
 	PhdWinLeft = room->left = 0;
 	PhdWinTop = room->top = 0;
@@ -72,6 +84,9 @@ void __cdecl DrawRooms(__int16 currentRoom) {
 	}
 
 	UnderwaterCamera = room->flags & ROOM_UNDERWATER;
+#ifdef FEATURE_RENDER_IMPROVED
+	SetRoomPvsOrigin(currentRoom);
+#endif // FEATURE_RENDER_IMPROVED
 	GetRoomBounds();
 	MidSort = 0;
 
@@ -191,6 +206,10 @@ void __cdecl GetRoomBounds() {
 
 		for( int i = 0; i < room->doors->wCount; ++i ) {
 			DOOR_INFO *door = &room->doors->door[i];
+#ifdef FEATURE_RENDER_IMPROVED
+			// skip the rooms that cannot be seen from the camera room at all
+			if( !IsRoomPotentiallyVisible(door->room) ) continue;
+#endif // FEATURE_RENDER_IMPROVED
 			if( door->x * (room->x + door->vertex[0].x - MatrixW2V._03)
 				+ door->y * (room->y + door->vertex[0].y - MatrixW2V._13)
 				+ door->z * (room->z + door->vertex[0].z - MatrixW2V._23) < 0 )
@@ -399,6 +418,9 @@ void __cdecl PrintRooms(__int16 roomNumber) {
 	PhdWinTop = room->boundTop;
 	PhdWinBottom = room->boundBottom;
 	S_LightRoom(room);
+#ifdef FEATURE_RENDER_IMPROVED
+	SelectRoomVertexCache(roomNumber);
+#endif // FEATURE_RENDER_IMPROVED
 	if( OutsideCamera > 0 && !CHK_ANY(room->flags, ROOM_INSIDE) ) {
 		S_InsertRoom(room->data, 1);
 	} else {
@@ -529,6 +551,75 @@ void __cdecl DrawSpriteItem(ITEM_INFO *item) {
 void __cdecl DrawDummyItem(ITEM_INFO *item) {
 }
 
+#ifdef FEATURE_RENDER_IMPROVED
+// Draws the item by the unpacked frame rotations. The interpolated frames
+// are blended per bone, so the interpolation matrix stack is not used.
+static void DrawAnimatingItemBones(ITEM_INFO *item, __int16 **frames, int frac, int rate, ANIM_BONE *bones1, ANIM_BONE *bones2, int clip, __int16 *rots) {
+	OBJECT_INFO *obj = &Objects[item->objectID];
+	__int16 **meshPtr = &MeshPtr[obj->meshIndex];
+	int *bonePtr = &AnimBones[obj->boneIndex];
+	DWORD bit = 1;
+
+	if( frac ) {
+		phd_TranslateRel(frames[0][6] + (frames[1][6] - frames[0][6]) * frac / rate,
+						 frames[0][7] + (frames[1][7] - frames[0][7]) * frac / rate,
+						 frames[0][8] + (frames[1][8] - frames[0][8]) * frac / rate);
+		phd_RotAnimBoneInterpolated(&bones1[0], &bones2[0], frac, rate);
+	} else {
+		phd_TranslateRel(frames[0][6], frames[0][7], frames[0][8]);
+		phd_RotAnimBone(&bones1[0]);
+	}
+
+	if( CHK_ANY(item->meshBits, 1) ) {
+#ifdef FEATURE_VIDEOFX_IMPROVED
+		SetMeshReflectState(item->objectID, 0);
+#endif // FEATURE_VIDEOFX_IMPROVED
+		phd_PutPolygons(meshPtr[0], clip);
+#ifdef FEATURE_VIDEOFX_IMPROVED
+		ClearMeshReflectState();
+#endif // FEATURE_VIDEOFX_IMPROVED
+	}
+
+	for( int i = 1; i < obj->nMeshes; ++i ) {
+		DWORD state = *bonePtr;
+		if( CHK_ANY(state, 1) ) {
+			phd_PopMatrix();
+		}
+		if( CHK_ANY(state, 2) ) {
+			phd_PushMatrix();
+		}
+		phd_TranslateRel(bonePtr[1], bonePtr[2], bonePtr[3]);
+		if( frac ) {
+			phd_RotAnimBoneInterpolated(&bones1[i], &bones2[i], frac, rate);
+		} else {
+			phd_RotAnimBone(&bones1[i]);
+		}
+		if( CHK_ANY(state, 0x1C) ) {
+			if( CHK_ANY(state, 0x08) ) {
+				phd_RotY(*(rots++));
+			}
+			if( CHK_ANY(state, 0x04) ) {
+				phd_RotX(*(rots++));
+			}
+			if( CHK_ANY(state, 0x10) ) {
+				phd_RotZ(*(rots++));
+			}
+		}
+		bonePtr += 4;
+		bit <<= 1;
+		if( CHK_ANY(item->meshBits, bit) ) {
+#ifdef FEATURE_VIDEOFX_IMPROVED
+			SetMeshReflectState(item->objectID, i);
+#endif // FEATURE_VIDEOFX_IMPROVED
+			phd_PutPolygons(meshPtr[i], clip);
+#ifdef FEATURE_VIDEOFX_IMPROVED
+			ClearMeshReflectState();
+#endif // FEATURE_VIDEOFX_IMPROVED
+		}
+	}
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl DrawAnimatingItem(ITEM_INFO *item) {
 	static __int16 no_rotation[12] = {0};
 	__int16 *frames[2] = {0};
@@ -552,6 +643,13 @@ void __cdecl DrawAnimatingItem(ITEM_INFO *item) {
 		__int16 *rots = item->data ? (__int16 *)item->data : no_rotation;
 		__int16 **meshPtr = &MeshPtr[obj->meshIndex];
 		int *bonePtr = &AnimBones[obj->boneIndex];
+#ifdef FEATURE_RENDER_IMPROVED
+		ANIM_BONE *bones1 = GetAnimFrameBones(frames[0], obj->nMeshes);
+		ANIM_BONE *bones2 = frac ? GetAnimFrameBones(frames[1], obj->nMeshes) : NULL;
+		if( bones1 != NULL && (!frac || bones2 != NULL) ) {
+			DrawAnimatingItemBones(item, frames, frac, rate, bones1, bones2, clip, rots);
+		} else
+#endif // FEATURE_RENDER_IMPROVED
 		if( frac ) {
 			InitInterpolate(frac, rate);
 			phd_TranslateRel_ID(frames[0][6], frames[0][7], frames[0][8], frames[1][6], frames[1][7], frames[1][8]);
@@ -115,6 +115,19 @@ bool GF_IsFinalLevel(DWORD levelID) {
 	return GF_GetSequenceValue(levelID, GFE_GAMECOMPLETE, NULL, 0);
 }
 
+#ifdef FEATURE_LOADING_IMPROVED
+// NOTE: there is no such function in the original code
+int GF_GetNextLevel(DWORD levelID) {
+	// the same way as GF_DoLevelSequence goes to the next level
+	if( GF_GameFlow.singleLevel >= 0 || levelID + 1 >= GF_GameFlow.num_Levels
+		|| !GF_GetSequenceValue(levelID, GFE_LEVCOMPLETE, NULL, 0) )
+	{
+		return -1;
+	}
+	return levelID + 1;
+}
+#endif // FEATURE_LOADING_IMPROVED
+
 BOOL __cdecl GF_LoadScriptFile(LPCTSTR fileName) {
 	GF_SunsetEnabled = 0;
 
@@ -34,4 +34,8 @@ int __cdecl GF_InterpretSequence(__int16 *seq, GF_LEVEL_TYPE levelType, int seqT
 void __cdecl GF_ModifyInventory(int levelID, BOOL isSecret); // 0x004201A0
 int __cdecl GF_CurrentEvent(); // NOTE: not presented in the original game
 
+#ifdef FEATURE_LOADING_IMPROVED
+int GF_GetNextLevel(DWORD levelID);
+#endif // FEATURE_LOADING_IMPROVED
+
 #endif // GAMEFLOW_H_INCLUDED
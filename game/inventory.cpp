@@ -39,6 +39,10 @@
 #include "specific/sndpc.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_DEMO_IMPROVED
+#include "modding/demo_stream.h"
+#endif // FEATURE_DEMO_IMPROVED
+
 #ifdef FEATURE_INPUT_IMPROVED
 #include "modding/joy_output.h"
 #endif // FEATURE_INPUT_IMPROVED
@@ -161,7 +165,15 @@ int __cdecl Display_Inventory(INVENTORY_MODE invMode) {
 			if( InputStatus ) {
 				return GF_GameFlow.onDemo_Interrupt;
 			}
+#ifdef FEATURE_DEMO_IMPROVED
+			if( IsDemoStreamPlaying() ) {
+				InputStatus = DemoStreamGetInput();
+			} else {
+				GetDemoInput();
+			}
+#else // FEATURE_DEMO_IMPROVED
 			GetDemoInput();
+#endif // FEATURE_DEMO_IMPROVED
 
 			if( InputStatus == (DWORD)-1 ) {
 				return GF_GameFlow.onDemo_End;
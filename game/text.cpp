@@ -27,6 +27,10 @@
 #include "specific/output.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_PROFILER
+#include "modding/profiler.h"
+#endif // FEATURE_PROFILER
+
 #ifdef FEATURE_HUD_IMPROVED
 #include "modding/texture_utils.h"
 
@@ -97,6 +101,9 @@ static const BYTE T_RemapASCII[0x5F] = {
 
 void __cdecl T_InitPrint() {
 	DisplayModeInfo(NULL);
+#ifdef FEATURE_PROFILER
+	ProfilerResetOverlay();
+#endif // FEATURE_PROFILER
 
 	for( int i=0; i<64; ++i )
 		TextInfoTable[i].flags = 0;
@@ -104,6 +104,9 @@ typedef struct {
 #define	TRIGMULT3(a,b,c)	(TRIGMULT2((TRIGMULT2(a,b)),c))
 #define	VBUF_VISIBLE(a,b,c)	(((a).ys-(b).ys)*((c).xs-(b).xs)>=((c).ys-(b).ys)*((a).xs-(b).xs))
 
+// SIMD function attribute (the code is built for plain i386, so SSE2 is enabled per function)
+#define SSE2_FUNC			__attribute__((target("sse2"), force_align_arg_pointer))
+
 // Fast conversion macros
 #define BYTEn(a,b)			(*((BYTE*)&(a)+b))
 #define BYTE0(a)			(LOBYTE(a))
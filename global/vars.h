@@ -562,7 +562,10 @@ extern PHD_SPRITE PhdSpriteInfo[2048];
 #else // FEATURE_EXTENDED_LIMITS
 #define PhdSpriteInfo				ARRAY_(0x0046E308, PHD_SPRITE, [512])
 #endif // FEATURE_EXTENDED_LIMITS
-#if defined(FEATURE_EXTENDED_LIMITS) || defined(FEATURE_VIEW_IMPROVED)
+#if defined(FEATURE_RENDER_IMPROVED)
+extern SORT_ITEM *SortBuffer; // it is reallocated if the poly list grows
+extern __int16 Info3dBuffer[480000];
+#elif defined(FEATURE_EXTENDED_LIMITS) || defined(FEATURE_VIEW_IMPROVED)
 extern SORT_ITEM SortBuffer[16000];
 extern __int16 Info3dBuffer[480000];
 #else // defined(FEATURE_EXTENDED_LIMITS) || defined(FEATURE_VIEW_IMPROVED)
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/anim_cache.h"
+#include "game/draw.h"
+#include "global/vars.h"
+#include <malloc.h>
+#include <math.h>
+
+#ifdef FEATURE_RENDER_IMPROVED
+#define ANIM_CACHE_ALIGN	(64) // cache line size
+
+typedef struct {
+	DWORD offset; // frame offset in AnimFrames
+	DWORD bone; // the first bone in AnimBoneCache
+	int count; // rotations decoded from the frame
+} ANIM_FRAME_ENTRY;
+
+bool AnimFrameCacheEnabled = true;
+
+static ANIM_FRAME_ENTRY *AnimFrameEntries = NULL;
+static DWORD AnimFrameEntriesCount = 0;
+static ANIM_BONE *AnimBoneCache = NULL;
+static DWORD AnimBoneCacheCount = 0;
+
+static int CompareFrameEntries(const void *a, const void *b) {
+	DWORD x = ((ANIM_FRAME_ENTRY *)a)->offset;
+	DWORD y = ((ANIM_FRAME_ENTRY *)b)->offset;
+	return ( x > y ) - ( x < y );
+}
+
+// Checks how many packed rotations of the frame fit into the frame size
+static int GetFrameRotationsCount(__int16 *frame, int frameSize, int nMeshes) {
+	UINT16 *rot = (UINT16 *)&frame[9];
+	UINT16 *end = (UINT16 *)&frame[frameSize];
+	int count = 0;
+	while( count < nMeshes && rot < end ) {
+		rot += ( (*rot >> 14) == 0 ) ? 2 : 1;
+		if( rot > end ) break;
+		++count;
+	}
+	return count;
+}
+
+static void QuaternionFromMatrix(int *m, float *q) {
+	double m00 = m[0] / (double)W2V_SCALE, m01 = m[1] / (double)W2V_SCALE, m02 = m[2] / (double)W2V_SCALE;
+	double m10 = m[3] / (double)W2V_SCALE, m11 = m[4] / (double)W2V_SCALE, m12 = m[5] / (double)W2V_SCALE;
+	double m20 = m[6] / (double)W2V_SCALE, m21 = m[7] / (double)W2V_SCALE, m22 = m[8] / (double)W2V_SCALE;
+	double trace = m00 + m11 + m22;
+	double s;
+
+	if( trace > 0.0 ) {
+		s = sqrt(trace + 1.0) * 2.0;
+		q[3] = 0.25 * s;
+		q[0] = (m21 - m12) / s;
+		q[1] = (m02 - m20) / s;
+		q[2] = (m10 - m01) / s;
+	} else if( m00 > m11 && m00 > m22 ) {
+		s = sqrt(1.0 + m00 - m11 - m22) * 2.0;
+		q[3] = (m21 - m12) / s;
+		q[0] = 0.25 * s;
+		q[1] = (m01 + m10) / s;
+		q[2] = (m02 + m20) / s;
+	} else if( m11 > m22 ) {
+		s = sqrt(1.0 + m11 - m00 - m22) * 2.0;
+		q[3] = (m02 - m20) / s;
+		q[0] = (m01 + m10) / s;
+		q[1] = 0.25 * s;
+		q[2] = (m12 + m21) / s;
+	} else {
+		s = sqrt(1.0 + m22 - m00 - m11) * 2.0;
+		q[3] = (m10 - m01) / s;
+		q[0] = (m02 + m20) / s;
+		q[1] = (m12 + m21) / s;
+		q[2] = 0.25 * s;
+	}
+}
+
+static void MatrixFromQuaternion(float *q, int *m) {
+	float x = q[0], y = q[1], z = q[2], w = q[3];
+	m[0] = (int)((1.0f - 2.0f * (y*y + z*z)) * W2V_SCALE);
+	m[1] = (int)((2.0f * (x*y - z*w)) * W2V_SCALE);
+	m[2] = (int)((2.0f * (x*z + y*w)) * W2V_SCALE);
+	m[3] = (int)((2.0f * (x*y + z*w)) * W2V_SCALE);
+	m[4] = (int)((1.0f - 2.0f * (x*x + z*z)) * W2V_SCALE);
+	m[5] = (int)((2.0f * (y*z - x*w)) * W2V_SCALE);
+	m[6] = (int)((2.0f * (x*z - y*w)) * W2V_SCALE);
+	m[7] = (int)((2.0f * (y*z + x*w)) * W2V_SCALE);
+	m[8] = (int)((1.0f - 2.0f * (x*x + y*y)) * W2V_SCALE);
+}
+
+// The same as the packed rotation is applied to the current matrix
+static void MultiplyRotation(int *r) {
+	int *row = &PhdMatrixPtr->_00;
+	for( int i = 0; i < 3; ++i, row += 4 ) {
+		int a = row[0], b = row[1], c = row[2];
+		row[0] = (a * r[0] + b * r[3] + c * r[6]) >> W2V_SHIFT;
+		row[1] = (a * r[1] + b * r[4] + c * r[7]) >> W2V_SHIFT;
+		row[2] = (a * r[2] + b * r[5] + c * r[8]) >> W2V_SHIFT;
+	}
+}
+
+void FreeAnimFrameCache() {
+	if( AnimFrameEntries != NULL ) {
+		free(AnimFrameEntries);
+		AnimFrameEntries = NULL;
+	}
+	if( AnimBoneCache != NULL ) {
+		_aligned_free(AnimBoneCache);
+		AnimBoneCache = NULL;
+	}
+	AnimFrameEntriesCount = 0;
+	AnimBoneCacheCount = 0;
+}
+
+/*
+ * Unpacks the rotations of all animation frames on level loading.
+ * Frames are found through the animations. The number of rotations is
+ * taken from the object, whose animations include the animation.
+ */
+void BuildAnimFrameCache(DWORD animCount, DWORD framesSize) {
+	FreeAnimFrameCache();
+	if( !AnimFrameCacheEnabled || animCount == 0 || framesSize == 0 ) return;
+
+	// every object owns animations from its animIndex to the next object animIndex
+	int *animMeshes = (int *)calloc(animCount, sizeof(int));
+	if( animMeshes == NULL ) return;
+	for( DWORD i = 0; i < ARRAY_SIZE(Objects); ++i ) {
+		OBJECT_INFO *obj = &Objects[i];
+		if( !obj->loaded || obj->nMeshes <= 0 || obj->animIndex < 0 || (DWORD)obj->animIndex >= animCount ) continue;
+		DWORD next = animCount;
+		for( DWORD j = 0; j < ARRAY_SIZE(Objects); ++j ) {
+			if( Objects[j].loaded && Objects[j].animIndex > obj->animIndex && (DWORD)Objects[j].animIndex < next ) {
+				next = Objects[j].animIndex;
+			}
+		}
+		for( DWORD j = obj->animIndex; j < next; ++j ) {
+			animMeshes[j] = MAX(animMeshes[j], obj->nMeshes);
+		}
+	}
+
+	// collect the frames
+	DWORD capacity = 0;
+	for( DWORD i = 0; i < animCount; ++i ) {
+		int rate = Anims[i].interpolation & 0xFF;
+		if( animMeshes[i] > 0 && rate > 0 && Anims[i].frameEnd >= Anims[i].frameBase ) {
+			capacity += (Anims[i].frameEnd - Anims[i].frameBase) / rate + 2;
+		}
+	}
+	AnimFrameEntries = (ANIM_FRAME_ENTRY *)malloc(sizeof(ANIM_FRAME_ENTRY) * MAX(capacity, 1));
+	if( AnimFrameEntries == NULL ) {
+		free(animMeshes);
+		return;
+	}
+	DWORD bonesCount = 0;
+	for( DWORD i = 0; i < animCount; ++i ) {
+		int rate = Anims[i].interpolation & 0xFF;
+		int frameSize = Anims[i].interpolation >> 8;
+		if( animMeshes[i] <= 0 || rate <= 0 || frameSize <= 9 || Anims[i].frameEnd < Anims[i].frameBase ) continue;
+		// the next frame after the last one is used for interpolation too
+		int keysCount = (Anims[i].frameEnd - Anims[i].frameBase) / rate + 2;
+		for( int j = 0; j < keysCount; ++j ) {
+			__int16 *frame = Anims[i].framePtr + j * frameSize;
+			if( frame < AnimFrames || frame + frameSize > AnimFrames + framesSize ) break;
+			int count = GetFrameRotationsCount(frame, frameSize, animMeshes[i]);
+			if( count <= 0 ) continue;
+			ANIM_FRAME_ENTRY *entry = &AnimFrameEntries[AnimFrameEntriesCount++];
+			entry->offset = frame - AnimFrames;
+			entry->count = count;
+		}
+	}
+	free(animMeshes);
+
+	// the same frames may be shared by several animations
+	qsort(AnimFrameEntries, AnimFrameEntriesCount, sizeof(ANIM_FRAME_ENTRY), CompareFrameEntries);
+	DWORD uniqueCount = 0;
+	for( DWORD i = 0; i < AnimFrameEntriesCount; ++i ) {
+		if( uniqueCount > 0 && AnimFrameEntries[uniqueCount-1].offset == AnimFrameEntries[i].offset ) {
+			CLAMPL(AnimFrameEntries[uniqueCount-1].count, AnimFrameEntries[i].count);
+			continue;
+		}
+		AnimFrameEntries[uniqueCount++] = AnimFrameEntries[i];
+	}
+	AnimFrameEntriesCount = uniqueCount;
+	for( DWORD i = 0; i < AnimFrameEntriesCount; ++i ) {
+		AnimFrameEntries[i].bone = bonesCount;
+		bonesCount += AnimFrameEntries[i].count;
+	}
+
+	AnimBoneCache = (ANIM_BONE *)_aligned_malloc(sizeof(ANIM_BONE) * MAX(bonesCount, 1), ANIM_CACHE_ALIGN);
+	if( AnimBoneCache == NULL ) {
+		FreeAnimFrameCache();
+		return;
+	}
+	AnimBoneCacheCount = bonesCount;
+
+	// decode the rotations by the original code, applied to the unit matrix
+	PHD_MATRIX matrix;
+	PHD_MATRIX *savedMatrixPtr = PhdMatrixPtr;
+	PhdMatrixPtr = &matrix;
+	for( DWORD i = 0; i < AnimFrameEntriesCount; ++i ) {
+		UINT16 *rot = (UINT16 *)&AnimFrames[AnimFrameEntries[i].offset + 9];
+		for( int j = 0; j < AnimFrameEntries[i].count; ++j ) {
+			ANIM_BONE *bone = &AnimBoneCache[AnimFrameEntries[i].bone + j];
+			memset(&matrix, 0, sizeof(matrix));
+			matrix._00 = matrix._11 = matrix._22 = W2V_SCALE;
+			phd_RotYXZsuperpack(&rot, 0);
+			bone->matrix[0] = matrix._00; bone->matrix[1] = matrix._01; bone->matrix[2] = matrix._02;
+			bone->matrix[3] = matrix._10; bone->matrix[4] = matrix._11; bone->matrix[5] = matrix._12;
+			bone->matrix[6] = matrix._20; bone->matrix[7] = matrix._21; bone->matrix[8] = matrix._22;
+			QuaternionFromMatrix(bone->matrix, bone->quat);
+		}
+	}
+	PhdMatrixPtr = savedMatrixPtr;
+}
+
+// NOTE: this function is absent in the original code
+ANIM_BONE *GetAnimFrameBones(__int16 *frame, int nMeshes) {
+	if( !AnimFrameCacheEnabled || AnimFrameEntries == NULL || frame < AnimFrames ) return NULL;
+	DWORD offset = frame - AnimFrames;
+	int left = 0;
+	int right = (int)AnimFrameEntriesCount - 1;
+	while( left <= right ) {
+		int mid = (left + right) / 2;
+		if( AnimFrameEntries[mid].offset < offset ) {
+			left = mid + 1;
+		} else if( AnimFrameEntries[mid].offset > offset ) {
+			right = mid - 1;
+		} else {
+			if( AnimFrameEntries[mid].count < nMeshes ) return NULL;
+			return &AnimBoneCache[AnimFrameEntries[mid].bone];
+		}
+	}
+	return NULL;
+}
+
+// NOTE: this function is absent in the original code
+void phd_RotAnimBone(ANIM_BONE *bone) {
+	MultiplyRotation(bone->matrix);
+}
+
+// NOTE: this function is absent in the original code
+void phd_RotAnimBoneInterpolated(ANIM_BONE *bone1, ANIM_BONE *bone2, int frac, int rate) {
+	float t = (float)frac / (float)rate;
+	float q[4];
+	int m[9];
+
+	// normalized linear interpolation along the shortest arc
+	float dot = bone1->quat[0] * bone2->quat[0] + bone1->quat[1] * bone2->quat[1]
+			  + bone1->quat[2] * bone2->quat[2] + bone1->quat[3] * bone2->quat[3];
+	float sign = ( dot < 0.0f ) ? -1.0f : 1.0f;
+	for( int i = 0; i < 4; ++i ) {
+		q[i] = bone1->quat[i] + (sign * bone2->quat[i] - bone1->quat[i]) * t;
+	}
+	float length = sqrtf(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+	if( length < 0.0001f ) {
+		MultiplyRotation(bone1->matrix);
+		return;
+	}
+	for( int i = 0; i < 4; ++i ) {
+		q[i] /= length;
+	}
+	MatrixFromQuaternion(q, m);
+	MultiplyRotation(m);
+}
+#endif // FEATURE_RENDER_IMPROVED
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANIM_CACHE_H_INCLUDED
+#define ANIM_CACHE_H_INCLUDED
+
+#include "global/types.h"
+
+#ifdef FEATURE_RENDER_IMPROVED
+typedef struct {
+	int matrix[9]; // rotation matrix rows in W2V scale
+	float quat[4]; // the same rotation as quaternion (x, y, z, w)
+	int pad[3];
+} ANIM_BONE;
+#endif // FEATURE_RENDER_IMPROVED
+
+/*
+ * Function list
+ */
+#ifdef FEATURE_RENDER_IMPROVED
+void BuildAnimFrameCache(DWORD animCount, DWORD framesSize);
+void FreeAnimFrameCache();
+ANIM_BONE *GetAnimFrameBones(__int16 *frame, int nMeshes);
+void phd_RotAnimBone(ANIM_BONE *bone);
+void phd_RotAnimBoneInterpolated(ANIM_BONE *bone1, ANIM_BONE *bone2, int frac, int rate);
+#endif // FEATURE_RENDER_IMPROVED
+
+#endif // ANIM_CACHE_H_INCLUDED
@@ -0,0 +1,973 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/benchmark.h"
+#include "3dsystem/3d_gen.h"
+#include "3dsystem/phd_math.h"
+#include "game/camera.h"
+#include "game/control.h"
+#include "game/demo.h"
+#include "game/draw.h"
+#include "game/gameflow.h"
+#include "game/laramisc.h"
+#include "game/savegame.h"
+#include "game/setup.h"
+#include "specific/file.h"
+#include "specific/game.h"
+#include "specific/screenshot.h"
+#include "specific/utils.h"
+#include "specific/winvid.h"
+#include "modding/file_utils.h"
+#include "global/vars.h"
+
+#ifdef FEATURE_DEMO_IMPROVED
+#include "modding/demo_stream.h"
+#endif // FEATURE_DEMO_IMPROVED
+
+#ifdef FEATURE_BENCHMARK
+#define BENCHMARK_PATH			".\\benchmark"
+#define BENCHMARK_GOLDEN_PATH	".\\benchmark\\golden"
+#define BENCHMARK_DEF_FRAMES	(64)
+#define BENCHMARK_MAX_LIGHTS	(64) // the same as DynamicLights array size
+#define LIGHTBENCH_DEF_VERTICES	(256)
+#define LIGHTBENCH_DEF_LOOPS	(20000)
+#define SPANBENCH_DEF_POLYS		(256)
+#define SPANBENCH_DEF_FRAMES	(20)
+#define SORTBENCH_DEF_LOOPS		(100)
+#define LOADBENCH_DEF_LOOPS		(5)
+#define SIMULATE_MAX_TICKS		(1000000) // the limit, if the demo never ends
+#define DEMOCHECK_TICKS			(60 * 30 * 3 + 77) // three chunks and a half
+#define DEMOCHECK_IGNORED		(IN_OPTION|IN_LOAD|IN_SAVE|IN_PAUSE)
+
+extern bool SimdEnabled;
+
+#ifdef FEATURE_RENDER_IMPROVED
+extern bool RadixSortEnabled;
+#endif // FEATURE_RENDER_IMPROVED
+
+#ifdef FEATURE_LOADING_IMPROVED
+extern bool LevelStreamEnabled;
+#endif // FEATURE_LOADING_IMPROVED
+
+#ifdef FEATURE_NOLEGACY_OPTIONS
+extern void PrepareSWR(int pitch, int height);
+#endif // FEATURE_NOLEGACY_OPTIONS
+
+typedef struct {
+	double geometry;
+	double sort;
+	double raster;
+} FRAME_TIMINGS;
+
+static LONGLONG BenchmarkFrequency = 0;
+
+static double GetMilliseconds(LONGLONG from, LONGLONG to) {
+	return (double)(to - from) * 1000.0 / (double)BenchmarkFrequency;
+}
+
+static LONGLONG GetCounter() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+static bool SaveFile(LPCSTR fileName, LPCVOID data, DWORD size) {
+	DWORD bytesWritten = 0;
+	HANDLE hFile = CreateFile(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if( hFile == INVALID_HANDLE_VALUE ) return false;
+	WriteFile(hFile, data, size, &bytesWritten, NULL);
+	CloseHandle(hFile);
+	return ( bytesWritten == size );
+}
+
+// returns 1 if the golden frame matches, 0 if it differs, -1 if it is absent
+static int CompareGoldenFile(LPCSTR fileName, LPCVOID data, DWORD size) {
+	DWORD bytesRead = 0;
+	HANDLE hFile = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if( hFile == INVALID_HANDLE_VALUE ) return -1;
+	int result = 0;
+	if( GetFileSize(hFile, NULL) == size ) {
+		BYTE *golden = (BYTE *)malloc(size);
+		if( golden != NULL ) {
+			ReadFile(hFile, golden, size, &bytesRead, NULL);
+			result = ( bytesRead == size && !memcmp(golden, data, size) ) ? 1 : 0;
+			free(golden);
+		}
+	}
+	CloseHandle(hFile);
+	return result;
+}
+
+static void DrawBenchmarkFrame(BYTE *bitmap, FRAME_TIMINGS *timings) {
+	LONGLONG t0 = GetCounter();
+	DrawRooms(Camera.pos.roomNumber);
+	LONGLONG t1 = GetCounter();
+	phd_SortPolyList();
+	LONGLONG t2 = GetCounter();
+	memset(bitmap, 0, PhdScreenWidth * PhdScreenHeight);
+#ifdef FEATURE_NOLEGACY_OPTIONS
+	PrepareSWR(PhdScreenWidth, PhdScreenHeight);
+#endif // FEATURE_NOLEGACY_OPTIONS
+	phd_PrintPolyList(bitmap);
+	LONGLONG t3 = GetCounter();
+	timings->geometry = GetMilliseconds(t0, t1);
+	timings->sort = GetMilliseconds(t1, t2);
+	timings->raster = GetMilliseconds(t2, t3);
+}
+
+static BOOL PrepareBenchmarkLevel(int levelID) {
+	CurrentLevel = levelID;
+	ModifyStartInfo(levelID);
+	InitialiseLevelFlags();
+	if( !InitialiseLevel(levelID, GFL_NORMAL) ) {
+		return FALSE;
+	}
+	InitialiseCamera();
+	CalculateCamera();
+	return TRUE;
+}
+
+// returns the number of different vertex shades
+static int CompareShades(__int16 *shades, int vtxCount) {
+	int result = 0;
+	for( int i = 0; i < vtxCount; ++i ) {
+		if( shades[i] != PhdVBuf[i].g ) ++result;
+	}
+	return result;
+}
+
+static double MeasureLighting(__int16 *mesh, int loops) {
+	LONGLONG t0 = GetCounter();
+	for( int i = 0; i < loops; ++i ) {
+		calc_vertice_light(mesh);
+	}
+	return GetMilliseconds(t0, GetCounter());
+}
+
+/*
+ * Lights a generated mesh many times by the scalar and by the SSE2 code,
+ * both with vertex normals and with prelit vertices, without any level.
+ * Command line: -lightbench[:vertices[:loops]]
+ * Timings are saved as CSV, and the number of vertex shades that differ
+ * between the scalar and SSE2 code is returned as the application result.
+ */
+static BOOL LightingBenchmarkRun() {
+	int vtxCount = LIGHTBENCH_DEF_VERTICES;
+	int loops = LIGHTBENCH_DEF_LOOPS;
+	int failedCount = 0;
+	DWORD seed = 0x2F0B5D83;
+	LARGE_INTEGER frequency;
+	PHD_MATRIX matrix;
+
+	sscanf(UT_FindArg("-lightbench"), ":%d:%d", &vtxCount, &loops);
+	if( vtxCount <= 0 || vtxCount > (int)ARRAY_SIZE(PhdVBuf) || loops <= 0 ) {
+		wsprintf(StringToShow, "LightingBenchmarkRun: invalid vertices count (%d) or loops count (%d)", vtxCount, loops);
+		return FALSE;
+	}
+	if( !QueryPerformanceFrequency(&frequency) ) {
+		lstrcpy(StringToShow, "LightingBenchmarkRun: performance counter is not available");
+		return FALSE;
+	}
+	BenchmarkFrequency = frequency.QuadPart;
+
+	__int16 *normals = (__int16 *)malloc(sizeof(__int16) * (1 + 3 * vtxCount));
+	__int16 *prelit = (__int16 *)malloc(sizeof(__int16) * (1 + vtxCount));
+	__int16 *shades = (__int16 *)malloc(sizeof(__int16) * vtxCount);
+	if( normals == NULL || prelit == NULL || shades == NULL ) {
+		free(normals);
+		free(prelit);
+		free(shades);
+		lstrcpy(StringToShow, "LightingBenchmarkRun: could not allocate vertex buffers");
+		return FALSE;
+	}
+	CreateDirectories(BENCHMARK_PATH, false);
+
+	// the mesh data is pseudo random, but the same for every run
+	normals[0] = vtxCount;
+	prelit[0] = -vtxCount;
+	for( int i = 0; i < vtxCount; ++i ) {
+		for( int j = 0; j < 3; ++j ) {
+			seed = seed * 1103515245 + 12345;
+			normals[1 + i * 3 + j] = (__int16)((seed >> 16) & 0x7FFF) - 0x4000;
+		}
+		seed = seed * 1103515245 + 12345;
+		prelit[1 + i] = (seed >> 16) & 0x1FFF;
+	}
+
+	PHD_MATRIX *savedMatrixPtr = PhdMatrixPtr;
+	bool savedSimd = SimdEnabled;
+	memset(&matrix, 0, sizeof(matrix));
+	matrix._00 = matrix._11 = matrix._22 = 1 << W2V_SHIFT;
+	PhdMatrixPtr = &matrix;
+	LsVectorView.x = 0x2000;
+	LsVectorView.y = -0x2000;
+	LsVectorView.z = 0x1000;
+	LsAdder = 0x1000;
+	LsDivider = (1 << (W2V_SHIFT + 12)) / 0x800;
+
+	FILE *fp = fopen(BENCHMARK_PATH "\\lighting.csv", "wt");
+	if( fp != NULL ) {
+		fprintf(fp, "mesh,code,total_ms,ns_per_vertex\n");
+	}
+	__int16 *meshes[2] = {normals, prelit};
+	const char *meshNames[2] = {"normals", "prelit"};
+	for( int i = 0; i < 2; ++i ) {
+		double scalar, simd;
+		SimdEnabled = false;
+		scalar = MeasureLighting(meshes[i], loops);
+		for( int j = 0; j < vtxCount; ++j ) {
+			shades[j] = PhdVBuf[j].g;
+		}
+		SimdEnabled = true;
+		simd = MeasureLighting(meshes[i], loops);
+		failedCount += CompareShades(shades, vtxCount);
+		if( fp != NULL ) {
+			fprintf(fp, "%s,scalar,%.3f,%.3f\n", meshNames[i], scalar, scalar * 1000000.0 / ((double)loops * vtxCount));
+			fprintf(fp, "%s,%s,%.3f,%.3f\n", meshNames[i], IsSimdAvailable() ? "sse2" : "scalar",
+				simd, simd * 1000000.0 / ((double)loops * vtxCount));
+		}
+	}
+	if( fp != NULL ) {
+		fprintf(fp, "# %d vertices, %d loops, different shades: %d\n", vtxCount, loops, failedCount);
+		fclose(fp);
+	}
+
+	SimdEnabled = savedSimd;
+	PhdMatrixPtr = savedMatrixPtr;
+	free(normals);
+	free(prelit);
+	free(shades);
+	AppResultCode = failedCount;
+	return TRUE;
+}
+
+#ifdef FEATURE_RENDER_IMPROVED
+static int GetBenchmarkRandom(DWORD *seed, int range) {
+	*seed = *seed * 1103515245 + 12345;
+	return ((*seed >> 16) & 0x7FFF) % range;
+}
+
+// fills the polygon list with the perspective textured triangles, every second one is color keyed
+static void InsertSpanBenchmarkPolys(int polysCount) {
+	DWORD seed = 0x1B873593;
+	phd_InitPolyList();
+	for( int i = 0; i < polysCount; ++i ) {
+		phd_ReservePolyList();
+		Sort3dPtr->_0 = (DWORD)Info3dPtr;
+		Sort3dPtr->_1 = 0;
+		++Sort3dPtr;
+		*Info3dPtr++ = (i & 1) ? POLY_WGTmap_persp : POLY_GTmap_persp;
+		*Info3dPtr++ = 0; // texture page
+		*Info3dPtr++ = 3;
+		for( int j = 0; j < 3; ++j ) {
+			float rhw = 0.25f + (float)GetBenchmarkRandom(&seed, 1024) / 256.0f;
+			*Info3dPtr++ = GetBenchmarkRandom(&seed, PhdWinMaxX + 1);
+			*Info3dPtr++ = GetBenchmarkRandom(&seed, PhdWinMaxY + 1);
+			*Info3dPtr++ = GetBenchmarkRandom(&seed, 0x1F00);
+			*(float *)Info3dPtr = rhw;
+			Info3dPtr += sizeof(float)/sizeof(__int16);
+			*(float *)Info3dPtr = rhw * (float)GetBenchmarkRandom(&seed, 0xFF00);
+			Info3dPtr += sizeof(float)/sizeof(__int16);
+			*(float *)Info3dPtr = rhw * (float)GetBenchmarkRandom(&seed, 0xFF00);
+			Info3dPtr += sizeof(float)/sizeof(__int16);
+		}
+		++SurfaceCount;
+	}
+}
+
+/*
+ * Draws generated perspective textured triangles (opaque and color keyed)
+ * many times by the scalar and by the SSE2 span code, without any level.
+ * Command line: -spanbench[:polygons[:frames]]
+ * The scalar code is built for x87, and the SSE2 code divides in doubles,
+ * so a texel may be taken from the neighbour one where the rounding differs.
+ * Timings are saved as CSV, and the number of pixels that differ between
+ * the scalar and SSE2 pictures is returned as the application result.
+ */
+static BOOL SpanBenchmarkRun() {
+	int polysCount = SPANBENCH_DEF_POLYS;
+	int framesCount = SPANBENCH_DEF_FRAMES;
+	int failedCount = 0;
+	DWORD seed = 0x85EBCA6B;
+	LARGE_INTEGER frequency;
+
+	sscanf(UT_FindArg("-spanbench"), ":%d:%d", &polysCount, &framesCount);
+	if( polysCount <= 0 || framesCount <= 0 ) {
+		wsprintf(StringToShow, "SpanBenchmarkRun: invalid polygons count (%d) or frames count (%d)", polysCount, framesCount);
+		return FALSE;
+	}
+	if( !QueryPerformanceFrequency(&frequency) ) {
+		lstrcpy(StringToShow, "SpanBenchmarkRun: performance counter is not available");
+		return FALSE;
+	}
+	BenchmarkFrequency = frequency.QuadPart;
+
+	DWORD bitmapSize = PhdScreenWidth * PhdScreenHeight;
+	BYTE *bitmaps[2] = {(BYTE *)malloc(bitmapSize), (BYTE *)malloc(bitmapSize)};
+	BYTE *texPage = (BYTE *)malloc(256 * 256);
+	DEPTHQ_ENTRY *savedDepthQ = (DEPTHQ_ENTRY *)malloc(sizeof(DepthQTable));
+	if( bitmaps[0] == NULL || bitmaps[1] == NULL || texPage == NULL || savedDepthQ == NULL ) {
+		free(bitmaps[0]);
+		free(bitmaps[1]);
+		free(texPage);
+		free(savedDepthQ);
+		lstrcpy(StringToShow, "SpanBenchmarkRun: could not allocate frame buffer");
+		return FALSE;
+	}
+	CreateDirectories(BENCHMARK_PATH, false);
+
+	// the texture and depth tables are pseudo random, but the same for every run
+	for( int i = 0; i < 256 * 256; ++i ) {
+		texPage[i] = GetBenchmarkRandom(&seed, 256); // zero texels are color keyed
+	}
+	memcpy(savedDepthQ, DepthQTable, sizeof(DepthQTable));
+	for( int i = 0; i < (int)ARRAY_SIZE(DepthQTable); ++i ) {
+		for( int j = 0; j < 256; ++j ) {
+			DepthQTable[i].index[j] = (BYTE)(j * 7 + i * 13);
+		}
+	}
+	BYTE *savedTexPage = TexturePageBuffer8[0];
+	bool savedSimd = SimdEnabled;
+	TexturePageBuffer8[0] = texPage;
+#ifdef FEATURE_NOLEGACY_OPTIONS
+	PrepareSWR(PhdScreenWidth, PhdScreenHeight);
+#endif // FEATURE_NOLEGACY_OPTIONS
+	InsertSpanBenchmarkPolys(polysCount);
+
+	FILE *fp = fopen(BENCHMARK_PATH "\\spans.csv", "wt");
+	if( fp != NULL ) {
+		fprintf(fp, "code,total_ms,ms_per_frame\n");
+	}
+	for( int i = 0; i < 2; ++i ) {
+		SimdEnabled = ( i != 0 );
+		memset(bitmaps[i], 0, bitmapSize);
+		LONGLONG t0 = GetCounter();
+		for( int j = 0; j < framesCount; ++j ) {
+			phd_PrintPolyList(bitmaps[i]);
+		}
+		double total = GetMilliseconds(t0, GetCounter());
+		if( fp != NULL ) {
+			fprintf(fp, "%s,%.3f,%.3f\n", ( i != 0 && IsSimdAvailable() ) ? "sse2" : "scalar", total, total / framesCount);
+		}
+	}
+	for( DWORD i = 0; i < bitmapSize; ++i ) {
+		if( bitmaps[0][i] != bitmaps[1][i] ) ++failedCount;
+	}
+	if( fp != NULL ) {
+		fprintf(fp, "# %d polygons, %d frames, %dx%d, different pixels: %d\n",
+			polysCount, framesCount, PhdScreenWidth, PhdScreenHeight, failedCount);
+		fclose(fp);
+	}
+
+	phd_InitPolyList();
+	SimdEnabled = savedSimd;
+	TexturePageBuffer8[0] = savedTexPage;
+	memcpy(DepthQTable, savedDepthQ, sizeof(DepthQTable));
+	free(bitmaps[0]);
+	free(bitmaps[1]);
+	free(texPage);
+	free(savedDepthQ);
+	AppResultCode = failedCount;
+	return TRUE;
+}
+
+/*
+ * Loads the level, turns the game camera around at its place like the
+ * frame benchmark does, and captures the unsorted polygon list of every
+ * frame. Each captured list is sorted many times by the quick sort and
+ * by the radix sort through phd_SortPolyList, with the same key setup.
+ * Command line: -sortbench[:level[:frames[:loops]]]
+ * Timings are saved as CSV, and the number of frames where the sorted
+ * lists differ is returned as the application result.
+ */
+static BOOL SortBenchmarkRun() {
+	int levelID = 1;
+	int framesCount = BENCHMARK_DEF_FRAMES;
+	int loopsCount = SORTBENCH_DEF_LOOPS;
+	int failedCount = 0;
+	double totals[2] = {0.0, 0.0};
+	LARGE_INTEGER frequency;
+
+	sscanf(UT_FindArg("-sortbench"), ":%d:%d:%d", &levelID, &framesCount, &loopsCount);
+	if( levelID < 0 || levelID >= GF_GameFlow.num_Levels || framesCount <= 0 || loopsCount <= 0 ) {
+		wsprintf(StringToShow, "SortBenchmarkRun: invalid level number (%d), frames count (%d) or loops count (%d)", levelID, framesCount, loopsCount);
+		return FALSE;
+	}
+	if( SavedAppSettings.RenderMode != RM_Software ) {
+		lstrcpy(StringToShow, "SortBenchmarkRun: software renderer is required");
+		return FALSE;
+	}
+	if( !QueryPerformanceFrequency(&frequency) ) {
+		lstrcpy(StringToShow, "SortBenchmarkRun: performance counter is not available");
+		return FALSE;
+	}
+	BenchmarkFrequency = frequency.QuadPart;
+
+	if( !PrepareBenchmarkLevel(levelID) ) {
+		wsprintf(StringToShow, "SortBenchmarkRun: could not load level %d", levelID);
+		return FALSE;
+	}
+	CreateDirectories(BENCHMARK_PATH, false);
+	FILE *fp = fopen(BENCHMARK_PATH "\\sorting.csv", "wt");
+	if( fp == NULL ) {
+		lstrcpy(StringToShow, "SortBenchmarkRun: could not create sorting.csv");
+		return FALSE;
+	}
+	fprintf(fp, "frame,surfaces,quick_ms,radix_ms\n");
+
+	bool isRadixEnabled = RadixSortEnabled;
+	int x = Camera.pos.x;
+	int y = Camera.pos.y + Camera.shift;
+	int z = Camera.pos.z;
+	__int16 angle = phd_atan(Camera.target.z - z, Camera.target.x - x);
+	for( int i = 0; i < framesCount; ++i ) {
+		__int16 yaw = angle + PHD_360 * i / framesCount;
+		phd_LookAt(x, y, z, x + (phd_sin(yaw) >> 4), y, z + (phd_cos(yaw) >> 4), 0);
+		DrawRooms(Camera.pos.roomNumber);
+		WinVidSpinMessageLoop(false);
+
+		DWORD count = SurfaceCount;
+		if( count == 0 ) continue;
+		SORT_ITEM *captured = (SORT_ITEM *)malloc(sizeof(SORT_ITEM) * count * 3);
+		if( captured == NULL ) {
+			RadixSortEnabled = isRadixEnabled;
+			fclose(fp);
+			lstrcpy(StringToShow, "SortBenchmarkRun: could not allocate sort list");
+			return FALSE;
+		}
+		SORT_ITEM *sorted[2] = {captured + count, captured + count * 2};
+		memcpy(captured, SortBuffer, sizeof(SORT_ITEM) * count);
+
+		double times[2];
+		for( int mode = 0; mode < 2; ++mode ) {
+			RadixSortEnabled = ( mode != 0 );
+			LONGLONG t0 = GetCounter();
+			for( int j = 0; j < loopsCount; ++j ) {
+				memcpy(SortBuffer, captured, sizeof(SORT_ITEM) * count);
+				phd_SortPolyList();
+			}
+			times[mode] = GetMilliseconds(t0, GetCounter()) / loopsCount;
+			totals[mode] += times[mode];
+			memcpy(sorted[mode], SortBuffer, sizeof(SORT_ITEM) * count);
+		}
+		if( memcmp(sorted[0], sorted[1], sizeof(SORT_ITEM) * count) ) {
+			++failedCount;
+		}
+		fprintf(fp, "%d,%lu,%.4f,%.4f\n", i, count, times[0], times[1]);
+		free(captured);
+	}
+	RadixSortEnabled = isRadixEnabled;
+
+	fprintf(fp, "# level %d, %d frames, %d loops, total %.3f ms quick, %.3f ms radix, different lists: %d\n",
+		levelID, framesCount, loopsCount, totals[0], totals[1], failedCount);
+	fclose(fp);
+	AppResultCode = failedCount;
+	return TRUE;
+}
+#endif // FEATURE_RENDER_IMPROVED
+
+static DWORD HashData(DWORD hash, LPCVOID data, DWORD size) {
+	const BYTE *ptr = (const BYTE *)data;
+	for( DWORD i = 0; i < size; ++i ) {
+		hash = (hash ^ ptr[i]) * 16777619; // FNV-1a
+	}
+	return hash;
+}
+
+// Only the game state is hashed here, pointers differ from run to run
+static DWORD GetSimulationHash() {
+	DWORD hash = 2166136261;
+	hash = HashData(hash, &RandomControl, sizeof(RandomControl));
+	for( int i = 0; i < LevelItemCount; ++i ) {
+		ITEM_INFO *item = &Items[i];
+		__int16 state[] = {
+			item->objectID, item->currentAnimState, item->goalAnimState, item->requiredAnimState,
+			item->animNumber, item->frameNumber, item->roomNumber, item->speed, item->fallSpeed,
+			item->hitPoints, item->timer, (__int16)item->flags, (__int16)item->status, (__int16)item->active,
+			item->pos.rotX, item->pos.rotY, item->pos.rotZ,
+		};
+		hash = HashData(hash, state, sizeof(state));
+		hash = HashData(hash, &item->pos, sizeof(int) * 3);
+	}
+	return hash;
+}
+
+// the same preparations as StartDemo does
+static BOOL PrepareSimulationDemo(int levelID) {
+	START_INFO *start = &SaveGame.start[levelID];
+	start->available = 1;
+	start->pistolAmmo = 1000;
+	start->gunStatus = LGS_Armless;
+	start->gunType = LGT_Pistols;
+	SeedRandomDraw(RANDOM_SEED);
+	SeedRandomControl(RANDOM_SEED);
+	IsTitleLoaded = FALSE;
+	CurrentLevel = levelID;
+	if( !InitialiseLevel(levelID, GFL_DEMO) ) {
+		wsprintf(StringToShow, "SimulationRun: could not load level %d", levelID);
+		return FALSE;
+	}
+	if( !IsDemoLoaded ) {
+		wsprintf(StringToShow, "SimulationRun: level %d has no demo data", levelID);
+		return FALSE;
+	}
+	IsLevelComplete = FALSE;
+	LoadLaraDemoPos();
+	LaraCheatGetStuff();
+	SeedRandomDraw(RANDOM_SEED);
+	SeedRandomControl(RANDOM_SEED);
+	return TRUE;
+}
+
+#ifdef FEATURE_DEMO_IMPROVED
+// the same preparations as StartDemoStream does
+static BOOL PrepareSimulationStream(LPCSTR fileName, int *levelID) {
+	START_INFO start;
+	*levelID = DemoStreamOpen(fileName, &start);
+	if( *levelID < 0 || *levelID >= GF_GameFlow.num_Levels ) {
+		wsprintf(StringToShow, "SimulationRun: could not open demo stream %s", fileName);
+		return FALSE;
+	}
+	SaveGame.start[*levelID] = start;
+	IsTitleLoaded = FALSE;
+	CurrentLevel = *levelID;
+	if( !InitialiseLevel(*levelID, GFL_NORMAL) ) {
+		wsprintf(StringToShow, "SimulationRun: could not load level %d", *levelID);
+		return FALSE;
+	}
+	IsLevelComplete = FALSE;
+	DemoStreamSeed();
+	return TRUE;
+}
+#endif // FEATURE_DEMO_IMPROVED
+
+/*
+ * Loads the demo level, and runs ControlPhase with the recorded demo input
+ * as fast as possible, without drawing anything.
+ * Command line: -simulate[:level[:ticks]]
+ * The default level is the first demo level, and zero ticks means the
+ * whole demo. The state hash of every tick is saved as CSV with the ticks
+ * per second. If there is the same file in the golden folder, the hashes
+ * are compared, and the number of different ticks is returned as the
+ * application result. The ticks present in one run only are different too.
+ * With the "-demoplay:file" option, the streamed demo is simulated instead,
+ * and its level is taken from the file.
+ */
+static BOOL SimulationRun() {
+	int levelID = GF_GameFlow.num_Demos ? GF_DemoLevels[0] : -1;
+	int ticksCount = 0;
+	int failedCount = 0;
+	int goldenCount = 0;
+	int result = 0;
+	LARGE_INTEGER frequency;
+	BOOL isPrepared;
+
+	sscanf(UT_FindArg("-simulate"), ":%d:%d", &levelID, &ticksCount);
+	if( levelID < 0 || levelID >= GF_GameFlow.num_Levels || ticksCount < 0 ) {
+		wsprintf(StringToShow, "SimulationRun: invalid level number (%d) or ticks count (%d)", levelID, ticksCount);
+		return FALSE;
+	}
+	if( !QueryPerformanceFrequency(&frequency) ) {
+		lstrcpy(StringToShow, "SimulationRun: performance counter is not available");
+		return FALSE;
+	}
+	BenchmarkFrequency = frequency.QuadPart;
+	if( ticksCount == 0 || ticksCount > SIMULATE_MAX_TICKS ) {
+		ticksCount = SIMULATE_MAX_TICKS;
+	}
+
+#ifdef FEATURE_DEMO_IMPROVED
+	LPCSTR streamName = UT_FindArg("-demoplay");
+	if( streamName != NULL && streamName[0] == ':' ) {
+		isPrepared = PrepareSimulationStream(streamName + 1, &levelID);
+	} else {
+		isPrepared = PrepareSimulationDemo(levelID);
+	}
+#else // FEATURE_DEMO_IMPROVED
+	isPrepared = PrepareSimulationDemo(levelID);
+#endif // FEATURE_DEMO_IMPROVED
+	if( !isPrepared ) {
+#ifdef FEATURE_DEMO_IMPROVED
+		DemoStreamClose();
+#endif // FEATURE_DEMO_IMPROVED
+		return FALSE;
+	}
+
+	DWORD *hashes = (DWORD *)malloc(sizeof(DWORD) * ticksCount);
+	if( hashes == NULL ) {
+#ifdef FEATURE_DEMO_IMPROVED
+		DemoStreamClose();
+#endif // FEATURE_DEMO_IMPROVED
+		lstrcpy(StringToShow, "SimulationRun: could not allocate hash buffer");
+		return FALSE;
+	}
+
+	int ticks = 0;
+	LONGLONG t0 = GetCounter();
+	while( ticks < ticksCount ) {
+		result = ControlPhase(TICKS_PER_FRAME, TRUE);
+		if( result != 0 ) break;
+		hashes[ticks++] = GetSimulationHash();
+		if( (ticks % 256) == 0 ) {
+			WinVidSpinMessageLoop(false);
+		}
+	}
+	double total = GetMilliseconds(t0, GetCounter());
+#ifdef FEATURE_DEMO_IMPROVED
+	DemoStreamClose();
+#endif // FEATURE_DEMO_IMPROVED
+
+	// golden hashes are read from the previous run output
+	CreateDirectories(BENCHMARK_PATH, false);
+	FILE *golden = fopen(BENCHMARK_GOLDEN_PATH "\\simulation.csv", "rt");
+	if( golden != NULL ) {
+		int tick;
+		int goldenTicks = 0;
+		DWORD hash;
+		char line[256];
+		while( fgets(line, sizeof(line), golden) ) {
+			if( sscanf(line, "%d,%lx", &tick, &hash) != 2 || tick < 0 ) continue;
+			++goldenCount;
+			CLAMPL(goldenTicks, tick + 1);
+			// the golden ticks beyond the new run mean it has ended earlier
+			if( tick >= ticks || hashes[tick] != hash ) ++failedCount;
+		}
+		fclose(golden);
+		// the new ticks beyond the golden run mean it has ended later
+		if( goldenTicks < ticks ) {
+			failedCount += ticks - goldenTicks;
+		}
+	}
+
+	FILE *fp = fopen(BENCHMARK_PATH "\\simulation.csv", "wt");
+	if( fp != NULL ) {
+		fprintf(fp, "tick,hash\n");
+		for( int i = 0; i < ticks; ++i ) {
+			fprintf(fp, "%d,%08lx\n", i, hashes[i]);
+		}
+		fprintf(fp, "# level %d, %d ticks, %.3f ms, %.0f ticks per second, demo result %d, golden ticks: %d checked, %d failed\n",
+			levelID, ticks, total, ( total > 0.0 ) ? ticks * 1000.0 / total : 0.0, result, goldenCount, failedCount);
+		fclose(fp);
+	}
+	free(hashes);
+	AppResultCode = failedCount;
+	return TRUE;
+}
+
+#ifdef FEATURE_DEMO_IMPROVED
+/*
+ * Records the scripted input into the demo stream, and plays it back.
+ * The script holds keys for long runs (so chunks are crossed by runs),
+ * and presses the inventory, load, save and pause keys between them.
+ * Command line: -democheck
+ * ControlPhase takes the input from the keyboard, so the stream is checked
+ * at the same calls the game uses: the input returned on recording (the
+ * one ControlPhase acts upon) must never open the inventory or pause, and
+ * the playback must return exactly that input tick by tick, then ~0.
+ * The weapon and medipack hotkeys must stay disabled while the stream is
+ * recorded or played, since they act bypassing the input status.
+ * Mismatched ticks are saved as CSV, and their number is returned as the
+ * application result.
+ */
+static BOOL DemoCheckRun() {
+	int failedCount = 0;
+	int ignoredCount = 0;
+	int hotkeysCount = 0;
+	DWORD seed = 0x6C8E9CF5;
+	DWORD input = 0;
+	START_INFO start;
+
+	DWORD *recorded = (DWORD *)malloc(sizeof(DWORD) * DEMOCHECK_TICKS);
+	if( recorded == NULL ) {
+		lstrcpy(StringToShow, "DemoCheckRun: could not allocate input buffer");
+		return FALSE;
+	}
+	CreateDirectories(BENCHMARK_PATH, false);
+	if( !DemoStreamRecordFile(BENCHMARK_PATH "\\democheck.dms", 0) ) {
+		free(recorded);
+		return FALSE;
+	}
+	for( int i = 0; i < DEMOCHECK_TICKS; ++i ) {
+		seed = seed * 1103515245 + 12345;
+		if( (seed >> 16) % 97 == 0 ) {
+			input = (seed >> 8) & ~DEMOCHECK_IGNORED; // the new held keys
+		}
+		DWORD pressed = 0;
+		switch( i % 211 ) {
+			case 10 : pressed = IN_OPTION; break;
+			case 20 : pressed = IN_LOAD; break;
+			case 30 : pressed = IN_SAVE; break;
+			case 40 : pressed = IN_PAUSE; break;
+		}
+		if( pressed ) ++ignoredCount;
+		recorded[i] = DemoStreamRecordInput(input | pressed);
+		if( recorded[i] != input ) ++failedCount;
+		if( !IsDemoStreamActive() ) ++hotkeysCount; // the hotkeys would not be recorded
+	}
+	DemoStreamRecordStop();
+	if( IsDemoStreamActive() ) ++hotkeysCount;
+
+	FILE *fp = fopen(BENCHMARK_PATH "\\democheck.csv", "wt");
+	if( fp != NULL ) {
+		fprintf(fp, "tick,recorded,replayed\n");
+	}
+	if( DemoStreamOpen(BENCHMARK_PATH "\\democheck.dms", &start) != 0 ) {
+		if( fp != NULL ) fclose(fp);
+		free(recorded);
+		return FALSE;
+	}
+	for( int i = 0; i <= DEMOCHECK_TICKS; ++i ) {
+		DWORD expected = ( i < DEMOCHECK_TICKS ) ? recorded[i] : ~0;
+		DWORD replayed = DemoStreamGetInput();
+		if( !IsDemoStreamActive() ) ++hotkeysCount; // the hotkeys would be mixed into the stream
+		if( replayed == expected ) continue;
+		++failedCount;
+		if( fp != NULL ) {
+			fprintf(fp, "%d,%08lx,%08lx\n", i, expected, replayed);
+		}
+	}
+	DemoStreamClose();
+	if( IsDemoStreamActive() ) ++hotkeysCount;
+	failedCount += hotkeysCount;
+
+	if( fp != NULL ) {
+		fprintf(fp, "# %d ticks, %d ignored key presses, %d ticks with hotkeys enabled, failed ticks: %d\n",
+			DEMOCHECK_TICKS, ignoredCount, hotkeysCount, failedCount);
+		fclose(fp);
+	}
+	free(recorded);
+	AppResultCode = failedCount;
+	return TRUE;
+}
+#endif // FEATURE_DEMO_IMPROVED
+
+#ifdef FEATURE_LOADING_IMPROVED
+/*
+ * Loads every level of the script several times with the level stream
+ * turned off and on, and saves the best load time of every level as CSV.
+ * The level files are cached by the system after the first loading, so
+ * the file reading calls and parsing are measured, not the disk speed.
+ * Command line: -loadbench[:loops]
+ */
+static BOOL LoadingBenchmarkRun() {
+	int loopsCount = LOADBENCH_DEF_LOOPS;
+	double totals[2] = {0.0, 0.0};
+	LARGE_INTEGER frequency;
+
+	sscanf(UT_FindArg("-loadbench"), ":%d", &loopsCount);
+	if( loopsCount <= 0 ) {
+		wsprintf(StringToShow, "LoadingBenchmarkRun: invalid loops count (%d)", loopsCount);
+		return FALSE;
+	}
+	if( !QueryPerformanceFrequency(&frequency) ) {
+		lstrcpy(StringToShow, "LoadingBenchmarkRun: performance counter is not available");
+		return FALSE;
+	}
+	BenchmarkFrequency = frequency.QuadPart;
+
+	CreateDirectories(BENCHMARK_PATH, false);
+	FILE *fp = fopen(BENCHMARK_PATH "\\loading.csv", "wt");
+	if( fp == NULL ) {
+		lstrcpy(StringToShow, "LoadingBenchmarkRun: could not create loading.csv");
+		return FALSE;
+	}
+	fprintf(fp, "level,file,read_ms,stream_ms\n");
+
+	bool isStreamEnabled = LevelStreamEnabled;
+	for( int i = 0; i < GF_GameFlow.num_Levels; ++i ) {
+		double best[2] = {0.0, 0.0};
+		for( int mode = 0; mode < 2; ++mode ) {
+			LevelStreamEnabled = ( mode != 0 );
+			for( int j = 0; j < loopsCount; ++j ) {
+				S_UnloadLevelFile();
+				LONGLONG t0 = GetCounter();
+				BOOL isLoaded = LoadLevel(GF_LevelFilesStringTable[i], i);
+				double time = GetMilliseconds(t0, GetCounter());
+				WinVidSpinMessageLoop(false);
+				if( !isLoaded ) {
+					LevelStreamEnabled = isStreamEnabled;
+					fclose(fp);
+					wsprintf(StringToShow, "LoadingBenchmarkRun: could not load level %d", i);
+					return FALSE;
+				}
+				if( j == 0 || time < best[mode] ) {
+					best[mode] = time;
+				}
+			}
+			totals[mode] += best[mode];
+		}
+		fprintf(fp, "%d,%s,%.3f,%.3f\n", i, GF_LevelFilesStringTable[i], best[0], best[1]);
+	}
+	LevelStreamEnabled = isStreamEnabled;
+	S_UnloadLevelFile();
+
+	fprintf(fp, "# %d levels, %d loops, total %.3f ms read, %.3f ms stream\n",
+		GF_GameFlow.num_Levels, loopsCount, totals[0], totals[1]);
+	fclose(fp);
+	AppResultCode = 0;
+	return TRUE;
+}
+#endif // FEATURE_LOADING_IMPROVED
+
+bool IsBenchmarkRequested() {
+	return ( UT_FindArg("-benchmark") != NULL
+		|| UT_FindArg("-lightbench") != NULL
+#ifdef FEATURE_RENDER_IMPROVED
+		|| UT_FindArg("-spanbench") != NULL
+		|| UT_FindArg("-sortbench") != NULL
+#endif // FEATURE_RENDER_IMPROVED
+#ifdef FEATURE_LOADING_IMPROVED
+		|| UT_FindArg("-loadbench") != NULL
+#endif // FEATURE_LOADING_IMPROVED
+#ifdef FEATURE_DEMO_IMPROVED
+		|| UT_FindArg("-democheck") != NULL
+#endif // FEATURE_DEMO_IMPROVED
+		|| UT_FindArg("-simulate") != NULL );
+}
+
+/*
+ * Loads the level, then turns the game camera around at its place, and
+ * draws every frame by the software renderer into a memory bitmap.
+ * Command line: -benchmark[:level[:frames[:lights]]]
+ * The lights are dynamic lights (like gunfire) placed around the camera
+ * in every frame, so the room lighting is measured too.
+ * Frames are saved as PCX files, and their timings are saved as CSV.
+ * If there is the same frame in the golden folder, the frames are compared,
+ * and the number of different frames is returned as the application result.
+ */
+BOOL BenchmarkRun() {
+	char fileName[MAX_PATH];
+	int levelID = 1;
+	int framesCount = BENCHMARK_DEF_FRAMES;
+	int lightsCount = 0;
+	int goldenCount = 0;
+	int failedCount = 0;
+	LARGE_INTEGER frequency;
+
+	if( UT_FindArg("-simulate") != NULL ) {
+		return SimulationRun();
+	}
+#ifdef FEATURE_RENDER_IMPROVED
+	if( UT_FindArg("-spanbench") != NULL ) {
+		return SpanBenchmarkRun();
+	}
+	if( UT_FindArg("-sortbench") != NULL ) {
+		return SortBenchmarkRun();
+	}
+#endif // FEATURE_RENDER_IMPROVED
+#ifdef FEATURE_LOADING_IMPROVED
+	if( UT_FindArg("-loadbench") != NULL ) {
+		return LoadingBenchmarkRun();
+	}
+#endif // FEATURE_LOADING_IMPROVED
+#ifdef FEATURE_DEMO_IMPROVED
+	if( UT_FindArg("-democheck") != NULL ) {
+		return DemoCheckRun();
+	}
+#endif // FEATURE_DEMO_IMPROVED
+	if( UT_FindArg("-benchmark") == NULL ) {
+		return LightingBenchmarkRun();
+	}
+
+	sscanf(UT_FindArg("-benchmark"), ":%d:%d:%d", &levelID, &framesCount, &lightsCount);
+	if( levelID < 0 || levelID >= GF_GameFlow.num_Levels || framesCount <= 0 ) {
+		wsprintf(StringToShow, "BenchmarkRun: invalid level number (%d) or frames count (%d)", levelID, framesCount);
+		return FALSE;
+	}
+	if( lightsCount < 0 || lightsCount > BENCHMARK_MAX_LIGHTS ) {
+		wsprintf(StringToShow, "BenchmarkRun: invalid dynamic lights count (%d)", lightsCount);
+		return FALSE;
+	}
+	if( SavedAppSettings.RenderMode != RM_Software ) {
+		lstrcpy(StringToShow, "BenchmarkRun: software renderer is required");
+		return FALSE;
+	}
+	if( !QueryPerformanceFrequency(&frequency) ) {
+		lstrcpy(StringToShow, "BenchmarkRun: performance counter is not available");
+		return FALSE;
+	}
+	BenchmarkFrequency = frequency.QuadPart;
+
+	if( !PrepareBenchmarkLevel(levelID) ) {
+		wsprintf(StringToShow, "BenchmarkRun: could not load level %d", levelID);
+		return FALSE;
+	}
+
+	BYTE *bitmap = (BYTE *)malloc(PhdScreenWidth * PhdScreenHeight);
+	FRAME_TIMINGS *timings = (FRAME_TIMINGS *)malloc(sizeof(FRAME_TIMINGS) * framesCount);
+	if( bitmap == NULL || timings == NULL ) {
+		free(bitmap);
+		free(timings);
+		lstrcpy(StringToShow, "BenchmarkRun: could not allocate frame buffer");
+		return FALSE;
+	}
+	CreateDirectories(BENCHMARK_PATH, false);
+
+	// the camera stays at the same place (so its room is always valid), and just turns around
+	int x = Camera.pos.x;
+	int y = Camera.pos.y + Camera.shift;
+	int z = Camera.pos.z;
+	__int16 angle = phd_atan(Camera.target.z - z, Camera.target.x - x);
+	for( int i = 0; i < framesCount; ++i ) {
+		__int16 yaw = angle + PHD_360 * i / framesCount;
+		phd_LookAt(x, y, z, x + (phd_sin(yaw) >> 4), y, z + (phd_cos(yaw) >> 4), 0);
+		DynamicLightCount = 0;
+		for( int j = 0; j < lightsCount; ++j ) {
+			__int16 lightAngle = yaw + PHD_360 * j / lightsCount;
+			AddDynamicLight(x + (phd_sin(lightAngle) >> 3), y, z + (phd_cos(lightAngle) >> 3), 12, 11);
+		}
+		DrawBenchmarkFrame(bitmap, &timings[i]);
+		WinVidSpinMessageLoop(false);
+
+		BYTE *pcxData = NULL;
+		DWORD pcxSize = CompPCX(bitmap, PhdScreenWidth, PhdScreenHeight, GamePalette8, &pcxData);
+		if( pcxSize == 0 || pcxData == NULL ) continue;
+		snprintf(fileName, sizeof(fileName), BENCHMARK_PATH "\\frame%04d.pcx", i);
+		SaveFile(fileName, pcxData, pcxSize);
+		snprintf(fileName, sizeof(fileName), BENCHMARK_GOLDEN_PATH "\\frame%04d.pcx", i);
+		int cmp = CompareGoldenFile(fileName, pcxData, pcxSize);
+		if( cmp >= 0 ) {
+			++goldenCount;
+			if( cmp == 0 ) ++failedCount;
+		}
+		GlobalFree(pcxData);
+	}
+
+	FILE *fp = fopen(BENCHMARK_PATH "\\timings.csv", "wt");
+	if( fp != NULL ) {
+		double total = 0.0;
+		fprintf(fp, "frame,geometry_ms,sort_ms,raster_ms,total_ms\n");
+		for( int i = 0; i < framesCount; ++i ) {
+			double frame = timings[i].geometry + timings[i].sort + timings[i].raster;
+			fprintf(fp, "%d,%.3f,%.3f,%.3f,%.3f\n", i, timings[i].geometry, timings[i].sort, timings[i].raster, frame);
+			total += frame;
+		}
+		fprintf(fp, "# level %d, %dx%d, %d frames, %d dynamic lights, %.3f ms average, golden frames: %d checked, %d failed\n",
+			levelID, PhdScreenWidth, PhdScreenHeight, framesCount, lightsCount, total / framesCount, goldenCount, failedCount);
+		fclose(fp);
+	}
+	free(bitmap);
+	free(timings);
+	AppResultCode = failedCount;
+	return TRUE;
+}
+#endif // FEATURE_BENCHMARK
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/demo_stream.h"
+#include "specific/game.h"
+#include "specific/utils.h"
+#include "modding/file_utils.h"
+#include "global/vars.h"
+
+#ifdef FEATURE_DEMO_IMPROVED
+#define DEMO_STREAM_PATH	".\\demos"
+#define DEMO_STREAM_MAGIC	(0x53443254) // "T2DS"
+#define DEMO_STREAM_VERSION	(2)
+#define DEMO_CHUNK_TICKS	(60 * 30) // one minute of the game
+#define DEMO_CHUNK_SIZE		(4096)
+#define DEMO_RUN_MAX_SIZE	(10) // two values, 5 bytes each
+
+// the inventory and pause have their own input loops that are not recorded
+#define DEMO_STREAM_IGNORED	(IN_OPTION|IN_LOAD|IN_SAVE|IN_PAUSE)
+
+/*
+ * The stream file is the header and any number of chunks. A chunk is
+ * the chunk header and the run-length encoded input: the number of ticks
+ * and the input xor-delta against the previous run, both are stored as
+ * variable length values of 7 bits per byte. The delta is reset at the
+ * start of every chunk, so only one chunk is kept in memory at a time.
+ */
+typedef struct {
+	DWORD magic;
+	DWORD version;
+	DWORD buildStamp;
+	DWORD levelID;
+	int seedControl;
+	int seedDraw;
+	START_INFO start;
+} DEMO_STREAM_HEADER;
+
+typedef struct {
+	DWORD ticks;
+	DWORD size;
+} DEMO_CHUNK_HEADER;
+
+typedef struct {
+	FILE *fp;
+	DEMO_STREAM_HEADER header;
+	BYTE data[DEMO_CHUNK_SIZE];
+	DWORD size; // encoded bytes of the chunk
+	DWORD pos; // decoding position in the chunk
+	DWORD ticks; // encoded ticks of the chunk
+	DWORD prev; // input of the previous run
+	DWORD runInput;
+	DWORD runLength;
+} DEMO_STREAM;
+
+static DEMO_STREAM RecordStream;
+static DEMO_STREAM PlayStream;
+
+// the link time stamp of TR2Main.dll identifies the build
+static DWORD GetBuildStamp() {
+	extern HINSTANCE hInstance;
+	PIMAGE_DOS_HEADER dosHeader = (PIMAGE_DOS_HEADER)hInstance;
+	if( dosHeader == NULL || dosHeader->e_magic != IMAGE_DOS_SIGNATURE ) return 0;
+	PIMAGE_NT_HEADERS ntHeaders = (PIMAGE_NT_HEADERS)((BYTE *)dosHeader + dosHeader->e_lfanew);
+	if( ntHeaders->Signature != IMAGE_NT_SIGNATURE ) return 0;
+	return ntHeaders->FileHeader.TimeDateStamp;
+}
+
+static void PutValue(DEMO_STREAM *stream, DWORD value) {
+	while( value >= 0x80 ) {
+		stream->data[stream->size++] = (BYTE)(value | 0x80);
+		value >>= 7;
+	}
+	stream->data[stream->size++] = (BYTE)value;
+}
+
+static bool GetValue(DEMO_STREAM *stream, DWORD *value) {
+	*value = 0;
+	for( int shift = 0; shift < 35; shift += 7 ) {
+		if( stream->pos >= stream->size ) break;
+		BYTE data = stream->data[stream->pos++];
+		*value |= (DWORD)(data & 0x7F) << shift;
+		if( !(data & 0x80) ) return true;
+	}
+	return false;
+}
+
+static void FlushChunk(DEMO_STREAM *stream) {
+	if( stream->ticks == 0 ) return;
+	DEMO_CHUNK_HEADER chunk = {stream->ticks, stream->size};
+	fwrite(&chunk, sizeof(chunk), 1, stream->fp);
+	fwrite(stream->data, 1, stream->size, stream->fp);
+	stream->size = 0;
+	stream->ticks = 0;
+	stream->prev = 0;
+}
+
+static void PutRun(DEMO_STREAM *stream) {
+	if( stream->runLength == 0 ) return;
+	if( stream->size + DEMO_RUN_MAX_SIZE > DEMO_CHUNK_SIZE ) {
+		FlushChunk(stream);
+	}
+	PutValue(stream, stream->runLength);
+	PutValue(stream, stream->runInput ^ stream->prev);
+	stream->prev = stream->runInput;
+	stream->ticks += stream->runLength;
+	stream->runLength = 0;
+}
+
+/*
+ * Starts recording of the level into the file. The current random seeds
+ * and the level start info are saved into the header, so the level is
+ * started the same way on playback.
+ */
+bool DemoStreamRecordFile(LPCSTR fileName, int levelID) {
+	DemoStreamRecordStop();
+	DEMO_STREAM *stream = &RecordStream;
+	memset(stream, 0, sizeof(DEMO_STREAM));
+	stream->fp = fopen(fileName, "wb");
+	if( stream->fp == NULL ) {
+		snprintf(StringToShow, sizeof(StringToShow), "Demo stream: could not create %s", fileName);
+		return false;
+	}
+	stream->header.magic = DEMO_STREAM_MAGIC;
+	stream->header.version = DEMO_STREAM_VERSION;
+	stream->header.buildStamp = GetBuildStamp();
+	stream->header.levelID = levelID;
+	stream->header.seedControl = RandomControl;
+	stream->header.seedDraw = RandomDraw;
+	stream->header.start = SaveGame.start[levelID];
+	fwrite(&stream->header, sizeof(DEMO_STREAM_HEADER), 1, stream->fp);
+	return true;
+}
+
+/*
+ * Starts recording of the level, if the game is run with the
+ * "-demorecord[:file]" option. The default file is "demos\levelXX.dms".
+ */
+bool DemoStreamRecordStart(int levelID) {
+	char fileName[MAX_PATH];
+	LPCSTR arg = UT_FindArg("-demorecord");
+	if( arg == NULL ) return false;
+
+	if( arg[0] == ':' && arg[1] != 0 ) {
+		snprintf(fileName, sizeof(fileName), "%s", arg + 1);
+	} else {
+		CreateDirectories(DEMO_STREAM_PATH, false);
+		snprintf(fileName, sizeof(fileName), DEMO_STREAM_PATH "\\level%02d.dms", levelID);
+	}
+	return DemoStreamRecordFile(fileName, levelID);
+}
+
+/*
+ * Records the input of the tick, and returns it without the inventory
+ * and pause keys while recording, so the recorded game never leaves
+ * ControlPhase, and every tick of it is in the stream.
+ */
+DWORD DemoStreamRecordInput(DWORD input) {
+	DEMO_STREAM *stream = &RecordStream;
+	if( stream->fp == NULL ) return input;
+	input &= ~DEMO_STREAM_IGNORED;
+
+	if( stream->runLength > 0 && input == stream->runInput ) {
+		++stream->runLength;
+	} else {
+		PutRun(stream);
+		stream->runInput = input;
+		stream->runLength = 1;
+	}
+	if( stream->ticks + stream->runLength >= DEMO_CHUNK_TICKS ) {
+		PutRun(stream);
+		FlushChunk(stream);
+	}
+	return input;
+}
+
+void DemoStreamRecordStop() {
+	DEMO_STREAM *stream = &RecordStream;
+	if( stream->fp == NULL ) return;
+	PutRun(stream);
+	FlushChunk(stream);
+	fclose(stream->fp);
+	stream->fp = NULL;
+}
+
+/*
+ * Opens the stream for playback, and returns its level number and
+ * start info, or -1 if the file is not a valid stream.
+ */
+int DemoStreamOpen(LPCSTR fileName, START_INFO *start) {
+	DemoStreamClose();
+	DEMO_STREAM *stream = &PlayStream;
+	memset(stream, 0, sizeof(DEMO_STREAM));
+	stream->fp = fopen(fileName, "rb");
+	if( stream->fp == NULL ) {
+		snprintf(StringToShow, sizeof(StringToShow), "Demo stream: could not open %s", fileName);
+		return -1;
+	}
+	if( fread(&stream->header, sizeof(DEMO_STREAM_HEADER), 1, stream->fp) != 1
+		|| stream->header.magic != DEMO_STREAM_MAGIC
+		|| stream->header.version != DEMO_STREAM_VERSION )
+	{
+		snprintf(StringToShow, sizeof(StringToShow), "Demo stream: %s has wrong header", fileName);
+		DemoStreamClose();
+		return -1;
+	}
+	if( stream->header.buildStamp != GetBuildStamp() ) {
+		// the game logic of another build may differ, so the playback may go out of sync
+		snprintf(StringToShow, sizeof(StringToShow), "Demo stream: %s is recorded by another build", fileName);
+	}
+	if( start != NULL ) {
+		*start = stream->header.start;
+	}
+	return stream->header.levelID;
+}
+
+void DemoStreamSeed() {
+	SeedRandomControl(PlayStream.header.seedControl);
+	SeedRandomDraw(PlayStream.header.seedDraw);
+}
+
+bool IsDemoStreamPlaying() {
+	return ( PlayStream.fp != NULL );
+}
+
+// The weapon and medipack hotkeys act directly, bypassing the input status,
+// so they must be disabled while a stream is recorded or played
+bool IsDemoStreamActive() {
+	return ( RecordStream.fp != NULL || PlayStream.fp != NULL );
+}
+
+/*
+ * Returns the input of the next tick, or ~0 at the end of the stream
+ * (the same as GetDemoInput does). The chunks are read from the file
+ * when they are needed, so the stream length is not limited. The ignored
+ * keys are masked here too, in case the stream is made by another tool.
+ */
+DWORD DemoStreamGetInput() {
+	DEMO_STREAM *stream = &PlayStream;
+	DWORD runLength, delta;
+
+	while( stream->runLength == 0 ) {
+		if( stream->fp == NULL ) {
+			return ~0;
+		}
+		if( stream->pos >= stream->size ) {
+			DEMO_CHUNK_HEADER chunk;
+			if( fread(&chunk, sizeof(chunk), 1, stream->fp) != 1
+				|| chunk.size > DEMO_CHUNK_SIZE
+				|| fread(stream->data, 1, chunk.size, stream->fp) != chunk.size )
+			{
+				return ~0;
+			}
+			stream->size = chunk.size;
+			stream->pos = 0;
+			stream->prev = 0;
+			continue;
+		}
+		if( !GetValue(stream, &runLength) || !GetValue(stream, &delta) ) {
+			return ~0;
+		}
+		stream->runInput = stream->prev ^ delta;
+		stream->prev = stream->runInput;
+		stream->runLength = runLength;
+	}
+	--stream->runLength;
+	return stream->runInput & ~DEMO_STREAM_IGNORED;
+}
+
+void DemoStreamClose() {
+	DEMO_STREAM *stream = &PlayStream;
+	if( stream->fp == NULL ) return;
+	fclose(stream->fp);
+	stream->fp = NULL;
+}
+#endif // FEATURE_DEMO_IMPROVED
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/level_loader.h"
+#include "3dsystem/3dinsert.h"
+#include "specific/file.h"
+#include "specific/init_display.h"
+#include "specific/output.h"
+#include "specific/winvid.h"
+#include "global/vars.h"
+#include <float.h>
+
+#ifdef FEATURE_LOADING_IMPROVED
+#define LOADER_FRAME_TIME	(33) // milliseconds between progress frames
+#define LOADER_BAR_DELAY	(250) // fast loadings do not show the progress bar
+
+typedef struct {
+	LPCTSTR fileName;
+	int levelID;
+	unsigned int fpuControl;
+} LOADER_ARGS;
+
+typedef struct {
+	volatile LONG done;
+	volatile LONG total;
+} LOADER_PROGRESS;
+
+typedef struct {
+	BYTE index;
+	D3DCOLOR rgb;
+} LOADER_COLOR;
+
+typedef enum {
+	LOADER_CLR_Frame,
+	LOADER_CLR_Back,
+	LOADER_CLR_Bar,
+	LOADER_CLR_Count,
+} LOADER_COLOR_ID;
+
+bool AsyncLoadingEnabled = true;
+
+static DWORD LoaderThreadId = 0;
+static HANDLE LoaderRequestEvent = NULL;
+static HANDLE LoaderReplyEvent = NULL;
+static LOADER_CALL LoaderCall = NULL;
+static LPVOID LoaderCallParam = NULL;
+static int LoaderCallResult = 0;
+static LOADER_PROGRESS LoaderProgress[LOAD_SectionCount];
+static LOADER_COLOR LoaderColors[LOADER_CLR_Count];
+
+static DWORD WINAPI LoaderThreadProc(LPVOID param) {
+	LOADER_ARGS *args = (LOADER_ARGS *)param;
+	// the main thread FPU precision may be changed by Direct3D, so the results must be the same
+	_control87(args->fpuControl, _MCW_PC|_MCW_RC);
+	return LoadLevel(args->fileName, args->levelID);
+}
+
+// The worker rewrites GamePalette8 and InvColours, so the colors are taken before it starts
+static void SaveLoadingColors() {
+	static const int colors[LOADER_CLR_Count] = {ICLR_Gray, ICLR_Black, ICLR_Orange};
+	for( int i = 0; i < LOADER_CLR_Count; ++i ) {
+		BYTE idx = InvColours[colors[i]];
+		LoaderColors[i].index = idx;
+		LoaderColors[i].rgb = RGBA_MAKE(GamePalette8[idx].red, GamePalette8[idx].green, GamePalette8[idx].blue, 0xFF);
+	}
+}
+
+static void InsertLoadingRect(int x0, int y0, int x1, int y1, int z, LOADER_COLOR_ID id) {
+	if( SavedAppSettings.RenderMode == RM_Hardware ) {
+		D3DCOLOR rgb = LoaderColors[id].rgb;
+		InsertGourQuad(x0, y0, x1, y1, z, rgb, rgb, rgb, rgb);
+	} else {
+		ins_flat_rect(x0, y0, x1, y1, z, LoaderColors[id].index);
+	}
+}
+
+static void DrawLoadingProgress() {
+	DWORD done, total;
+	double progress = 0.0;
+	for( int i = 0; i < LOAD_SectionCount; ++i ) {
+		GetLoadingProgress((LOAD_SECTION)i, &done, &total);
+		if( total > 0 ) {
+			progress += (double)MIN(done, total) / (double)total;
+		}
+	}
+	progress /= (double)LOAD_SectionCount;
+
+	int pixel = MAX(1, PhdWinHeight / 240);
+	int barWidth = PhdWinWidth / 3;
+	int x0 = PhdWinMinX + (PhdWinWidth - barWidth) / 2;
+	int x1 = x0 + barWidth;
+	int y1 = PhdWinMinY + PhdWinHeight - pixel * 16;
+	int y0 = y1 - pixel * 4;
+	int bar = (int)(barWidth * progress);
+
+	S_InitialisePolyList(TRUE);
+	InsertLoadingRect(x0-pixel*2, y0-pixel*2, x1+pixel*2, y1+pixel*2, PhdNearZ + 40, LOADER_CLR_Frame);
+	InsertLoadingRect(x0-pixel*1, y0-pixel*1, x1+pixel*1, y1+pixel*1, PhdNearZ + 30, LOADER_CLR_Back);
+	if( bar > 0 ) {
+		InsertLoadingRect(x0, y0, x0+bar, y1, PhdNearZ + 20, LOADER_CLR_Bar);
+	}
+	S_OutputPolyList();
+	S_DumpScreen();
+}
+
+/*
+ * Runs LoadLevel by the worker thread. Meanwhile the main thread pumps
+ * window messages, draws the loading progress bar, and runs the calls
+ * that must be done by the main thread (Direct3D textures and DirectSound
+ * buffers creation), requested by the worker via CallOnMainThread.
+ */
+BOOL LoadLevelAsync(LPCTSTR fileName, int levelID) {
+	if( !AsyncLoadingEnabled ) {
+		return LoadLevel(fileName, levelID);
+	}
+
+	LoaderRequestEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	LoaderReplyEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	LOADER_ARGS args = {fileName, levelID, _control87(0, 0)};
+	HANDLE hThread = NULL;
+	if( LoaderRequestEvent != NULL && LoaderReplyEvent != NULL ) {
+		// the thread is suspended until its ID is stored, so IsLevelLoaderThread works for it
+		hThread = CreateThread(NULL, 0, LoaderThreadProc, &args, CREATE_SUSPENDED, &LoaderThreadId);
+	}
+	if( hThread == NULL ) {
+		LoaderThreadId = 0;
+		if( LoaderRequestEvent != NULL ) CloseHandle(LoaderRequestEvent);
+		if( LoaderReplyEvent != NULL ) CloseHandle(LoaderReplyEvent);
+		LoaderRequestEvent = LoaderReplyEvent = NULL;
+		return LoadLevel(fileName, levelID);
+	}
+	memset(LoaderProgress, 0, sizeof(LoaderProgress));
+	SaveLoadingColors();
+	// WM_SIZE must not apply the new resolution while the worker uses the
+	// textures and the device, the window size is just stored until it's done
+	bool isWindowUpdating = IsGameWindowUpdating;
+	int windowWidth = GameWindowWidth;
+	int windowHeight = GameWindowHeight;
+	IsGameWindowUpdating = true;
+	ResumeThread(hThread);
+
+	DWORD startTime = GetTickCount();
+	DWORD drawTime = startTime;
+	HANDLE handles[2] = {hThread, LoaderRequestEvent};
+	for(;;) {
+		DWORD wait = MsgWaitForMultipleObjects(2, handles, FALSE, LOADER_FRAME_TIME, QS_ALLINPUT);
+		if( wait == WAIT_OBJECT_0 || wait == WAIT_FAILED ) {
+			break;
+		}
+		if( wait == WAIT_OBJECT_0 + 1 ) {
+			LoaderCallResult = LoaderCall(LoaderCallParam);
+			SetEvent(LoaderReplyEvent);
+			continue;
+		}
+		WinVidSpinMessageLoop(false);
+		DWORD time = GetTickCount();
+		if( time - startTime >= LOADER_BAR_DELAY && time - drawTime >= LOADER_FRAME_TIME ) {
+			DrawLoadingProgress();
+			drawTime = time;
+		}
+	}
+
+	DWORD result = FALSE;
+	WaitForSingleObject(hThread, INFINITE);
+	GetExitCodeThread(hThread, &result);
+	CloseHandle(hThread);
+	CloseHandle(LoaderRequestEvent);
+	CloseHandle(LoaderReplyEvent);
+	LoaderRequestEvent = LoaderReplyEvent = NULL;
+	LoaderThreadId = 0;
+
+	IsGameWindowUpdating = isWindowUpdating;
+	if( !IsGameWindowUpdating && !IsGameFullScreen &&
+		(GameWindowWidth != windowWidth || GameWindowHeight != windowHeight) )
+	{
+		UpdateGameResolution();
+	}
+	return (BOOL)result;
+}
+
+bool IsLevelLoaderThread() {
+	return ( LoaderThreadId != 0 && LoaderThreadId == GetCurrentThreadId() );
+}
+
+// Called by the worker thread, it waits until the main thread runs the call
+int CallOnMainThread(LOADER_CALL call, LPVOID param) {
+	if( !IsLevelLoaderThread() ) {
+		return call(param);
+	}
+	LoaderCall = call;
+	LoaderCallParam = param;
+	SignalObjectAndWait(LoaderRequestEvent, LoaderReplyEvent, INFINITE, FALSE);
+	return LoaderCallResult;
+}
+
+void SetLoadingProgress(LOAD_SECTION section, DWORD done, DWORD total) {
+	LoaderProgress[section].total = total;
+	LoaderProgress[section].done = done;
+}
+
+void GetLoadingProgress(LOAD_SECTION section, DWORD *done, DWORD *total) {
+	*done = LoaderProgress[section].done;
+	*total = LoaderProgress[section].total;
+}
+#endif // FEATURE_LOADING_IMPROVED
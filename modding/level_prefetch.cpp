@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/level_prefetch.h"
+#include "specific/file.h"
+#include "global/vars.h"
+
+#ifdef FEATURE_LOADING_IMPROVED
+#define PREFETCH_CHUNK_SIZE	(0x40000) // the thread may be cancelled between chunks
+
+typedef struct {
+	HANDLE hThread;
+	volatile bool isCancelled;
+	char fullPath[MAX_PATH];
+	BY_HANDLE_FILE_INFORMATION info;
+	BYTE *data;
+	DWORD size;
+} LEVEL_PREFETCH;
+
+DWORD LevelPrefetchBudget = 32; // megabytes, zero turns the prefetching off
+
+extern bool LevelStreamEnabled;
+
+static LEVEL_PREFETCH Prefetch;
+
+static bool ReadPrefetchFile(HANDLE hFile) {
+	if( !GetFileInformationByHandle(hFile, &Prefetch.info)
+		|| Prefetch.info.nFileSizeHigh != 0
+		|| Prefetch.info.nFileSizeLow < sizeof(int)
+		|| Prefetch.info.nFileSizeLow > LevelPrefetchBudget * 0x100000 )
+	{
+		return false;
+	}
+
+	DWORD size = Prefetch.info.nFileSizeLow;
+	BYTE *data = (BYTE *)malloc(size);
+	if( data == NULL ) {
+		return false;
+	}
+	for( DWORD pos = 0; pos < size; ) {
+		DWORD bytesRead = 0;
+		DWORD chunkSize = MIN(size - pos, PREFETCH_CHUNK_SIZE);
+		if( Prefetch.isCancelled || !ReadFile(hFile, data + pos, chunkSize, &bytesRead, NULL) || bytesRead != chunkSize ) {
+			free(data);
+			return false;
+		}
+		pos += chunkSize;
+	}
+
+	// the only check that can be done before loading, other level data depends on the level memory
+	if( *(int *)data != REQ_LEVEL_VERSION ) {
+		free(data);
+		return false;
+	}
+	Prefetch.data = data;
+	Prefetch.size = size;
+	return true;
+}
+
+static DWORD WINAPI PrefetchThreadProc(LPVOID param) {
+	// the game must not wait for the disk because of the prefetching
+#ifdef THREAD_MODE_BACKGROUND_BEGIN
+	if( !SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN) )
+#endif // THREAD_MODE_BACKGROUND_BEGIN
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+	HANDLE hFile = CreateFile(Prefetch.fullPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN|FILE_ATTRIBUTE_NORMAL, NULL);
+	if( hFile == INVALID_HANDLE_VALUE ) {
+		return 0;
+	}
+	bool result = ReadPrefetchFile(hFile);
+	CloseHandle(hFile);
+	return result;
+}
+
+static bool IsPrefetchRunning() {
+	return ( Prefetch.hThread != NULL && WaitForSingleObject(Prefetch.hThread, 0) == WAIT_TIMEOUT );
+}
+
+/*
+ * Starts reading of the level file into memory by the low priority thread,
+ * if the file fits the memory budget. The level stream takes this buffer
+ * instead of the file mapping, when the level is loaded, so nothing is
+ * prefetched if the level stream is off.
+ */
+void PrefetchLevelFile(LPCTSTR fileName) {
+	CancelLevelPrefetch();
+	if( !LevelStreamEnabled || LevelPrefetchBudget == 0 || fileName == NULL || *fileName == 0 ) {
+		return;
+	}
+	snprintf(Prefetch.fullPath, sizeof(Prefetch.fullPath), "%s", GetFullPath(fileName));
+	Prefetch.isCancelled = false;
+	Prefetch.hThread = CreateThread(NULL, 0, PrefetchThreadProc, NULL, 0, NULL);
+}
+
+void CancelLevelPrefetch() {
+	if( Prefetch.hThread != NULL ) {
+		Prefetch.isCancelled = true;
+		WaitForSingleObject(Prefetch.hThread, INFINITE);
+		CloseHandle(Prefetch.hThread);
+		Prefetch.hThread = NULL;
+	}
+	free(Prefetch.data);
+	Prefetch.data = NULL;
+	Prefetch.size = 0;
+	*Prefetch.fullPath = 0;
+}
+
+// The level file cannot be opened until the prefetching thread closes it
+void WaitLevelPrefetch(LPCTSTR fullPath) {
+	if( Prefetch.hThread != NULL && !lstrcmpi(fullPath, Prefetch.fullPath) ) {
+		WaitForSingleObject(Prefetch.hThread, INFINITE);
+	}
+}
+
+/*
+ * Returns the prefetched data, if it's the same file, and it was not
+ * changed after prefetching. The caller must free the data.
+ */
+LPVOID TakePrefetchedLevel(HANDLE hFile, DWORD size) {
+	BY_HANDLE_FILE_INFORMATION info;
+	if( Prefetch.data == NULL || IsPrefetchRunning() || Prefetch.size != size
+		|| !GetFileInformationByHandle(hFile, &info)
+		|| info.dwVolumeSerialNumber != Prefetch.info.dwVolumeSerialNumber
+		|| info.nFileIndexHigh != Prefetch.info.nFileIndexHigh
+		|| info.nFileIndexLow != Prefetch.info.nFileIndexLow
+		|| CompareFileTime(&info.ftLastWriteTime, &Prefetch.info.ftLastWriteTime) )
+	{
+		return NULL;
+	}
+	LPVOID data = Prefetch.data;
+	Prefetch.data = NULL;
+	Prefetch.size = 0;
+	return data;
+}
+#endif // FEATURE_LOADING_IMPROVED
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/level_snapshot.h"
+#include "specific/init.h"
+#include "global/vars.h"
+
+#ifdef FEATURE_LOADING_IMPROVED
+#define SNAPSHOT_MOD_CONFIG	"TR2Main.json"
+
+extern PHD_TEXTURE TextureBackupUV[ARRAY_SIZE(PhdTextureInfo)];
+
+/*
+ * The snapshot is taken by LoadLevel right before the items are loaded.
+ * At this point the game memory holds the rooms, meshes, animations and
+ * boxes, and the globals below point to it. The game memory buffer is
+ * allocated once, so the snapshot stays valid without any pointer
+ * relocation, while the level textures and the derived level data are
+ * not unloaded.
+ */
+typedef struct {
+	LPVOID ptr;
+	DWORD size;
+} SNAPSHOT_GLOBAL;
+
+static const SNAPSHOT_GLOBAL SnapshotGlobals[] = {
+	{&GamePalette8, sizeof(GamePalette8)},
+	{&GamePalette16, sizeof(GamePalette16)},
+	{&TexturePageBuffer8, sizeof(TexturePageBuffer8)},
+	{&RoomCount, sizeof(RoomCount)},
+	{&RoomInfo, sizeof(RoomInfo)},
+	{&FloorData, sizeof(FloorData)},
+	{&Meshes, sizeof(Meshes)},
+	{&MeshPtr, sizeof(MeshPtr)},
+	{&Anims, sizeof(Anims)},
+	{&AnimChanges, sizeof(AnimChanges)},
+	{&AnimRanges, sizeof(AnimRanges)},
+	{&AnimCommands, sizeof(AnimCommands)},
+	{&AnimBones, sizeof(AnimBones)},
+	{&AnimFrames, sizeof(AnimFrames)},
+	{&Objects, sizeof(Objects)},
+	{&StaticObjects, sizeof(StaticObjects)},
+	{&TextureInfoCount, sizeof(TextureInfoCount)},
+	{&PhdTextureInfo, sizeof(PhdTextureInfo)},
+	{&TextureBackupUV, sizeof(TextureBackupUV)},
+	{&LabTextureUVFlags, sizeof(LabTextureUVFlags)},
+	{&PhdSpriteInfo, sizeof(PhdSpriteInfo)},
+	{&CameraCount, sizeof(CameraCount)},
+	{&Camera.fixed, sizeof(Camera.fixed)},
+	{&SoundFxCount, sizeof(SoundFxCount)},
+	{&SoundFx, sizeof(SoundFx)},
+	{&BoxesCount, sizeof(BoxesCount)},
+	{&Boxes, sizeof(Boxes)},
+	{&Overlaps, sizeof(Overlaps)},
+	{&GroundZones, sizeof(GroundZones)},
+	{&FlyZones, sizeof(FlyZones)},
+	{&AnimatedTextureRanges, sizeof(AnimatedTextureRanges)},
+};
+
+typedef struct {
+	char fullPath[MAX_PATH];
+	WIN32_FILE_ATTRIBUTE_DATA levelFile;
+	WIN32_FILE_ATTRIBUTE_DATA modConfig;
+	RENDER_MODE renderMode;
+	LONG itemsOffset;
+	DWORD memUsed;
+	BYTE *data; // the game memory, then the globals
+} LEVEL_SNAPSHOT;
+
+bool LevelSnapshotEnabled = true;
+
+static LEVEL_SNAPSHOT Snapshot;
+
+static DWORD GetGlobalsSize() {
+	DWORD size = 0;
+	for( DWORD i = 0; i < ARRAY_SIZE(SnapshotGlobals); ++i ) {
+		size += SnapshotGlobals[i].size;
+	}
+	return size;
+}
+
+static void GetFileAttrs(LPCTSTR fileName, WIN32_FILE_ATTRIBUTE_DATA *attrs) {
+	memset(attrs, 0, sizeof(WIN32_FILE_ATTRIBUTE_DATA));
+	if( !GetFileAttributesEx(fileName, GetFileExInfoStandard, attrs) ) {
+		memset(attrs, 0, sizeof(WIN32_FILE_ATTRIBUTE_DATA));
+	}
+}
+
+static bool IsSameFile(const WIN32_FILE_ATTRIBUTE_DATA *a, const WIN32_FILE_ATTRIBUTE_DATA *b) {
+	return ( a->nFileSizeHigh == b->nFileSizeHigh
+		&& a->nFileSizeLow == b->nFileSizeLow
+		&& !CompareFileTime(&a->ftLastWriteTime, &b->ftLastWriteTime) );
+}
+
+/*
+ * Saves the loaded part of the level. The snapshot is keyed by the level
+ * file, the mod configuration file and the render mode.
+ */
+bool SaveLevelSnapshot(LPCTSTR fullPath, LONG itemsOffset) {
+	FreeLevelSnapshot();
+	if( !LevelSnapshotEnabled || GameMemoryPointer == NULL ) {
+		return false;
+	}
+	DWORD memUsed = GameAllocMemPointer - GameMemoryPointer;
+	BYTE *data = (BYTE *)malloc(memUsed + GetGlobalsSize());
+	if( data == NULL ) {
+		return false;
+	}
+
+	memcpy(data, GameMemoryPointer, memUsed);
+	BYTE *ptr = data + memUsed;
+	for( DWORD i = 0; i < ARRAY_SIZE(SnapshotGlobals); ++i ) {
+		memcpy(ptr, SnapshotGlobals[i].ptr, SnapshotGlobals[i].size);
+		ptr += SnapshotGlobals[i].size;
+	}
+
+	snprintf(Snapshot.fullPath, sizeof(Snapshot.fullPath), "%s", fullPath);
+	GetFileAttrs(fullPath, &Snapshot.levelFile);
+	GetFileAttrs(SNAPSHOT_MOD_CONFIG, &Snapshot.modConfig);
+	Snapshot.renderMode = SavedAppSettings.RenderMode;
+	Snapshot.itemsOffset = itemsOffset;
+	Snapshot.memUsed = memUsed;
+	Snapshot.data = data;
+	return true;
+}
+
+/*
+ * Restores the game memory and the globals, if the snapshot matches
+ * the level file. Returns the items offset in the level file, so the
+ * rest of the level is loaded as usual, or -1 if there is no snapshot.
+ */
+LONG RestoreLevelSnapshot(LPCTSTR fullPath) {
+	WIN32_FILE_ATTRIBUTE_DATA levelFile, modConfig;
+	if( !LevelSnapshotEnabled || Snapshot.data == NULL
+		|| Snapshot.renderMode != SavedAppSettings.RenderMode
+		|| lstrcmpi(fullPath, Snapshot.fullPath) )
+	{
+		return -1;
+	}
+	GetFileAttrs(fullPath, &levelFile);
+	GetFileAttrs(SNAPSHOT_MOD_CONFIG, &modConfig);
+	if( !IsSameFile(&levelFile, &Snapshot.levelFile) || !IsSameFile(&modConfig, &Snapshot.modConfig) ) {
+		return -1;
+	}
+
+	init_game_malloc();
+	memcpy(GameMemoryPointer, Snapshot.data, Snapshot.memUsed);
+	GameAllocMemPointer += Snapshot.memUsed;
+	GameAllocMemUsed += Snapshot.memUsed;
+	GameAllocMemFree -= Snapshot.memUsed;
+
+	const BYTE *ptr = Snapshot.data + Snapshot.memUsed;
+	for( DWORD i = 0; i < ARRAY_SIZE(SnapshotGlobals); ++i ) {
+		memcpy(SnapshotGlobals[i].ptr, ptr, SnapshotGlobals[i].size);
+		ptr += SnapshotGlobals[i].size;
+	}
+	return Snapshot.itemsOffset;
+}
+
+// The snapshot is freed when the level is unloaded, since it needs the level textures
+void FreeLevelSnapshot() {
+	free(Snapshot.data);
+	memset(&Snapshot, 0, sizeof(Snapshot));
+}
+#endif // FEATURE_LOADING_IMPROVED
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/level_stream.h"
+#include "modding/level_prefetch.h"
+#include "global/vars.h"
+
+#ifdef FEATURE_LOADING_IMPROVED
+typedef struct {
+	HANDLE hFile;
+	HANDLE hMapping; // NULL if the file is read into memory
+	BYTE *data;
+	DWORD size;
+	DWORD pos;
+} LEVEL_STREAM;
+
+bool LevelStreamEnabled = true;
+
+static LEVEL_STREAM LevelStream = {INVALID_HANDLE_VALUE, NULL, NULL, 0, 0};
+
+/*
+ * Maps the whole level file into memory (or reads it at once, if mapping
+ * fails), so the level loading functions just copy the data from memory
+ * instead of calling ReadFile for every field. If the file is already
+ * prefetched, its data is used as is. The stream starts at the current
+ * file position.
+ */
+bool LevelStreamOpen(HANDLE hFile) {
+	LevelStreamClose();
+	if( !LevelStreamEnabled || hFile == INVALID_HANDLE_VALUE ) {
+		return false;
+	}
+
+	DWORD size = GetFileSize(hFile, NULL);
+	DWORD pos = SetFilePointer(hFile, 0, NULL, FILE_CURRENT);
+	if( size == INVALID_FILE_SIZE || size == 0 || pos == INVALID_SET_FILE_POINTER ) {
+		return false;
+	}
+
+	BYTE *data = (BYTE *)TakePrefetchedLevel(hFile, size);
+	HANDLE hMapping = NULL;
+	if( data == NULL ) {
+		hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if( hMapping != NULL ) {
+		data = (BYTE *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+		if( data == NULL ) {
+			CloseHandle(hMapping);
+			hMapping = NULL;
+		}
+	}
+	if( data == NULL ) {
+		DWORD bytesRead = 0;
+		data = (BYTE *)malloc(size);
+		if( data == NULL
+			|| SetFilePointer(hFile, 0, NULL, FILE_BEGIN) != 0
+			|| !ReadFile(hFile, data, size, &bytesRead, NULL)
+			|| bytesRead != size )
+		{
+			free(data);
+			SetFilePointer(hFile, pos, NULL, FILE_BEGIN);
+			return false;
+		}
+	}
+
+	LevelStream.hFile = hFile;
+	LevelStream.hMapping = hMapping;
+	LevelStream.data = data;
+	LevelStream.size = size;
+	LevelStream.pos = pos;
+	return true;
+}
+
+void LevelStreamClose() {
+	if( LevelStream.data == NULL ) return;
+
+	// the file pointer is moved to the stream position, so the file can be read as usual
+	SetFilePointer(LevelStream.hFile, LevelStream.pos, NULL, FILE_BEGIN);
+	if( LevelStream.hMapping != NULL ) {
+		UnmapViewOfFile(LevelStream.data);
+		CloseHandle(LevelStream.hMapping);
+	} else {
+		free(LevelStream.data);
+	}
+	LevelStream.hFile = INVALID_HANDLE_VALUE;
+	LevelStream.hMapping = NULL;
+	LevelStream.data = NULL;
+	LevelStream.size = 0;
+	LevelStream.pos = 0;
+}
+
+bool IsLevelStream(HANDLE hFile) {
+	return ( LevelStream.data != NULL && LevelStream.hFile == hFile );
+}
+
+// Works like ReadFile, the data is just copied from the stream
+BOOL LevelStreamRead(LPVOID buffer, DWORD size, LPDWORD bytesRead) {
+	DWORD left = ( LevelStream.pos < LevelStream.size ) ? LevelStream.size - LevelStream.pos : 0;
+	CLAMPG(size, left);
+	memcpy(buffer, LevelStream.data + LevelStream.pos, size);
+	LevelStream.pos += size;
+	if( bytesRead != NULL ) {
+		*bytesRead = size;
+	}
+	return TRUE;
+}
+
+/*
+ * Returns the pointer to the stream data and skips it, so the data that
+ * is not kept in the level memory (like texture pages) is used without
+ * copying. The pointer is valid until the stream is closed.
+ */
+LPCVOID LevelStreamView(DWORD size) {
+	if( LevelStream.pos > LevelStream.size || size > LevelStream.size - LevelStream.pos ) {
+		return NULL;
+	}
+	LPCVOID view = LevelStream.data + LevelStream.pos;
+	LevelStream.pos += size;
+	return view;
+}
+
+// Works like SetFilePointer for 32-bit positions
+DWORD LevelStreamSeek(LONG distance, DWORD method) {
+	LONGLONG pos = distance;
+	if( method == FILE_CURRENT ) {
+		pos += LevelStream.pos;
+	} else if( method == FILE_END ) {
+		pos += LevelStream.size;
+	}
+	if( pos < 0 || pos > 0xFFFFFFFE ) {
+		return INVALID_SET_FILE_POINTER;
+	}
+	LevelStream.pos = (DWORD)pos;
+	return LevelStream.pos;
+}
+#endif // FEATURE_LOADING_IMPROVED
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/profiler.h"
+#include "3dsystem/3d_gen.h"
+#include "game/text.h"
+#include "specific/hwr.h"
+#include "modding/file_utils.h"
+#include "global/vars.h"
+
+#ifdef FEATURE_PROFILER
+#define PROFILER_FRAMES		(256) // ring buffer size
+#define PROFILER_PATH		".\\profiler"
+#define PROFILER_REFRESH	(15) // overlay is refreshed every 15 frames
+#define PROFILER_POLYTYPES	(32) // enough for any POLYTYPE value
+#define PROFILER_LINES		(PROF_NumberPhases + 7)
+
+typedef struct {
+	DWORD surfaces;
+	DWORD surfacesSize;
+	DWORD info3d;
+	DWORD info3dSize;
+	DWORD vertices;
+	DWORD verticesSize;
+	DWORD overflow; // queue entries beyond the fixed arrays
+	DWORD drawCalls;
+	DWORD stateChanges;
+	DWORD overdrawPixels;
+	DWORD screenPixels;
+	DWORD polyTypes[PROFILER_POLYTYPES];
+} RENDER_QUEUE_STATS;
+
+static const char *PhaseNames[PROF_NumberPhases] = {
+	"Frame",
+	"Control",
+	"Items",
+	"Lara",
+	"Draw",
+	"Rooms",
+	"Sort",
+	"Output",
+	"HWR",
+};
+
+static bool ProfilerEnabled = false;
+static double CounterPeriod = 0.0; // milliseconds per counter tick
+static LONGLONG PhaseStart[PROF_NumberPhases];
+static LONGLONG PhaseTotal[PROF_NumberPhases];
+static float FrameRing[PROFILER_FRAMES][PROF_NumberPhases];
+static DWORD FrameCount = 0;
+static RENDER_QUEUE_STATS QueueStats;
+static RENDER_QUEUE_STATS QueuePeaks;
+static RENDER_QUEUE_STATS QueueRing[PROFILER_FRAMES];
+static TEXT_STR_INFO *OverlayText[PROFILER_LINES];
+
+static LONGLONG GetCounter() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+static int CompareFloat(const void *a, const void *b) {
+	float fa = *(const float *)a;
+	float fb = *(const float *)b;
+	return ( fa > fb ) - ( fa < fb );
+}
+
+static void RemoveOverlay() {
+	for( int i = 0; i < PROFILER_LINES; ++i ) {
+		T_RemovePrint(OverlayText[i]);
+		OverlayText[i] = NULL;
+	}
+}
+
+static void PrintOverlayLine(int line, const char *str) {
+	if( OverlayText[line] == NULL ) {
+		OverlayText[line] = T_Print(-8, 48 + line * 14, 0, str);
+		T_RightAlign(OverlayText[line], 1);
+	} else {
+		T_ChangeText(OverlayText[line], str);
+	}
+}
+
+static void UpdateOverlay() {
+	static float sorted[PROFILER_FRAMES];
+	char str[64];
+	DWORD count = MIN(FrameCount, PROFILER_FRAMES);
+	if( count == 0 ) return;
+
+	PrintOverlayLine(0, "ms  min avg p99");
+	for( int i = 0; i < PROF_NumberPhases; ++i ) {
+		double sum = 0.0;
+		for( DWORD j = 0; j < count; ++j ) {
+			sorted[j] = FrameRing[j][i];
+			sum += sorted[j];
+		}
+		qsort(sorted, count, sizeof(float), CompareFloat);
+		snprintf(str, sizeof(str), "%s %.2f %.2f %.2f",
+			PhaseNames[i], sorted[0], sum / count, sorted[(count - 1) * 99 / 100]);
+		PrintOverlayLine(i + 1, str);
+	}
+
+	RENDER_QUEUE_STATS *last = &QueueRing[(FrameCount - 1) % PROFILER_FRAMES];
+	snprintf(str, sizeof(str), "Polys %lu peak %lu of %lu",
+		last->surfaces, QueuePeaks.surfaces, last->surfacesSize);
+	PrintOverlayLine(PROF_NumberPhases + 1, str);
+	snprintf(str, sizeof(str), "Info3d %lu peak %lu of %lu",
+		last->info3d, QueuePeaks.info3d, last->info3dSize);
+	PrintOverlayLine(PROF_NumberPhases + 2, str);
+	snprintf(str, sizeof(str), "Verts %lu peak %lu of %lu",
+		last->vertices, QueuePeaks.vertices, last->verticesSize);
+	PrintOverlayLine(PROF_NumberPhases + 3, str);
+	snprintf(str, sizeof(str), "Overflow %lu peak %lu", last->overflow, QueuePeaks.overflow);
+	PrintOverlayLine(PROF_NumberPhases + 4, str);
+	snprintf(str, sizeof(str), "Draws %lu states %lu peak %lu",
+		last->drawCalls, last->stateChanges, QueuePeaks.drawCalls);
+	PrintOverlayLine(PROF_NumberPhases + 5, str);
+	if( last->screenPixels != 0 ) {
+		snprintf(str, sizeof(str), "Overdraw %.2f", (double)last->overdrawPixels / (double)last->screenPixels);
+	} else {
+		snprintf(str, sizeof(str), "Overdraw n/a");
+	}
+	PrintOverlayLine(PROF_NumberPhases + 6, str);
+}
+
+void ProfilerBegin(PROFILER_PHASE phase) {
+	if( !ProfilerEnabled ) return;
+	PhaseStart[phase] = GetCounter();
+}
+
+void ProfilerEnd(PROFILER_PHASE phase) {
+	if( !ProfilerEnabled || !PhaseStart[phase] ) return;
+	PhaseTotal[phase] += GetCounter() - PhaseStart[phase];
+	PhaseStart[phase] = 0;
+}
+
+void ProfilerNextFrame() {
+	if( !ProfilerEnabled ) return;
+	LONGLONG now = GetCounter();
+	if( PhaseStart[PROF_Frame] ) {
+		PhaseTotal[PROF_Frame] = now - PhaseStart[PROF_Frame];
+		float *frame = FrameRing[FrameCount % PROFILER_FRAMES];
+		for( int i = 0; i < PROF_NumberPhases; ++i ) {
+			frame[i] = (float)((double)PhaseTotal[i] * CounterPeriod);
+		}
+		QueueRing[FrameCount % PROFILER_FRAMES] = QueueStats;
+		CLAMPL(QueuePeaks.overflow, QueueStats.overflow);
+		CLAMPL(QueuePeaks.drawCalls, QueueStats.drawCalls);
+		CLAMPL(QueuePeaks.stateChanges, QueueStats.stateChanges);
+		if( ++FrameCount % PROFILER_REFRESH == 0 ) {
+			UpdateOverlay();
+		}
+	}
+	memset(PhaseTotal, 0, sizeof(PhaseTotal));
+	memset(&QueueStats, 0, sizeof(QueueStats));
+	PhaseStart[PROF_Frame] = now;
+}
+
+void ProfilerToggle() {
+	if( ProfilerEnabled ) {
+		ProfilerEnabled = false;
+		RemoveOverlay();
+		return;
+	}
+	LARGE_INTEGER frequency;
+	if( !QueryPerformanceFrequency(&frequency) ) return;
+	CounterPeriod = 1000.0 / (double)frequency.QuadPart;
+	memset(PhaseStart, 0, sizeof(PhaseStart));
+	memset(PhaseTotal, 0, sizeof(PhaseTotal));
+	memset(&QueueStats, 0, sizeof(QueueStats));
+	memset(&QueuePeaks, 0, sizeof(QueuePeaks));
+	FrameCount = 0;
+	ProfilerEnabled = true;
+}
+
+bool IsProfilerEnabled() {
+	return ProfilerEnabled;
+}
+
+void ProfilerResetOverlay() {
+	// text slots are already released by T_InitPrint
+	memset(OverlayText, 0, sizeof(OverlayText));
+}
+
+bool ProfilerSaveCSV() {
+	static int fileNumber = 0;
+	char fileName[MAX_PATH];
+	DWORD count = MIN(FrameCount, PROFILER_FRAMES);
+	if( count == 0 ) return false;
+
+	fileNumber = CreateSequenceFilename(fileName, sizeof(fileName), PROFILER_PATH, ".csv", "frames", 4, fileNumber);
+	if( fileNumber < 0 ) return false;
+	++fileNumber;
+	CreateDirectories(fileName, true);
+
+	FILE *fp = fopen(fileName, "wt");
+	if( fp == NULL ) return false;
+	fprintf(fp, "frame");
+	for( int i = 0; i < PROF_NumberPhases; ++i ) {
+		fprintf(fp, ",%s_ms", PhaseNames[i]);
+	}
+	fprintf(fp, ",surfaces,info3d,vertices,overflow,draw_calls,state_changes,overdraw_pixels,screen_pixels");
+	for( int i = 0; i < PROFILER_POLYTYPES; ++i ) {
+		fprintf(fp, ",polytype%d", i);
+	}
+	fprintf(fp, "\n");
+	for( DWORD j = FrameCount - count; j < FrameCount; ++j ) {
+		RENDER_QUEUE_STATS *stats = &QueueRing[j % PROFILER_FRAMES];
+		fprintf(fp, "%lu", j);
+		for( int i = 0; i < PROF_NumberPhases; ++i ) {
+			fprintf(fp, ",%.3f", FrameRing[j % PROFILER_FRAMES][i]);
+		}
+		fprintf(fp, ",%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu", stats->surfaces, stats->info3d, stats->vertices, stats->overflow,
+			stats->drawCalls, stats->stateChanges, stats->overdrawPixels, stats->screenPixels);
+		for( int i = 0; i < PROFILER_POLYTYPES; ++i ) {
+			fprintf(fp, ",%lu", stats->polyTypes[i]);
+		}
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+	return true;
+}
+
+#ifdef FEATURE_RENDER_IMPROVED
+/*
+ * Collects the render queue statistics right before the polygon list output.
+ * The poly list grows on demand, so there are no overflows to detect here.
+ */
+void ProfilerRenderQueue() {
+	POLYLIST_USAGE usage;
+	if( !ProfilerEnabled ) return;
+
+	phd_GetPolyListUsage(&usage);
+	QueueStats.surfaces = usage.surfaces;
+	QueueStats.surfacesSize = usage.surfacesSize;
+	QueueStats.info3d = usage.info3d;
+	QueueStats.info3dSize = usage.info3dSize;
+	QueueStats.vertices = usage.vertices;
+	QueueStats.verticesSize = usage.verticesSize;
+#else // FEATURE_RENDER_IMPROVED
+/*
+ * Collects the render queue statistics right before the polygon list output.
+ * The queues are fixed arrays filled with no bounds checks, so the overflow
+ * can be detected only after the fact. It is saved into the CSV, and it is
+ * reported on exit even if the profiler is off, since the memory behind
+ * the queue is corrupted already.
+ */
+void ProfilerRenderQueue() {
+	static bool isReported = false;
+	DWORD info3d = Info3dPtr - Info3dBuffer;
+	DWORD vertices = 0;
+	DWORD overflow = 0;
+	if( SavedAppSettings.RenderMode == RM_Hardware ) {
+		vertices = HWR_VertexPtr - HWR_VertexBuffer;
+	}
+	if( SurfaceCount > ARRAY_SIZE(SortBuffer) ) {
+		overflow += SurfaceCount - ARRAY_SIZE(SortBuffer);
+	}
+	if( info3d > ARRAY_SIZE(Info3dBuffer) ) {
+		overflow += info3d - ARRAY_SIZE(Info3dBuffer);
+	}
+	if( overflow != 0 && !isReported ) {
+		// report it just once, since it happens every frame of the scene
+		snprintf(StringToShow, sizeof(StringToShow), "Render queue overflow: %lu of %u surfaces, %lu of %u info3d words",
+			SurfaceCount, ARRAY_SIZE(SortBuffer), info3d, ARRAY_SIZE(Info3dBuffer));
+		isReported = true;
+	}
+	if( !ProfilerEnabled ) return;
+
+	QueueStats.overflow = overflow;
+	QueueStats.surfaces = SurfaceCount;
+	QueueStats.surfacesSize = ARRAY_SIZE(SortBuffer);
+	QueueStats.info3d = info3d;
+	QueueStats.info3dSize = ARRAY_SIZE(Info3dBuffer);
+	QueueStats.vertices = vertices;
+	QueueStats.verticesSize = ARRAY_SIZE(HWR_VertexBuffer);
+	CLAMPG(QueueStats.surfaces, QueueStats.surfacesSize);
+#endif // FEATURE_RENDER_IMPROVED
+	memset(QueueStats.polyTypes, 0, sizeof(QueueStats.polyTypes));
+	for( DWORD i = 0; i < QueueStats.surfaces; ++i ) {
+		UINT16 polyType = *(UINT16 *)SortBuffer[i]._0;
+		if( polyType < PROFILER_POLYTYPES ) {
+			++QueueStats.polyTypes[polyType];
+		}
+	}
+	CLAMPL(QueuePeaks.surfaces, QueueStats.surfaces);
+	CLAMPL(QueuePeaks.info3d, QueueStats.info3d);
+	CLAMPL(QueuePeaks.vertices, QueueStats.vertices);
+}
+
+void ProfilerDrawCalls(DWORD drawCalls, DWORD stateChanges) {
+	if( !ProfilerEnabled ) return;
+	// the poly list may be drawn several times per frame
+	QueueStats.drawCalls += drawCalls;
+	QueueStats.stateChanges += stateChanges;
+}
+
+/*
+ * Pixels passed the depth test are counted by the occlusion query, and its
+ * result is taken at the next scene begin, so it comes one frame later.
+ */
+void ProfilerOverdraw(DWORD pixels, DWORD screenPixels) {
+	if( !ProfilerEnabled ) return;
+	QueueStats.overdrawPixels = pixels;
+	QueueStats.screenPixels = screenPixels;
+}
+#endif // FEATURE_PROFILER
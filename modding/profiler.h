@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include "global/types.h"
+
+#ifdef FEATURE_PROFILER
+typedef enum {
+	PROF_Frame,
+	PROF_ControlPhase,
+	PROF_ItemControl,
+	PROF_LaraControl,
+	PROF_DrawPhase,
+	PROF_DrawRooms,
+	PROF_SortPolyList,
+	PROF_OutputPolyList,
+	PROF_HwrDrawPolyList,
+	PROF_NumberPhases,
+} PROFILER_PHASE;
+
+/*
+ * Function list
+ */
+void ProfilerBegin(PROFILER_PHASE phase);
+void ProfilerEnd(PROFILER_PHASE phase);
+void ProfilerNextFrame();
+void ProfilerToggle();
+bool IsProfilerEnabled();
+void ProfilerResetOverlay();
+bool ProfilerSaveCSV();
+void ProfilerRenderQueue();
+void ProfilerDrawCalls(DWORD drawCalls, DWORD stateChanges);
+void ProfilerOverdraw(DWORD pixels, DWORD screenPixels);
+
+// -------------------
+// Phase scope timer
+// -------------------
+
+class ProfilerScope {
+	private:
+		PROFILER_PHASE phase;
+	public:
+		ProfilerScope(PROFILER_PHASE phase) : phase(phase) { ProfilerBegin(phase); }
+		~ProfilerScope() { ProfilerEnd(phase); }
+};
+
+#define PROFILER_SCOPE(phase)	ProfilerScope profilerScope(phase)
+#define PROFILER_BEGIN(phase)	ProfilerBegin(phase)
+#define PROFILER_END(phase)		ProfilerEnd(phase)
+#define PROFILER_NEXT_FRAME()	ProfilerNextFrame()
+#endif // FEATURE_PROFILER
+
+#endif // PROFILER_H_INCLUDED
@@ -24,6 +24,10 @@
 #include "specific/hwr.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_RENDER_IMPROVED
+#include "3dsystem/3d_gen.h"
+#endif // FEATURE_RENDER_IMPROVED
+
 #ifdef FEATURE_HUD_IMPROVED
 extern DWORD HealthBarMode;
 
@@ -148,6 +152,9 @@ void __cdecl PSX_DrawAirBar(int x0, int y0, int x1, int y1, int bar, int pixel,
 
 static void PSX_InsertBar(int polytype, int x0, int y0, int x1, int y1, int bar, int pixel, int alpha) {
 	CLAMP(alpha, 0, 255);
+#ifdef FEATURE_RENDER_IMPROVED
+	phd_ReservePolyList();
+#endif // FEATURE_RENDER_IMPROVED
 	Sort3dPtr->_0 = (DWORD)Info3dPtr;
 	Sort3dPtr->_1 = (DWORD)PhdNearZ;
 	++Sort3dPtr;
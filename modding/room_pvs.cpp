@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/room_pvs.h"
+#include "global/vars.h"
+
+#ifdef FEATURE_RENDER_IMPROVED
+// Door vertices closer to a plane than this are treated as lying on it
+#define PVS_EPSILON		(1.0)
+
+typedef struct {
+	double nx, ny, nz, d; // the owner room is on the positive side
+	double vtx[4][3];
+	int owner;
+	int room;
+} PVS_DOOR;
+
+bool RoomPvsEnabled = true;
+
+static DWORD *RoomPvs = NULL;
+static int RoomPvsCount = 0;
+static int RoomPvsStride = 0; // DWORDs per room bitset
+static DWORD *RoomPvsOrigin = NULL;
+
+static bool IsBitSet(DWORD *bits, int index) {
+	return CHK_ANY(bits[index / 32], 1 << (index % 32));
+}
+
+static void SetBit(DWORD *bits, int index) {
+	bits[index / 32] |= 1 << (index % 32);
+}
+
+static void GetRoomBox(int roomNumber, double *min, double *max) {
+	ROOM_INFO *room = &RoomInfo[roomNumber];
+	// NOTE: room xSize is the number of sectors along Z axis, and ySize is along X axis
+	min[0] = room->x;
+	min[1] = room->maxCeiling;
+	min[2] = room->z;
+	max[0] = room->x + room->ySize * 0x400;
+	max[1] = room->minFloor;
+	max[2] = room->z + room->xSize * 0x400;
+}
+
+// Checks if any part of the door is behind the plane (looking from the positive side)
+static bool IsDoorBehindPlane(PVS_DOOR *door, PVS_DOOR *plane) {
+	for( int i = 0; i < 4; ++i ) {
+		double dist = plane->nx * door->vtx[i][0] + plane->ny * door->vtx[i][1] + plane->nz * door->vtx[i][2] + plane->d;
+		if( dist < -PVS_EPSILON ) return true;
+	}
+	return false;
+}
+
+// Checks if any part of the room box is in front of the plane
+static bool IsBoxInFrontOfPlane(double *min, double *max, PVS_DOOR *plane) {
+	for( int i = 0; i < 8; ++i ) {
+		double x = CHK_ANY(i, 1) ? max[0] : min[0];
+		double y = CHK_ANY(i, 2) ? max[1] : min[1];
+		double z = CHK_ANY(i, 4) ? max[2] : min[2];
+		if( plane->nx * x + plane->ny * y + plane->nz * z + plane->d > PVS_EPSILON ) return true;
+	}
+	return false;
+}
+
+static int GetFlippedRoom(int roomNumber) {
+	int flipped = RoomInfo[roomNumber].flippedRoom;
+	return ( flipped >= 0 && flipped < RoomCount ) ? flipped : -1;
+}
+
+void FreeRoomPvs() {
+	if( RoomPvs != NULL ) {
+		free(RoomPvs);
+		RoomPvs = NULL;
+	}
+	RoomPvsCount = 0;
+	RoomPvsStride = 0;
+	RoomPvsOrigin = NULL;
+}
+
+// NOTE: this function is absent in the original code
+void BuildRoomPvs() {
+	FreeRoomPvs();
+	if( !RoomPvsEnabled || RoomCount <= 0 ) return;
+
+	// Door planes are taken in world coordinates
+	int *firstDoor = (int *)malloc(sizeof(int) * (RoomCount + 1));
+	if( firstDoor == NULL ) return;
+	int doorsCount = 0;
+	for( int i = 0; i < RoomCount; ++i ) {
+		firstDoor[i] = doorsCount;
+		if( RoomInfo[i].doors != NULL ) doorsCount += RoomInfo[i].doors->wCount;
+	}
+	firstDoor[RoomCount] = doorsCount;
+
+	PVS_DOOR *doors = (PVS_DOOR *)malloc(sizeof(PVS_DOOR) * MAX(doorsCount, 1));
+	int *stack = (int *)malloc(sizeof(int) * MAX(doorsCount, 1));
+	bool *visited = (bool *)malloc(sizeof(bool) * MAX(doorsCount, 1));
+	RoomPvsStride = (RoomCount + 31) / 32;
+	RoomPvs = (DWORD *)calloc(RoomCount * RoomPvsStride, sizeof(DWORD));
+	if( doors == NULL || stack == NULL || visited == NULL || RoomPvs == NULL ) {
+		FreeRoomPvs();
+		goto CLEANUP;
+	}
+
+	for( int i = 0; i < RoomCount; ++i ) {
+		ROOM_INFO *room = &RoomInfo[i];
+		for( int j = 0; j < firstDoor[i+1] - firstDoor[i]; ++j ) {
+			DOOR_INFO *src = &room->doors->door[j];
+			PVS_DOOR *door = &doors[firstDoor[i] + j];
+			for( int k = 0; k < 4; ++k ) {
+				door->vtx[k][0] = room->x + src->vertex[k].x;
+				door->vtx[k][1] = room->y + src->vertex[k].y;
+				door->vtx[k][2] = room->z + src->vertex[k].z;
+			}
+			door->nx = src->x;
+			door->ny = src->y;
+			door->nz = src->z;
+			door->d = -(door->nx * door->vtx[0][0] + door->ny * door->vtx[0][1] + door->nz * door->vtx[0][2]);
+			door->owner = i;
+			door->room = ( src->room >= 0 && src->room < RoomCount ) ? src->room : i;
+		}
+	}
+
+	// A room is potentially visible, if there is a door chain from the
+	// source room to it, where every next door is partially behind both
+	// the first and the previous doors, and faces the source room box.
+	// The flipped rooms swap their contents, so they are always merged.
+	for( int i = 0; i < RoomCount; ++i ) {
+		DWORD *pvs = &RoomPvs[i * RoomPvsStride];
+		int sources[2] = {i, GetFlippedRoom(i)};
+		double boxMin[3], boxMax[3];
+
+		SetBit(pvs, i);
+		if( sources[1] >= 0 ) SetBit(pvs, sources[1]);
+
+		for( int s = 0; s < 2; ++s ) {
+			if( sources[s] < 0 ) continue;
+			GetRoomBox(sources[s], boxMin, boxMax);
+
+			for( int first = firstDoor[sources[s]]; first < firstDoor[sources[s]+1]; ++first ) {
+				int stackSize = 0;
+				memset(visited, 0, sizeof(bool) * doorsCount);
+				visited[first] = true;
+				stack[stackSize++] = first;
+
+				while( stackSize > 0 ) {
+					PVS_DOOR *prev = &doors[stack[--stackSize]];
+					int rooms[2] = {prev->room, GetFlippedRoom(prev->room)};
+
+					for( int r = 0; r < 2; ++r ) {
+						if( rooms[r] < 0 ) continue;
+						SetBit(pvs, rooms[r]);
+						for( int next = firstDoor[rooms[r]]; next < firstDoor[rooms[r]+1]; ++next ) {
+							if( visited[next]
+								|| !IsDoorBehindPlane(&doors[next], &doors[first])
+								|| !IsDoorBehindPlane(&doors[next], prev)
+								|| !IsBoxInFrontOfPlane(boxMin, boxMax, &doors[next]) )
+							{
+								continue;
+							}
+							visited[next] = true;
+							stack[stackSize++] = next;
+						}
+					}
+				}
+			}
+		}
+	}
+	RoomPvsCount = RoomCount;
+
+CLEANUP :
+	free(firstDoor);
+	free(doors);
+	free(stack);
+	free(visited);
+}
+
+// NOTE: this function is absent in the original code
+void SetRoomPvsOrigin(int roomNumber) {
+	RoomPvsOrigin = NULL;
+	if( !RoomPvsEnabled || RoomPvs == NULL || roomNumber < 0 || roomNumber >= RoomPvsCount ) return;
+
+	// The sets are built for the viewer inside the room box,
+	// so the camera pushed out of its room does not use them
+	double boxMin[3], boxMax[3];
+	double camera[3] = {(double)MatrixW2V._03, (double)MatrixW2V._13, (double)MatrixW2V._23};
+	GetRoomBox(roomNumber, boxMin, boxMax);
+	for( int i = 0; i < 3; ++i ) {
+		if( camera[i] < boxMin[i] || camera[i] > boxMax[i] ) return;
+	}
+	RoomPvsOrigin = &RoomPvs[roomNumber * RoomPvsStride];
+}
+
+// NOTE: this function is absent in the original code
+bool IsRoomPotentiallyVisible(int roomNumber) {
+	if( RoomPvsOrigin == NULL || roomNumber < 0 || roomNumber >= RoomPvsCount ) return true;
+	return IsBitSet(RoomPvsOrigin, roomNumber);
+}
+#endif // FEATURE_RENDER_IMPROVED
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2017-2020 Michael Chaban. All rights reserved.
+ * Original game is created by Core Design Ltd. in 1997.
+ * Lara Croft and Tomb Raider are trademarks of Embracer Group AB.
+ *
+ * This file is part of TR2Main.
+ *
+ * TR2Main is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TR2Main is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TR2Main.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "global/precompiled.h"
+#include "modding/sample_bank.h"
+#include "modding/file_utils.h"
+#include "modding/level_loader.h"
+#include "specific/init_sound.h"
+#include "global/vars.h"
+
+#ifdef FEATURE_LOADING_IMPROVED
+#define SAMPLE_INDEX_PATH		".\\cache"
+#define SAMPLE_INDEX_MAGIC		(0x49533254) // "T2SI"
+#define SAMPLE_INDEX_VERSION	(1)
+#define SAMPLE_HASH_PART		(0x10000) // file head and tail sizes for the hash
+
+/*
+ * The index file is the header and the table of all samples of the SFX
+ * file. It is rebuilt if the SFX file size or hash are changed. The hash
+ * is taken from the file size, write time, head and tail data, so the
+ * index is checked without reading the whole SFX file.
+ */
+typedef struct {
+	DWORD magic;
+	DWORD version;
+	DWORD fileSize;
+	DWORD fileHash;
+	DWORD count;
+} SAMPLE_INDEX_HEADER;
+
+typedef struct {
+	DWORD offset; // offset of the wave data in the SFX file
+	WAVEPCM_HEADER header;
+} SAMPLE_INDEX_ENTRY;
+
+typedef struct {
+	char fullPath[MAX_PATH];
+	SAMPLE_INDEX_HEADER index;
+	SAMPLE_INDEX_ENTRY *entries;
+	LPDIRECTSOUNDBUFFER *residents; // the samples loaded by the previous levels
+	DWORD *frequencies;
+} SAMPLE_BANK;
+
+typedef struct {
+	const int *sampleIndexes;
+	int sampleCount;
+} BIND_SAMPLES_ARGS;
+
+bool SampleBankEnabled = true;
+
+static SAMPLE_BANK SampleBank;
+
+static DWORD HashData(DWORD hash, LPCVOID data, DWORD size) {
+	const BYTE *ptr = (const BYTE *)data;
+	for( DWORD i = 0; i < size; ++i ) {
+		hash = (hash ^ ptr[i]) * 16777619; // FNV-1a
+	}
+	return hash;
+}
+
+static bool GetSfxFileHash(HANDLE hFile, DWORD *fileSize, DWORD *fileHash) {
+	static BYTE buffer[SAMPLE_HASH_PART];
+	BY_HANDLE_FILE_INFORMATION info;
+	DWORD bytesRead = 0;
+
+	if( !GetFileInformationByHandle(hFile, &info) || info.nFileSizeHigh != 0 ) {
+		return false;
+	}
+	DWORD size = info.nFileSizeLow;
+	DWORD part = MIN(size, SAMPLE_HASH_PART);
+	DWORD hash = 2166136261;
+	hash = HashData(hash, &size, sizeof(size));
+	hash = HashData(hash, &info.ftLastWriteTime, sizeof(FILETIME));
+	if( SetFilePointer(hFile, 0, NULL, FILE_BEGIN) != 0
+		|| !ReadFile(hFile, buffer, part, &bytesRead, NULL) || bytesRead != part )
+	{
+		return false;
+	}
+	hash = HashData(hash, buffer, part);
+	if( SetFilePointer(hFile, size - part, NULL, FILE_BEGIN) != size - part
+		|| !ReadFile(hFile, buffer, part, &bytesRead, NULL) || bytesRead != part )
+	{
+		return false;
+	}
+	hash = HashData(hash, buffer, part);
+	*fileSize = size;
+	*fileHash = hash;
+	return true;
+}
+
+static void GetIndexFileName(LPSTR fileName, DWORD size) {
+	snprintf(fileName, size, SAMPLE_INDEX_PATH "\\%s.idx", PathFindFileName(SampleBank.fullPath));
+}
+
+static bool LoadIndexFile(DWORD fileSize, DWORD fileHash) {
+	char fileName[MAX_PATH];
+	SAMPLE_INDEX_HEADER header;
+
+	GetIndexFileName(fileName, sizeof(fileName));
+	FILE *fp = fopen(fileName, "rb");
+	if( fp == NULL ) {
+		return false;
+	}
+	if( fread(&header, sizeof(header), 1, fp) != 1
+		|| header.magic != SAMPLE_INDEX_MAGIC
+		|| header.version != SAMPLE_INDEX_VERSION
+		|| header.fileSize != fileSize
+		|| header.fileHash != fileHash
+		|| header.count == 0 )
+	{
+		fclose(fp);
+		return false;
+	}
+	SAMPLE_INDEX_ENTRY *entries = (SAMPLE_INDEX_ENTRY *)malloc(sizeof(SAMPLE_INDEX_ENTRY) * header.count);
+	if( entries == NULL || fread(entries, sizeof(SAMPLE_INDEX_ENTRY), header.count, fp) != header.count ) {
+		free(entries);
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+	SampleBank.index = header;
+	SampleBank.entries = entries;
+	return true;
+}
+
+static void SaveIndexFile() {
+	char fileName[MAX_PATH];
+
+	CreateDirectories(SAMPLE_INDEX_PATH, false);
+	GetIndexFileName(fileName, sizeof(fileName));
+	FILE *fp = fopen(fileName, "wb");
+	if( fp == NULL ) {
+		return; // the index is just built again next time
+	}
+	fwrite(&SampleBank.index, sizeof(SAMPLE_INDEX_HEADER), 1, fp);
+	fwrite(SampleBank.entries, sizeof(SAMPLE_INDEX_ENTRY), SampleBank.index.count, fp);
+	fclose(fp);
+}
+
+// Walks all RIFF headers of the SFX file once, the same way LoadSamples does
+static bool BuildIndex(HANDLE hFile, DWORD fileSize, DWORD fileHash) {
+	DWORD count = 0;
+	DWORD capacity = 0;
+	DWORD offset = 0;
+	SAMPLE_INDEX_ENTRY *entries = NULL;
+
+	if( SetFilePointer(hFile, 0, NULL, FILE_BEGIN) != 0 ) {
+		return false;
+	}
+	while( offset + sizeof(WAVEPCM_HEADER) <= fileSize ) {
+		WAVEPCM_HEADER header;
+		DWORD bytesRead = 0;
+		if( !ReadFile(hFile, &header, sizeof(header), &bytesRead, NULL) || bytesRead != sizeof(header) ) {
+			break;
+		}
+		if( header.dwRiffChunkID != 0x46464952 || // "RIFF"
+			header.dwFormat != 0x45564157 || // "WAVE"
+			header.dwDataSubchunkID != 0x61746164 ) // "data"
+		{
+			break;
+		}
+		DWORD dataSize = (header.dwDataSubchunkSize + 1) & ~1; // aligned data size
+		offset += sizeof(header);
+		if( dataSize > fileSize - offset ) {
+			break;
+		}
+		if( count >= capacity ) {
+			capacity = capacity ? capacity * 2 : 256;
+			SAMPLE_INDEX_ENTRY *ptr = (SAMPLE_INDEX_ENTRY *)realloc(entries, sizeof(SAMPLE_INDEX_ENTRY) * capacity);
+			if( ptr == NULL ) {
+				free(entries);
+				return false;
+			}
+			entries = ptr;
+		}
+		entries[count].offset = offset;
+		entries[count].header = header;
+		++count;
+		offset += dataSize;
+		if( SetFilePointer(hFile, offset, NULL, FILE_BEGIN) != offset ) {
+			break;
+		}
+	}
+	if( count == 0 ) {
+		free(entries);
+		return false;
+	}
+	SampleBank.index.magic = SAMPLE_INDEX_MAGIC;
+	SampleBank.index.version = SAMPLE_INDEX_VERSION;
+	SampleBank.index.fileSize = fileSize;
+	SampleBank.index.fileHash = fileHash;
+	SampleBank.index.count = count;
+	SampleBank.entries = entries;
+	return true;
+}
+
+static bool OpenBank(HANDLE hFile) {
+	DWORD fileSize, fileHash;
+	if( !GetSfxFileHash(hFile, &fileSize, &fileHash) ) {
+		return false;
+	}
+	if( SampleBank.entries != NULL
+		&& SampleBank.index.fileSize == fileSize
+		&& SampleBank.index.fileHash == fileHash )
+	{
+		return true;
+	}
+
+	char fullPath[MAX_PATH];
+	snprintf(fullPath, sizeof(fullPath), "%s", SampleBank.fullPath);
+	SampleBankRelease();
+	snprintf(SampleBank.fullPath, sizeof(SampleBank.fullPath), "%s", fullPath);
+	if( !LoadIndexFile(fileSize, fileHash) ) {
+		if( !BuildIndex(hFile, fileSize, fileHash) ) {
+			return false;
+		}
+		SaveIndexFile();
+	}
+	DWORD count = SampleBank.index.count;
+	SampleBank.residents = (LPDIRECTSOUNDBUFFER *)calloc(count, sizeof(LPDIRECTSOUNDBUFFER));
+	SampleBank.frequencies = (DWORD *)calloc(count, sizeof(DWORD));
+	return ( SampleBank.residents != NULL && SampleBank.frequencies != NULL );
+}
+
+/*
+ * Called by the main thread. Binds the resident samples to the level
+ * sample slots, takes the newly created samples as residents, and
+ * releases the residents that are not used by the level.
+ */
+static int __cdecl BindSamplesCall(LPVOID param) {
+	BIND_SAMPLES_ARGS *args = (BIND_SAMPLES_ARGS *)param;
+	DWORD count = SampleBank.index.count;
+	bool *isUsed = (bool *)calloc(count, sizeof(bool));
+	if( isUsed == NULL ) {
+		return FALSE;
+	}
+
+	for( int i = 0; i < args->sampleCount && i < (int)ARRAY_SIZE(SampleBuffers); ++i ) {
+		DWORD j = args->sampleIndexes[i];
+		if( SampleBuffers[i] == NULL && SampleBank.residents[j] != NULL ) {
+			SampleBuffers[i] = SampleBank.residents[j];
+			SampleBuffers[i]->AddRef();
+			SampleFreqs[i] = SampleBank.frequencies[j];
+		} else if( SampleBuffers[i] != NULL && SampleBank.residents[j] == NULL ) {
+			SampleBank.residents[j] = SampleBuffers[i];
+			SampleBank.residents[j]->AddRef();
+			SampleBank.frequencies[j] = SampleFreqs[i];
+		}
+		isUsed[j] = true;
+	}
+
+	for( DWORD j = 0; j < count; ++j ) {
+		if( !isUsed[j] && SampleBank.residents[j] != NULL ) {
+			SampleBank.residents[j]->Release();
+			SampleBank.residents[j] = NULL;
+		}
+	}
+	free(isUsed);
+	return TRUE;
+}
+
+static int __cdecl ReleaseSamplesCall(LPVOID param) {
+	for( DWORD j = 0; j < SampleBank.index.count; ++j ) {
+		if( SampleBank.residents[j] != NULL ) {
+			SampleBank.residents[j]->Release();
+			SampleBank.residents[j] = NULL;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Loads the level samples by their offsets from the SFX file index.
+ * The samples that were loaded by the previous level are not read
+ * again, so a level change loads only the missing samples. The level
+ * sample slots must be freed before the call.
+ */
+bool SampleBankLoad(LPCTSTR sfxFileName, const int *sampleIndexes, int sampleCount) {
+	if( !SampleBankEnabled || sfxFileName == NULL || sampleIndexes == NULL || sampleCount <= 0 ) {
+		return false;
+	}
+	if( lstrcmpi(sfxFileName, SampleBank.fullPath) ) {
+		SampleBankRelease();
+		snprintf(SampleBank.fullPath, sizeof(SampleBank.fullPath), "%s", sfxFileName);
+	}
+
+	HANDLE hFile = CreateFile(sfxFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS|FILE_ATTRIBUTE_NORMAL, NULL);
+	if( hFile == INVALID_HANDLE_VALUE ) {
+		return false;
+	}
+	if( !OpenBank(hFile) ) {
+		// the caller loads the samples the original way then
+		CloseHandle(hFile);
+		return false;
+	}
+
+	bool result = true;
+	for( int i = 0; i < sampleCount; ++i ) {
+		DWORD j = sampleIndexes[i];
+		if( j >= SampleBank.index.count ) {
+			result = false;
+			break;
+		}
+		if( SampleBank.residents[j] != NULL ) {
+			continue;
+		}
+		SAMPLE_INDEX_ENTRY *entry = &SampleBank.entries[j];
+		DWORD dataSize = (entry->header.dwDataSubchunkSize + 1) & ~1; // aligned data size
+		LPWAVEFORMATEX waveFormat = (LPWAVEFORMATEX)&entry->header.wFormatTag;
+		waveFormat->cbSize = 0;
+
+		DWORD bytesRead = 0;
+		LPVOID waveData = game_malloc(dataSize, GBUF_Samples);
+		if( SetFilePointer(hFile, entry->offset, NULL, FILE_BEGIN) != entry->offset
+			|| !ReadFile(hFile, waveData, dataSize, &bytesRead, NULL) || bytesRead != dataSize
+			|| !WinSndMakeSample(i, waveFormat, waveData, dataSize) )
+		{
+			game_free(dataSize);
+			result = false;
+			break;
+		}
+		game_free(dataSize);
+		SetLoadingProgress(LOAD_Samples, i + 1, sampleCount);
+	}
+	CloseHandle(hFile);
+
+	if( result ) {
+		BIND_SAMPLES_ARGS args = {sampleIndexes, sampleCount};
+		result = CallOnMainThread(BindSamplesCall, &args);
+		SetLoadingProgress(LOAD_Samples, sampleCount, sampleCount);
+	}
+	return result;
+}
+
+// Releases the resident samples and the index, it must be done before DirectSound is released
+void SampleBankRelease() {
+	if( SampleBank.residents != NULL ) {
+		CallOnMainThread(ReleaseSamplesCall, NULL);
+	}
+	free(SampleBank.residents);
+	free(SampleBank.frequencies);
+	free(SampleBank.entries);
+	memset(&SampleBank, 0, sizeof(SampleBank));
+}
+#endif // FEATURE_LOADING_IMPROVED
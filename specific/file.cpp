@@ -21,6 +21,7 @@
 
 #include "global/precompiled.h"
 #include "specific/file.h"
+#include "game/hair.h"
 #include "game/invfunc.h"
 #include "game/items.h"
 #include "game/setup.h"
@@ -61,6 +62,31 @@ extern bool LoadingScreensEnabled;
 #include "modding/texture_utils.h"
 #endif // FEATURE_HUD_IMPROVED
 
+#ifdef FEATURE_LOADING_IMPROVED
+#include "modding/level_loader.h"
+#include "modding/level_prefetch.h"
+#include "modding/level_snapshot.h"
+#include "modding/level_stream.h"
+#include "modding/sample_bank.h"
+#endif // FEATURE_LOADING_IMPROVED
+
+#ifdef FEATURE_RENDER_IMPROVED
+#include "3dsystem/3d_gen.h"
+#include "modding/room_pvs.h"
+#include "modding/anim_cache.h"
+#endif // FEATURE_RENDER_IMPROVED
+
+// NOTE: this function is absent in the original code
+static DWORD LevelFileSeek(HANDLE hFile, LONG distance, DWORD method) {
+#ifdef FEATURE_LOADING_IMPROVED
+	// while the level file is mapped, its position is kept by the level stream
+	if( IsLevelStream(hFile) ) {
+		return LevelStreamSeek(distance, method);
+	}
+#endif // FEATURE_LOADING_IMPROVED
+	return SetFilePointer(hFile, distance, NULL, method);
+}
+
 #ifdef FEATURE_VIDEOFX_IMPROVED
 static bool MarkSemitransPoly(__int16 *ptrObj, int vtxCount, bool colored, LPVOID param) {
 	UINT16 index = ptrObj[vtxCount];
@@ -334,6 +360,12 @@ static int CreateBgndPatternTexture(HANDLE hFile) {
 	if( hFile == INVALID_HANDLE_VALUE || SavedAppSettings.RenderMode != RM_Hardware || BgndPattern.side <= 0 ) {
 		return -1;
 	}
+#ifdef FEATURE_LOADING_IMPROVED
+	// the texture is created by the main thread
+	if( IsLevelLoaderThread() ) {
+		return CallOnMainThread(CreateBgndPatternTexture, hFile);
+	}
+#endif // FEATURE_LOADING_IMPROVED
 	int pageIndex = -1;
 
 #if (DIRECT3D_VERSION >= 0x900)
@@ -350,7 +382,7 @@ static int CreateBgndPatternTexture(HANDLE hFile) {
 
 	DWORD bytesRead;
 	int pageCount = 0;
-	SetFilePointer(hFile, LevelFileTexPagesOffset, NULL, FILE_BEGIN);
+	LevelFileSeek(hFile, LevelFileTexPagesOffset, FILE_BEGIN);
 	ReadFileSync(hFile, &pageCount, sizeof(pageCount), &bytesRead, NULL);
 	if( BgndPattern.page >= pageCount ) {
 		return -1;
@@ -365,12 +397,12 @@ static int CreateBgndPatternTexture(HANDLE hFile) {
 	DWORD pageSize = ( TextureFormat.bpp < 16 ) ? 256*256*1 : 256*256*2;
 	BYTE *bitmap = (BYTE *)GlobalAlloc(GMEM_FIXED, pageSize);
 	if( TextureFormat.bpp < 16 ) {
-		SetFilePointer(hFile, BgndPattern.page*(256*256*1), NULL, FILE_CURRENT);
+		LevelFileSeek(hFile, BgndPattern.page*(256*256*1), FILE_CURRENT);
 		ReadFileSync(hFile, bitmap, pageSize, &bytesRead, NULL);
 		pageIndex = MakeCustomTexture(BgndPattern.x, BgndPattern.y, BgndPattern.side, BgndPattern.side,
 									256, BgndPattern.side, 8, bitmap, GamePalette8, PaletteIndex, NULL, false);
 	} else {
-		SetFilePointer(hFile, pageCount*(256*256*1) + BgndPattern.page*(256*256*2), NULL, FILE_CURRENT);
+		LevelFileSeek(hFile, pageCount*(256*256*1) + BgndPattern.page*(256*256*2), FILE_CURRENT);
 		ReadFileSync(hFile, bitmap, pageSize, &bytesRead, NULL);
 		pageIndex = MakeCustomTexture(BgndPattern.x, BgndPattern.y, BgndPattern.side, BgndPattern.side,
 									256, BgndPattern.side, 16, bitmap, NULL, -1, NULL, false);
@@ -392,10 +424,20 @@ static GF_LEVEL_TYPE LoadLevelType = GFL_NOLEVEL;
 BOOL __cdecl ReadFileSync(HANDLE hFile, LPVOID lpBuffer, DWORD nBytesToRead, LPDWORD lpnBytesRead, LPOVERLAPPED lpOverlapped) {
 	ReadFileBytesCounter += nBytesToRead;
 
+#ifdef FEATURE_LOADING_IMPROVED
+	// the level loader thread has no window, the main thread pumps messages for it
+	if( ReadFileBytesCounter > 0x4000 && !IsLevelLoaderThread() ) {
+#else // FEATURE_LOADING_IMPROVED
 	if( ReadFileBytesCounter > 0x4000 ) {
+#endif // FEATURE_LOADING_IMPROVED
 		ReadFileBytesCounter = 0;
 		WinVidSpinMessageLoop(false);
 	}
+#ifdef FEATURE_LOADING_IMPROVED
+	if( IsLevelStream(hFile) ) {
+		return LevelStreamRead(lpBuffer, nBytesToRead, lpnBytesRead);
+	}
+#endif // FEATURE_LOADING_IMPROVED
 	return ReadFile(hFile, lpBuffer, nBytesToRead, lpnBytesRead, lpOverlapped);
 }
 
@@ -406,6 +448,12 @@ BOOL __cdecl LoadTexturePages(HANDLE hFile) {
 	LPVOID texPageBuffer;
 	BYTE *texPagePtr;
 
+#ifdef FEATURE_LOADING_IMPROVED
+	// texture pages are converted right into the renderer textures, so the main thread loads them
+	if( IsLevelLoaderThread() ) {
+		return CallOnMainThread(LoadTexturePages, hFile);
+	}
+#endif // FEATURE_LOADING_IMPROVED
 	ReadFileSync(hFile, &pageCount, sizeof(pageCount), &bytesRead, NULL);
 
 	// for software renderer read 8bit texture pages to GAME allocated buffer and skip 16bit pages
@@ -416,7 +464,27 @@ BOOL __cdecl LoadTexturePages(HANDLE hFile) {
 			}
 			ReadFileSync(hFile, TexturePageBuffer8[i], 256*256*1, &bytesRead, NULL);
 		}
-		SetFilePointer(hFile, pageCount*(256*256*2), NULL, FILE_CURRENT);
+		LevelFileSeek(hFile, pageCount*(256*256*2), FILE_CURRENT);
+#ifdef FEATURE_LOADING_IMPROVED
+	} else if( IsLevelStream(hFile) ) {
+		// for hardware renderer upload texture pages right from the mapped level file, without the temporary copy
+		if( TextureFormat.bpp < 16 ) {
+			texPageBuffer = (LPVOID)LevelStreamView(pageCount*(256*256*1));
+			LevelStreamSeek(pageCount*(256*256*2), FILE_CURRENT);
+		} else {
+			LevelStreamSeek(pageCount*(256*256*1), FILE_CURRENT);
+			texPageBuffer = (LPVOID)LevelStreamView(pageCount*(256*256*2));
+		}
+		if( texPageBuffer == NULL )
+			return FALSE;
+
+		HWR_LoadTexturePages(pageCount, texPageBuffer, ( TextureFormat.bpp < 16 ) ? GamePalette8 : NULL);
+#ifdef FEATURE_RENDER_IMPROVED
+		HwrTexturePagesCount = pageCount + HWR_GetAtlasCount();
+#else // FEATURE_RENDER_IMPROVED
+		HwrTexturePagesCount = pageCount;
+#endif // FEATURE_RENDER_IMPROVED
+#endif // FEATURE_LOADING_IMPROVED
 	} else {
 		// for hardware renderer do BPP check and load 8 bit or 16 bit texture pages to GLOBAL allocated memory and skip others
 		pageSize = ( TextureFormat.bpp < 16 ) ? 256*256*1 : 256*256*2;
@@ -433,11 +501,11 @@ BOOL __cdecl LoadTexturePages(HANDLE hFile) {
 				ReadFileSync(hFile, texPagePtr, pageSize, &bytesRead, NULL);
 				texPagePtr += pageSize;
 			}
-			SetFilePointer(hFile, pageCount*(256*256*2), NULL, FILE_CURRENT);
+			LevelFileSeek(hFile, pageCount*(256*256*2), FILE_CURRENT);
 			HWR_LoadTexturePages(pageCount, texPageBuffer, GamePalette8);
 		} else {
 			// skip 8 bit texture pages and load 16 bit texture pages
-			SetFilePointer(hFile, pageCount*(256*256*1), NULL, FILE_CURRENT);
+			LevelFileSeek(hFile, pageCount*(256*256*1), FILE_CURRENT);
 			for( i=0; i<pageCount; ++i ) {
 				ReadFileSync(hFile, texPagePtr, pageSize, &bytesRead, NULL);
 				texPagePtr += pageSize;
@@ -447,11 +515,24 @@ BOOL __cdecl LoadTexturePages(HANDLE hFile) {
 
 		// for hardware renderer textures stored in videomemory so we may clean up system memory
 		GlobalFree(texPageBuffer);
+#ifdef FEATURE_RENDER_IMPROVED
+		HwrTexturePagesCount = pageCount + HWR_GetAtlasCount();
+#else // FEATURE_RENDER_IMPROVED
 		HwrTexturePagesCount = pageCount;
+#endif // FEATURE_RENDER_IMPROVED
+	}
+#ifdef FEATURE_RENDER_IMPROVED
+	// the texture atlases may be changed on reload, so remap UVs again
+	if( TextureInfoCount != 0 ) {
+		AdjustTextureUVs(false);
 	}
+#endif // FEATURE_RENDER_IMPROVED
 #ifdef FEATURE_HUD_IMPROVED
 	LoadButtonSprites();
 #endif // FEATURE_HUD_IMPROVED
+#ifdef FEATURE_LOADING_IMPROVED
+	SetLoadingProgress(LOAD_Textures, pageCount, pageCount);
+#endif // FEATURE_LOADING_IMPROVED
 
 	return TRUE;
 }
@@ -467,6 +548,10 @@ BOOL __cdecl LoadRooms(HANDLE hFile) {
 		lstrcpy(StringToShow, "LoadRoom(): Too many rooms");
 		return FALSE;
 	}
+#ifdef FEATURE_RENDER_IMPROVED
+	// retained room vertices belong to the previous level
+	ResetRoomVertexCache();
+#endif // FEATURE_RENDER_IMPROVED
 
 	// Allocate memory for room info
 	RoomInfo = (ROOM_INFO *)game_malloc(sizeof(ROOM_INFO)*RoomCount, GBUF_RoomInfos);
@@ -544,12 +629,20 @@ BOOL __cdecl LoadRooms(HANDLE hFile) {
 		RoomInfo[i].boundBottom = 0;
 		RoomInfo[i].itemNumber = -1;
 		RoomInfo[i].fxNumber = -1;
+#ifdef FEATURE_LOADING_IMPROVED
+		SetLoadingProgress(LOAD_Rooms, i + 1, RoomCount);
+#endif // FEATURE_LOADING_IMPROVED
 	}
 
 	// Read floor data
 	ReadFileSync(hFile, &dwCount, sizeof(DWORD), &bytesRead, NULL);
 	FloorData = (__int16 *)game_malloc(sizeof(__int16)*dwCount, GBUF_FloorData);
 	ReadFileSync(hFile, FloorData, sizeof(__int16)*dwCount, &bytesRead, NULL);
+#ifdef FEATURE_RENDER_IMPROVED
+	BuildRoomPvs();
+	BuildRoomLightGrids();
+	BuildRoomLightProbes();
+#endif // FEATURE_RENDER_IMPROVED
 	return TRUE;
 }
 
@@ -578,6 +671,10 @@ void __cdecl AdjustTextureUVs(bool resetUvAdd) {
 					pUV[j].v = pBackup[j].v + ((uvFlags & 2) ? -UvAdd : UvAdd);
 					uvFlags >>= 2;
 				}
+#ifdef FEATURE_RENDER_IMPROVED
+				PhdTextureInfo[i].tpage = TextureBackupUV[i].tpage;
+				HWR_AtlasTextureUV(&PhdTextureInfo[i]);
+#endif // FEATURE_RENDER_IMPROVED
 			}
 			return;
 		}
@@ -593,6 +690,10 @@ void __cdecl AdjustTextureUVs(bool resetUvAdd) {
 	}
 
 	for( i=0; i<TextureInfoCount; ++i ) {
+#ifdef FEATURE_RENDER_IMPROVED
+		// the page may be remapped to the texture atlas, so take the original one
+		PhdTextureInfo[i].tpage = TextureBackupUV[i].tpage;
+#endif // FEATURE_RENDER_IMPROVED
 		if( SavedAppSettings.RenderMode == RM_Hardware ) {
 			// NOTE: page side is not counted in the original game, but we need it for HD textures
 			offset = UvAdd * 256 / GetTextureSideByPage(PhdTextureInfo[i].tpage);
@@ -610,6 +711,11 @@ void __cdecl AdjustTextureUVs(bool resetUvAdd) {
 			pUV[j].v = pBackup[j].v + ((uvFlags & 2) ? -offset : offset);
 			uvFlags >>= 2;
 		}
+#ifdef FEATURE_RENDER_IMPROVED
+		if( SavedAppSettings.RenderMode == RM_Hardware ) {
+			HWR_AtlasTextureUV(&PhdTextureInfo[i]);
+		}
+#endif // FEATURE_RENDER_IMPROVED
 	}
 }
 
@@ -665,6 +771,9 @@ BOOL __cdecl LoadObjects(HANDLE hFile) {
 	ReadFileSync(hFile, &dwCount, sizeof(DWORD), &bytesRead, NULL);
 	AnimFrames = (__int16 *)game_malloc(sizeof(__int16)*dwCount, GBUF_Frames);
 	ReadFileSync(hFile, AnimFrames, sizeof(__int16)*dwCount, &bytesRead, NULL);
+#ifdef FEATURE_RENDER_IMPROVED
+	DWORD framesSize = dwCount;
+#endif // FEATURE_RENDER_IMPROVED
 
 	// Remap anim pointers
 	for( i = 0; i < animCount; ++i )
@@ -681,10 +790,16 @@ BOOL __cdecl LoadObjects(HANDLE hFile) {
 		ReadFileSync(hFile, &Objects[objNumber].animIndex, sizeof(__int16), &bytesRead, NULL);
 		Objects[objNumber].frameBase = (__int16 *)((DWORD)AnimFrames + animOffset);
 		Objects[objNumber].loaded = 1;
+#ifdef FEATURE_LOADING_IMPROVED
+		SetLoadingProgress(LOAD_Objects, i + 1, dwCount);
+#endif // FEATURE_LOADING_IMPROVED
 	}
 
 	// Initialise animated objects
 	InitialiseObjects();
+#ifdef FEATURE_RENDER_IMPROVED
+	BuildAnimFrameCache(animCount, framesSize);
+#endif // FEATURE_RENDER_IMPROVED
 
 	// Load static objects
 	ReadFileSync(hFile, &dwCount, sizeof(DWORD), &bytesRead, NULL);
@@ -746,7 +861,7 @@ BOOL __cdecl LoadSprites(HANDLE hFile) {
 			Objects[objNumber].loaded = 1;
 		} else {
 			objNumber -= ID_NUMBER_OBJECTS;
-			SetFilePointer(hFile, sizeof(__int16), NULL, FILE_CURRENT); // StaticObjects don't have nMeshes (just one mesh)
+			LevelFileSeek(hFile, sizeof(__int16), FILE_CURRENT); // StaticObjects don't have nMeshes (just one mesh)
 			ReadFileSync(hFile, &StaticObjects[objNumber].meshIndex, sizeof(__int16), &bytesRead, NULL);
 		}
 	}
@@ -926,7 +1041,7 @@ BOOL __cdecl LoadBoxes(HANDLE hFile) {
 				(j == 1 && !Objects[ID_SPIDER_or_WOLF].loaded && !Objects[ID_SKIDOO_ARMED].loaded) ||
 				(j == 3 && !Objects[ID_YETI].loaded && !Objects[ID_WORKER3].loaded) )
 			{
-				SetFilePointer(hFile, sizeof(__int16)*BoxesCount, NULL, FILE_CURRENT); // skip some GroundZones
+				LevelFileSeek(hFile, sizeof(__int16)*BoxesCount, FILE_CURRENT); // skip some GroundZones
 				continue;
 			}
 
@@ -1048,6 +1163,12 @@ BOOL __cdecl LoadSamples(HANDLE hFile) {
 	}
 #endif // FEATURE_GOLD
 	sfxFileName = GetFullPath(sfxFileName);
+#ifdef FEATURE_LOADING_IMPROVED
+	// the indexed sample bank loads only the samples missing after the previous level
+	if( SampleBankLoad(sfxFileName, sampleIndexes, sampleCount) ) {
+		goto SAMPLES_LOADED;
+	}
+#endif // FEATURE_LOADING_IMPROVED
 	hSfxFile = CreateFile(sfxFileName, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if( hSfxFile == INVALID_HANDLE_VALUE ) {
 		wsprintf(StringToShow, "Could not open MAIN.SFX file");
@@ -1078,11 +1199,17 @@ BOOL __cdecl LoadSamples(HANDLE hFile) {
 			}
 			game_free(dataSize);
 			++i;
+#ifdef FEATURE_LOADING_IMPROVED
+			SetLoadingProgress(LOAD_Samples, i, sampleCount);
+#endif // FEATURE_LOADING_IMPROVED
 		} else {
 			SetFilePointer(hSfxFile, dataSize, NULL, FILE_CURRENT);
 		}
 	}
 	CloseHandle(hSfxFile);
+#ifdef FEATURE_LOADING_IMPROVED
+SAMPLES_LOADED :
+#endif // FEATURE_LOADING_IMPROVED
 	SoundIsActive = TRUE;
 #if defined(FEATURE_MOD_CONFIG)
 	LoadBareFootSFX(sampleIndexes, sampleCount);
@@ -1150,12 +1277,18 @@ BOOL __cdecl LoadLevel(LPCTSTR fileName, int levelID) {
 	fullPath = GetFullPath(fileName);
 	strcpy(LevelFileName, fullPath);
 	init_game_malloc();
+#ifdef FEATURE_LOADING_IMPROVED
+	WaitLevelPrefetch(fullPath);
+#endif // FEATURE_LOADING_IMPROVED
 
 	hFile = CreateFile(fullPath, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN|FILE_ATTRIBUTE_NORMAL, NULL);
 	if( hFile == INVALID_HANDLE_VALUE ) {
 		wsprintf(StringToShow, "LoadLevel(): Could not open %s (level %d)", fullPath, levelID);
 		return FALSE;
 	}
+#ifdef FEATURE_LOADING_IMPROVED
+	LevelStreamOpen(hFile);
+#endif // FEATURE_LOADING_IMPROVED
 
 	ReadFileSync(hFile, &levelVersion, sizeof(levelVersion), &bytesRead, NULL);
 	if( levelVersion != REQ_LEVEL_VERSION ) {
@@ -1172,12 +1305,12 @@ BOOL __cdecl LoadLevel(LPCTSTR fileName, int levelID) {
 	}
 #endif // (DIRECT3D_VERSION >= 0x900)
 
-	LevelFilePalettesOffset = SetFilePointer(hFile, 0, NULL, FILE_CURRENT);
+	LevelFilePalettesOffset = LevelFileSeek(hFile, 0, FILE_CURRENT);
 	if( !LoadPalettes(hFile) ) {
 		goto EXIT;
 	}
 
-	LevelFileTexPagesOffset = SetFilePointer(hFile, 0, NULL, FILE_CURRENT);
+	LevelFileTexPagesOffset = LevelFileSeek(hFile, 0, FILE_CURRENT);
 	if( !LoadTexturePages(hFile) ) {
 		goto EXIT;
 	}
@@ -1189,13 +1322,26 @@ BOOL __cdecl LoadLevel(LPCTSTR fileName, int levelID) {
 		!LoadCameras(hFile) ||
 		!LoadSoundEffects(hFile) ||
 		!LoadBoxes(hFile) ||
+#ifdef FEATURE_LOADING_IMPROVED
+		!LoadAnimatedTextures(hFile) )
+	{
+		goto EXIT;
+	}
+
+	// the level data loaded so far is kept for the level reload
+	SaveLevelSnapshot(fullPath, LevelFileSeek(hFile, 0, FILE_CURRENT));
+	if( !LoadItems(hFile) ) {
+		goto EXIT;
+	}
+#else // FEATURE_LOADING_IMPROVED
 		!LoadAnimatedTextures(hFile) ||
 		!LoadItems(hFile) )
 	{
 		goto EXIT;
 	}
+#endif // FEATURE_LOADING_IMPROVED
 
-	LevelFileDepthQOffset = SetFilePointer(hFile, 0, NULL, FILE_CURRENT);
+	LevelFileDepthQOffset = LevelFileSeek(hFile, 0, FILE_CURRENT);
 	if( !LoadDepthQ(hFile) ||
 		!LoadCinematic(hFile) ||
 		!LoadDemo(hFile) ||
@@ -1215,16 +1361,94 @@ BOOL __cdecl LoadLevel(LPCTSTR fileName, int levelID) {
 	result = TRUE;
 
 EXIT :
+#ifdef FEATURE_LOADING_IMPROVED
+	if( !result ) {
+		FreeLevelSnapshot();
+	}
+	LevelStreamClose();
+#endif // FEATURE_LOADING_IMPROVED
+	CloseHandle(hFile);
+	return result;
+}
+
+#ifdef FEATURE_LOADING_IMPROVED
+/*
+ * Reloads the same level without unloading it. The level data is restored
+ * from the snapshot up to the items, the textures and the mod configuration
+ * are still loaded, so only the items, depth tables, cinematic, demo and
+ * samples are loaded from the file again.
+ */
+// NOTE: this function is absent in the original code
+static BOOL ReloadLevel(LPCTSTR fileName, GF_LEVEL_TYPE levelType) {
+	BOOL result = FALSE;
+	LPCTSTR fullPath;
+	HANDLE hFile;
+	LONG itemsOffset;
+
+	fullPath = GetFullPath(fileName);
+	if( lstrcmpi(LevelFileName, fullPath) ) {
+		return FALSE;
+	}
+	itemsOffset = RestoreLevelSnapshot(fullPath);
+	if( itemsOffset < 0 ) {
+		return FALSE;
+	}
+
+	hFile = CreateFile(fullPath, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN|FILE_ATTRIBUTE_NORMAL, NULL);
+	if( hFile == INVALID_HANDLE_VALUE ) {
+		return FALSE;
+	}
+	LevelStreamOpen(hFile);
+	LoadLevelType = levelType;
+#ifdef FEATURE_RENDER_IMPROVED
+	ResetRoomVertexCache();
+#endif // FEATURE_RENDER_IMPROVED
+	InitialiseHair();
+	S_AdjustTexelCoordinates();
+
+	LevelFileSeek(hFile, itemsOffset, FILE_BEGIN);
+	if( !LoadItems(hFile) ) {
+		goto EXIT;
+	}
+	LevelFileSeek(hFile, LevelFileDepthQOffset, FILE_BEGIN);
+	if( !LoadDepthQ(hFile) ||
+		!LoadCinematic(hFile) ||
+		!LoadDemo(hFile) ||
+		!LoadSamples(hFile) )
+	{
+		goto EXIT;
+	}
+
+	LoadDemoExternal(fullPath);
+#ifdef FEATURE_VIDEOFX_IMPROVED
+	MarkSemitransObjects();
+	MarkSemitransTextureRanges();
+#endif // FEATURE_VIDEOFX_IMPROVED
+	result = TRUE;
+
+EXIT :
+	LevelStreamClose();
 	CloseHandle(hFile);
 	return result;
 }
+#endif // FEATURE_LOADING_IMPROVED
 
 BOOL __cdecl S_LoadLevelFile(LPCTSTR fileName, int levelID, GF_LEVEL_TYPE levelType) {
+#ifdef FEATURE_LOADING_IMPROVED
+	// the same level is restarted or loaded from the saved game
+	if( ReloadLevel(fileName, levelType) ) {
+		return TRUE;
+	}
+#endif // FEATURE_LOADING_IMPROVED
 	S_UnloadLevelFile();
 	LoadLevelType = levelType; // NOTE: this line is not presented in the original game
 #ifdef FEATURE_MOD_CONFIG
 	LoadModConfiguration(fileName);
+#ifdef FEATURE_LOADING_IMPROVED
+	BOOL result = LoadLevelAsync(fileName, levelID);
+#else // FEATURE_LOADING_IMPROVED
 	BOOL result = LoadLevel(fileName, levelID);
+#endif // FEATURE_LOADING_IMPROVED
 #ifdef FEATURE_BACKGROUND_IMPROVED
 	if( LoadingScreensEnabled && GetModLoadingPix() && (levelType == GFL_NORMAL || levelType == GFL_SAVED) ) {
 		RGB888 palette[256];
@@ -1239,11 +1463,18 @@ BOOL __cdecl S_LoadLevelFile(LPCTSTR fileName, int levelID, GF_LEVEL_TYPE levelT
 #endif // FEATURE_BACKGROUND_IMPROVED
 	return result;
 #else // FEATURE_MOD_CONFIG
+#ifdef FEATURE_LOADING_IMPROVED
+	return LoadLevelAsync(fileName, levelID);
+#else // FEATURE_LOADING_IMPROVED
 	return LoadLevel(fileName, levelID);
+#endif // FEATURE_LOADING_IMPROVED
 #endif // FEATURE_MOD_CONFIG
 }
 
 void __cdecl S_UnloadLevelFile() {
+#ifdef FEATURE_LOADING_IMPROVED
+	FreeLevelSnapshot();
+#endif // FEATURE_LOADING_IMPROVED
 	if( SavedAppSettings.RenderMode == RM_Hardware ) {
 		HWR_FreeTexturePages();
 	}
@@ -1271,6 +1502,9 @@ BOOL __cdecl S_ReloadLevelGraphics(BOOL reloadPalettes, BOOL reloadTexPages) {
 		hFile = CreateFile(LevelFileName, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 		if( hFile == INVALID_HANDLE_VALUE )
 			return FALSE;
+#ifdef FEATURE_LOADING_IMPROVED
+		LevelStreamOpen(hFile);
+#endif // FEATURE_LOADING_IMPROVED
 
 #if (DIRECT3D_VERSION >= 0x900)
 		if( SavedAppSettings.RenderMode == RM_Hardware ) {
@@ -1279,21 +1513,24 @@ BOOL __cdecl S_ReloadLevelGraphics(BOOL reloadPalettes, BOOL reloadTexPages) {
 #endif // (DIRECT3D_VERSION >= 0x900)
 
 		if( reloadPalettes && SavedAppSettings.RenderMode == RM_Software ) {
-			SetFilePointer(hFile, LevelFilePalettesOffset, NULL, FILE_BEGIN);
+			LevelFileSeek(hFile, LevelFilePalettesOffset, FILE_BEGIN);
 			LoadPalettes(hFile);
-			SetFilePointer(hFile, LevelFileDepthQOffset, NULL, FILE_BEGIN);
+			LevelFileSeek(hFile, LevelFileDepthQOffset, FILE_BEGIN);
 			LoadDepthQ(hFile);
 		}
 
 		if( reloadTexPages ) {
 			if( SavedAppSettings.RenderMode == RM_Hardware )
 				HWR_FreeTexturePages();
-			SetFilePointer(hFile, LevelFileTexPagesOffset, NULL, FILE_BEGIN);
+			LevelFileSeek(hFile, LevelFileTexPagesOffset, FILE_BEGIN);
 			LoadTexturePages(hFile);
 #ifdef FEATURE_BACKGROUND_IMPROVED
 			PatternTexPage = CreateBgndPatternTexture(hFile);
 #endif // FEATURE_BACKGROUND_IMPROVED
 		}
+#ifdef FEATURE_LOADING_IMPROVED
+		LevelStreamClose();
+#endif // FEATURE_LOADING_IMPROVED
 		CloseHandle(hFile);
 	}
 
@@ -24,6 +24,7 @@
 #include "game/camera.h"
 #include "game/control.h"
 #include "game/draw.h"
+#include "game/gameflow.h"
 #include "game/inventory.h"
 #include "game/invtext.h"
 #include "game/savegame.h"
@@ -41,15 +42,27 @@
 #include "specific/texture.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_PROFILER
+#include "modding/profiler.h"
+#endif // FEATURE_PROFILER
+
 #ifdef FEATURE_BACKGROUND_IMPROVED
 #include "modding/background_new.h"
 extern DWORD StatsBackgroundMode;
 #endif // FEATURE_BACKGROUND_IMPROVED
 
+#ifdef FEATURE_DEMO_IMPROVED
+#include "modding/demo_stream.h"
+#endif // FEATURE_DEMO_IMPROVED
+
 #ifdef FEATURE_INPUT_IMPROVED
 #include "modding/joy_output.h"
 #endif // FEATURE_INPUT_IMPROVED
 
+#ifdef FEATURE_LOADING_IMPROVED
+#include "modding/level_prefetch.h"
+#endif // FEATURE_LOADING_IMPROVED
+
 #ifdef FEATURE_GOLD
 extern bool IsGold();
 #endif // FEATURE_GOLD
@@ -103,7 +116,23 @@ __int16 __cdecl StartGame(int levelID, GF_LEVEL_TYPE levelType) {
 	ResetGoldenLaraAlpha();
 #endif // FEATURE_VIDEOFX_IMPROVED
 
+#ifdef FEATURE_DEMO_IMPROVED
+	if( levelType == GFL_NORMAL ) {
+		DemoStreamRecordStart(levelID);
+	}
+#endif // FEATURE_DEMO_IMPROVED
+#ifdef FEATURE_LOADING_IMPROVED
+	// the next level file is read in background while this level is played
+	if( levelType == GFL_NORMAL || levelType == GFL_SAVED ) {
+		int nextLevel = ( levelID > 0 ) ? GF_GetNextLevel(levelID) : -1;
+		PrefetchLevelFile(( nextLevel > 0 ) ? GF_LevelFilesStringTable[nextLevel] : NULL);
+	}
+#endif // FEATURE_LOADING_IMPROVED
+
 	int res = GameLoop(FALSE);
+#ifdef FEATURE_DEMO_IMPROVED
+	DemoStreamRecordStop();
+#endif // FEATURE_DEMO_IMPROVED
 #ifdef FEATURE_INPUT_IMPROVED
 	JoyOutputReset();
 #endif // FEATURE_INPUT_IMPROVED
@@ -169,7 +198,14 @@ int __cdecl GameLoop(BOOL demoMode) {
 
 	result = ControlPhase(1, demoMode);
 	while( result == 0 ) {
+#ifdef FEATURE_PROFILER
+		PROFILER_NEXT_FRAME();
+		PROFILER_BEGIN(PROF_DrawPhase);
+#endif // FEATURE_PROFILER
 		nTicks = DrawPhaseGame();
+#ifdef FEATURE_PROFILER
+		PROFILER_END(PROF_DrawPhase);
+#endif // FEATURE_PROFILER
 		result = IsGameToExit ? GF_EXIT_GAME : ControlPhase(nTicks, demoMode);
 	}
 
@@ -25,10 +25,80 @@
 #include "specific/texture.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_PROFILER
+#include "modding/profiler.h"
+#endif // FEATURE_PROFILER
+
 #ifdef FEATURE_HUD_IMPROVED
 #include "modding/psx_bar.h"
 #endif // FEATURE_HUD_IMPROVED
 
+#ifdef FEATURE_PROFILER
+// draw calls and render state changes done by the poly list output
+static DWORD DrawCallCount = 0;
+static DWORD StateChangeCount = 0;
+#endif // FEATURE_PROFILER
+
+#ifdef FEATURE_RENDER_IMPROVED
+#define HWR_BLEND_NONE		(-1)
+#define HWR_BLEND_TRANS		(4) // semitransparent color, after PSX blend modes
+
+bool HwrBatchingEnabled = true;
+
+#define HWR_BATCH_VERTICES	(1024)
+#define HWR_BATCH_INDICES	(HWR_BATCH_VERTICES * 3)
+
+/*
+ * Consecutive triangle fans with the same texture, color key and blend mode
+ * are collected here as an indexed triangle list. Only adjacent surfaces of
+ * the sorted list are merged, and the triangles keep their order, so the
+ * semitransparent surfaces are blended in the same order as before.
+ */
+typedef struct {
+	HWR_TEXHANDLE texSource;
+	bool colorKey;
+	int blendMode;
+	DWORD vtxCount;
+	DWORD idxCount;
+	D3DTLVERTEX vertices[HWR_BATCH_VERTICES];
+	WORD indices[HWR_BATCH_INDICES];
+} HWR_BATCH;
+
+static HWR_BATCH Batch;
+
+bool HwrFrontToBackEnabled = true;
+
+/*
+ * Opaque polygons of the Z-buffered mode are not drawn immediately, but
+ * queued and drawn front-to-back, so the most of hidden pixels are rejected
+ * by the depth test before texturing.
+ */
+typedef struct {
+	float depth;
+	DWORD index; // queue order, it makes the sort stable
+	HWR_TEXHANDLE texSource;
+	DWORD vtxIndex;
+	DWORD vtxCount;
+} OPAQUE_POLY;
+
+static OPAQUE_POLY *OpaquePolys = NULL;
+static DWORD OpaquePolysCount = 0;
+static DWORD OpaquePolysSize = 0;
+static D3DTLVERTEX *OpaqueVertices = NULL;
+static DWORD OpaqueVerticesCount = 0;
+static DWORD OpaqueVerticesSize = 0;
+static bool IsOpaqueFlushing = false;
+
+static void FlushOpaquePolys();
+#endif // FEATURE_RENDER_IMPROVED
+
+#if defined(FEATURE_PROFILER) && (DIRECT3D_VERSION >= 0x900)
+// counts pixels passed the depth test during the scene
+static LPDIRECT3DQUERY9 OverdrawQuery = NULL;
+static bool IsOverdrawQueryBegun = false;
+static bool IsOverdrawQueryIssued = false;
+#endif // defined(FEATURE_PROFILER) && (DIRECT3D_VERSION >= 0x900)
+
 #ifdef FEATURE_VIDEOFX_IMPROVED
 DWORD AlphaBlendMode = 2;
 
@@ -57,6 +127,9 @@ static void SetBlendMode(D3DTLVERTEX *vtxPtr, DWORD vtxCount, DWORD mode) {
 	D3DDev->SetRenderState(D3DRENDERSTATE_SRCBLEND, Blend[mode].src);
 	D3DDev->SetRenderState(D3DRENDERSTATE_DESTBLEND, Blend[mode].dst);
 #endif // (DIRECT3D_VERSION >= 0x900)
+#ifdef FEATURE_PROFILER
+	StateChangeCount += 2;
+#endif // FEATURE_PROFILER
 }
 
 static void DrawAlphaBlended(D3DTLVERTEX *vtxPtr, DWORD vtxCount, DWORD mode) {
@@ -76,9 +149,16 @@ static void DrawAlphaBlended(D3DTLVERTEX *vtxPtr, DWORD vtxCount, DWORD mode) {
 	D3DDev->SetRenderState(D3DRENDERSTATE_SRCBLEND, D3DBLEND_SRCALPHA);
 	D3DDev->SetRenderState(D3DRENDERSTATE_DESTBLEND, D3DBLEND_INVSRCALPHA);
 #endif // (DIRECT3D_VERSION >= 0x900)
+#ifdef FEATURE_PROFILER
+	StateChangeCount += 2;
+#endif // FEATURE_PROFILER
 }
 #endif // FEATURE_VIDEOFX_IMPROVED
 
+#if defined(FEATURE_RENDER_IMPROVED) && (DIRECT3D_VERSION >= 0x900)
+static bool IsStreamSourceLost = false;
+#endif // defined(FEATURE_RENDER_IMPROVED) && (DIRECT3D_VERSION >= 0x900)
+
 // NOTE: this function is absent in the original code
 HRESULT HWR_DrawPrimitive(D3DPRIMITIVETYPE primitiveType, LPVOID vertices, DWORD vertexCount, bool isNoClip) {
 #if (DIRECT3D_VERSION >= 0x900)
@@ -96,6 +176,14 @@ HRESULT HWR_DrawPrimitive(D3DPRIMITIVETYPE primitiveType, LPVOID vertices, DWORD
 	if( primitiveCount <= 0 ) {
 		return D3DERR_INVALIDCALL;
 	}
+#ifdef FEATURE_RENDER_IMPROVED
+	// queued opaque polygons were submitted before, so they must be drawn before
+	FlushOpaquePolys();
+	if( IsStreamSourceLost ) {
+		D3DDev->SetStreamSource(0, D3DVtx, 0, sizeof(D3DTLVERTEX));
+		IsStreamSourceLost = false;
+	}
+#endif // FEATURE_RENDER_IMPROVED
 	static DWORD vertexIndex = 0;
 	DWORD flags = D3DLOCK_NOOVERWRITE;
 	if( vertexIndex + vertexCount > VTXBUF_LEN ) {
@@ -109,12 +197,47 @@ HRESULT HWR_DrawPrimitive(D3DPRIMITIVETYPE primitiveType, LPVOID vertices, DWORD
 	D3DVtx->Unlock();
 	res = D3DDev->DrawPrimitive(primitiveType, vertexIndex, primitiveCount);
 	vertexIndex += vertexCount;
+#ifdef FEATURE_PROFILER
+	++DrawCallCount;
+#endif // FEATURE_PROFILER
 	return res;
 #else // (DIRECT3D_VERSION >= 0x900)
+#ifdef FEATURE_RENDER_IMPROVED
+	FlushOpaquePolys();
+#endif // FEATURE_RENDER_IMPROVED
+#ifdef FEATURE_PROFILER
+	++DrawCallCount;
+#endif // FEATURE_PROFILER
 	return D3DDev->DrawPrimitive(primitiveType, D3DVT_TLVERTEX, vertices, vertexCount, isNoClip ? D3DDP_DONOTUPDATEEXTENTS|D3DDP_DONOTCLIP : 0);
 #endif // (DIRECT3D_VERSION >= 0x900)
 }
 
+#ifdef FEATURE_RENDER_IMPROVED
+// NOTE: this function is absent in the original code
+HRESULT HWR_DrawIndexedPrimitive(D3DPRIMITIVETYPE primitiveType, LPVOID vertices, DWORD vertexCount, LPWORD indices, DWORD indexCount, bool isNoClip) {
+	FlushOpaquePolys();
+#ifdef FEATURE_PROFILER
+	++DrawCallCount;
+#endif // FEATURE_PROFILER
+#if (DIRECT3D_VERSION >= 0x900)
+	int primitiveCount = 0;
+	switch( primitiveType ) {
+		case D3DPT_LINELIST:		primitiveCount = indexCount/2; break;
+		case D3DPT_TRIANGLELIST:	primitiveCount = indexCount/3; break;
+		default: break;
+	}
+	if( primitiveCount <= 0 ) {
+		return D3DERR_INVALIDCALL;
+	}
+	// DrawIndexedPrimitiveUP resets the stream source, HWR_DrawPrimitive sets it back
+	IsStreamSourceLost = true;
+	return D3DDev->DrawIndexedPrimitiveUP(primitiveType, 0, vertexCount, primitiveCount, indices, D3DFMT_INDEX16, vertices, sizeof(D3DTLVERTEX));
+#else // (DIRECT3D_VERSION >= 0x900)
+	return D3DDev->DrawIndexedPrimitive(primitiveType, D3DVT_TLVERTEX, vertices, vertexCount, indices, indexCount, isNoClip ? D3DDP_DONOTUPDATEEXTENTS|D3DDP_DONOTCLIP : 0);
+#endif // (DIRECT3D_VERSION >= 0x900)
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl HWR_InitState() {
 #if (DIRECT3D_VERSION >= 0x900)
 	D3DDev->SetRenderState(D3DRS_CLIPPING, FALSE);
@@ -213,6 +336,9 @@ void __cdecl HWR_TexSource(HWR_TEXHANDLE texSource) {
 		D3DDev->SetRenderState(D3DRENDERSTATE_TEXTUREHANDLE, texSource);
 #endif // (DIRECT3D_VERSION >= 0x900)
 		CurrentTexSource = texSource;
+#ifdef FEATURE_PROFILER
+		++StateChangeCount;
+#endif // FEATURE_PROFILER
 	}
 }
 
@@ -224,6 +350,9 @@ void __cdecl HWR_EnableColorKey(bool state) {
 		D3DDev->SetRenderState(TexturesAlphaChannel ? D3DRENDERSTATE_ALPHABLENDENABLE : D3DRENDERSTATE_COLORKEYENABLE, state ? TRUE : FALSE);
 #endif // (DIRECT3D_VERSION >= 0x900)
 		ColorKeyState = state;
+#ifdef FEATURE_PROFILER
+		++StateChangeCount;
+#endif // FEATURE_PROFILER
 	}
 }
 
@@ -238,6 +367,9 @@ void __cdecl HWR_EnableZBuffer(bool ZWriteEnable, bool ZEnable) {
 		D3DDev->SetRenderState(D3DRENDERSTATE_ZWRITEENABLE, ZWriteEnable ? TRUE : FALSE);
 #endif // (DIRECT3D_VERSION >= 0x900)
 		ZWriteEnableState = ZWriteEnable;
+#ifdef FEATURE_PROFILER
+		++StateChangeCount;
+#endif // FEATURE_PROFILER
 	}
 
 	if( ZEnableState != ZEnable ) {
@@ -250,8 +382,50 @@ void __cdecl HWR_EnableZBuffer(bool ZWriteEnable, bool ZEnable) {
 			D3DDev->SetRenderState(D3DRENDERSTATE_ZENABLE, ZEnable ? TRUE : FALSE);
 #endif // (DIRECT3D_VERSION >= 0x900)
 		ZEnableState = ZEnable;
+#ifdef FEATURE_PROFILER
+		++StateChangeCount;
+#endif // FEATURE_PROFILER
+	}
+}
+
+#if defined(FEATURE_PROFILER) && (DIRECT3D_VERSION >= 0x900)
+void HWR_ReleaseOverdrawQuery() {
+	if( OverdrawQuery != NULL ) {
+		OverdrawQuery->Release();
+		OverdrawQuery = NULL;
+	}
+	IsOverdrawQueryBegun = false;
+	IsOverdrawQueryIssued = false;
+}
+
+static void BeginOverdrawQuery() {
+	DWORD pixels = 0;
+	if( IsOverdrawQueryIssued ) {
+		// the result of the previous scene is taken only if it's ready, the late one is dropped
+		if( OverdrawQuery->GetData(&pixels, sizeof(pixels), 0) == S_OK ) {
+			ProfilerOverdraw(pixels, PhdWinWidth * PhdWinHeight);
+		}
+		IsOverdrawQueryIssued = false;
+	}
+	if( !IsProfilerEnabled() ) {
+		return;
+	}
+	if( OverdrawQuery == NULL && FAILED(D3DDev->CreateQuery(D3DQUERYTYPE_OCCLUSION, &OverdrawQuery)) ) {
+		OverdrawQuery = NULL;
+		return;
+	}
+	OverdrawQuery->Issue(D3DISSUE_BEGIN);
+	IsOverdrawQueryBegun = true;
+}
+
+static void EndOverdrawQuery() {
+	if( IsOverdrawQueryBegun ) {
+		OverdrawQuery->Issue(D3DISSUE_END);
+		IsOverdrawQueryBegun = false;
+		IsOverdrawQueryIssued = true;
 	}
 }
+#endif // defined(FEATURE_PROFILER) && (DIRECT3D_VERSION >= 0x900)
 
 void __cdecl HWR_BeginScene() {
 	HWR_GetPageHandles();
@@ -259,13 +433,192 @@ void __cdecl HWR_BeginScene() {
 	WaitPrimaryBufferFlip();
 #endif // (DIRECT3D_VERSION < 0x900)
 	D3DDev->BeginScene();
+#ifdef FEATURE_RENDER_IMPROVED
+	OpaquePolysCount = 0;
+	OpaqueVerticesCount = 0;
+#endif // FEATURE_RENDER_IMPROVED
+#if defined(FEATURE_PROFILER) && (DIRECT3D_VERSION >= 0x900)
+	BeginOverdrawQuery();
+#endif // defined(FEATURE_PROFILER) && (DIRECT3D_VERSION >= 0x900)
 }
 
+#ifdef FEATURE_RENDER_IMPROVED
+static void DrawFanImmediate(HWR_TEXHANDLE texSource, bool colorKey, int blendMode, D3DTLVERTEX *vtxPtr, DWORD vtxCount) {
+	DWORD alphaState;
+
+	HWR_TexSource(texSource);
+	if( blendMode == HWR_BLEND_TRANS ) {
+		D3DDev->GetRenderState(AlphaBlendEnabler, &alphaState);
+		D3DDev->SetRenderState(AlphaBlendEnabler, TRUE);
+		HWR_DrawPrimitive(D3DPT_TRIANGLEFAN, vtxPtr, vtxCount, true);
+		D3DDev->SetRenderState(AlphaBlendEnabler, alphaState);
+#ifdef FEATURE_PROFILER
+		StateChangeCount += 2;
+#endif // FEATURE_PROFILER
+		return;
+	}
+	HWR_EnableColorKey(colorKey);
+#ifdef FEATURE_VIDEOFX_IMPROVED
+	if( blendMode != HWR_BLEND_NONE ) {
+		DrawAlphaBlended(vtxPtr, vtxCount, blendMode);
+		return;
+	}
+#endif // FEATURE_VIDEOFX_IMPROVED
+	HWR_DrawPrimitive(D3DPT_TRIANGLEFAN, vtxPtr, vtxCount, true);
+}
+
+static void DrawBatch() {
+	HWR_DrawIndexedPrimitive(D3DPT_TRIANGLELIST, Batch.vertices, Batch.vtxCount, Batch.indices, Batch.idxCount, true);
+}
+
+static void FlushBatch() {
+	DWORD alphaState;
+	if( Batch.idxCount == 0 ) return;
+
+	HWR_TexSource(Batch.texSource);
+	if( Batch.blendMode == HWR_BLEND_TRANS ) {
+		D3DDev->GetRenderState(AlphaBlendEnabler, &alphaState);
+		D3DDev->SetRenderState(AlphaBlendEnabler, TRUE);
+		DrawBatch();
+		D3DDev->SetRenderState(AlphaBlendEnabler, alphaState);
+#ifdef FEATURE_PROFILER
+		StateChangeCount += 2;
+#endif // FEATURE_PROFILER
+	} else {
+		HWR_EnableColorKey(Batch.colorKey);
+		DrawBatch();
+	}
+	Batch.vtxCount = 0;
+	Batch.idxCount = 0;
+}
+
+static void DrawFan(HWR_TEXHANDLE texSource, bool colorKey, int blendMode, D3DTLVERTEX *vtxPtr, DWORD vtxCount) {
+	// semitransparent fans may take two passes each, and overlapping fans must be blended
+	// one by one, so only the opaque and the plain alpha blended fans are batched
+	if( HwrBatchingEnabled && vtxCount >= 3 && vtxCount <= HWR_BATCH_VERTICES
+		&& (blendMode == HWR_BLEND_NONE || blendMode == HWR_BLEND_TRANS) )
+	{
+		if( Batch.idxCount > 0 && (Batch.texSource != texSource || Batch.colorKey != colorKey
+			|| Batch.blendMode != blendMode || Batch.vtxCount + vtxCount > HWR_BATCH_VERTICES) )
+		{
+			FlushBatch();
+		}
+		Batch.texSource = texSource;
+		Batch.colorKey = colorKey;
+		Batch.blendMode = blendMode;
+		memcpy(&Batch.vertices[Batch.vtxCount], vtxPtr, sizeof(D3DTLVERTEX) * vtxCount);
+		// the fan is split into triangles sharing its first vertex
+		WORD *idx = &Batch.indices[Batch.idxCount];
+		for( DWORD i = 2; i < vtxCount; ++i ) {
+			*(idx++) = Batch.vtxCount;
+			*(idx++) = Batch.vtxCount + i - 1;
+			*(idx++) = Batch.vtxCount + i;
+		}
+		Batch.vtxCount += vtxCount;
+		Batch.idxCount += (vtxCount - 2) * 3;
+		return;
+	}
+	FlushBatch();
+	DrawFanImmediate(texSource, colorKey, blendMode, vtxPtr, vtxCount);
+}
+
+static int CompareOpaquePolys(const void *a, const void *b) {
+	const OPAQUE_POLY *pa = (const OPAQUE_POLY *)a;
+	const OPAQUE_POLY *pb = (const OPAQUE_POLY *)b;
+	if( pa->depth != pb->depth ) {
+		return ( pa->depth > pb->depth ) ? 1 : -1;
+	}
+	return ( pa->index > pb->index ) - ( pa->index < pb->index );
+}
+
+static bool QueueOpaquePoly(HWR_TEXHANDLE texSource, D3DTLVERTEX *vertices, DWORD vtxCount) {
+	if( OpaquePolysCount >= OpaquePolysSize ) {
+		DWORD size = OpaquePolysSize ? OpaquePolysSize * 2 : 0x1000;
+		OPAQUE_POLY *polys = (OPAQUE_POLY *)realloc(OpaquePolys, sizeof(OPAQUE_POLY) * size);
+		if( polys == NULL ) return false;
+		OpaquePolys = polys;
+		OpaquePolysSize = size;
+	}
+	if( OpaqueVerticesCount + vtxCount > OpaqueVerticesSize ) {
+		DWORD size = OpaqueVerticesSize ? OpaqueVerticesSize * 2 : 0x4000;
+		while( OpaqueVerticesCount + vtxCount > size ) size *= 2;
+		D3DTLVERTEX *vtx = (D3DTLVERTEX *)realloc(OpaqueVertices, sizeof(D3DTLVERTEX) * size);
+		if( vtx == NULL ) return false;
+		OpaqueVertices = vtx;
+		OpaqueVerticesSize = size;
+	}
+
+	OPAQUE_POLY *poly = &OpaquePolys[OpaquePolysCount];
+	poly->depth = 0.0;
+	for( DWORD i = 0; i < vtxCount; ++i ) {
+		poly->depth += vertices[i].sz;
+	}
+	poly->depth /= (float)vtxCount;
+	poly->index = OpaquePolysCount++;
+	poly->texSource = texSource;
+	poly->vtxIndex = OpaqueVerticesCount;
+	poly->vtxCount = vtxCount;
+	memcpy(&OpaqueVertices[OpaqueVerticesCount], vertices, sizeof(D3DTLVERTEX) * vtxCount);
+	OpaqueVerticesCount += vtxCount;
+	return true;
+}
+
+static void FlushOpaquePolys() {
+	if( OpaquePolysCount == 0 || IsOpaqueFlushing ) return;
+	IsOpaqueFlushing = true;
+
+	// the caller may have set its own states for the primitive it's drawing
+	HWR_TEXHANDLE texSource = CurrentTexSource;
+	bool colorKey = ColorKeyState;
+	bool zWrite = ZWriteEnableState;
+	bool zEnable = ZEnableState;
+	// the smaller depth buffer value is the nearer one
+	qsort(OpaquePolys, OpaquePolysCount, sizeof(OPAQUE_POLY), CompareOpaquePolys);
+	HWR_EnableZBuffer(true, true);
+	for( DWORD i = 0; i < OpaquePolysCount; ++i ) {
+		OPAQUE_POLY *poly = &OpaquePolys[i];
+		DrawFan(poly->texSource, false, HWR_BLEND_NONE, &OpaqueVertices[poly->vtxIndex], poly->vtxCount);
+	}
+	FlushBatch();
+	HWR_EnableZBuffer(zWrite, zEnable);
+	HWR_TexSource(texSource);
+	HWR_EnableColorKey(colorKey);
+
+	OpaquePolysCount = 0;
+	OpaqueVerticesCount = 0;
+	IsOpaqueFlushing = false;
+}
+
+// NOTE: this function is absent in the original code
+void HWR_DrawTexturedPoly(HWR_TEXHANDLE texSource, bool colorKey, D3DTLVERTEX *vertices, DWORD vtxCount) {
+	// only opaque polygons written to the depth buffer may be drawn out of order
+	if( HwrFrontToBackEnabled && SavedAppSettings.ZBuffer && !colorKey && ZEnableState && ZWriteEnableState
+		&& QueueOpaquePoly(texSource, vertices, vtxCount) )
+	{
+		return;
+	}
+	HWR_TexSource(texSource);
+	HWR_EnableColorKey(colorKey);
+	HWR_DrawPrimitive(D3DPT_TRIANGLEFAN, vertices, vtxCount, true);
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl HWR_DrawPolyList() {
+#ifndef FEATURE_RENDER_IMPROVED
 	DWORD alphaState;
+#endif // !FEATURE_RENDER_IMPROVED
 	UINT16 *bufPtr;
 	UINT16 polyType, texPage, vtxCount;
 	D3DTLVERTEX *vtxPtr;
+#ifdef FEATURE_PROFILER
+	PROFILER_SCOPE(PROF_HwrDrawPolyList);
+
+	DrawCallCount = 0;
+	StateChangeCount = 0;
+#endif // FEATURE_PROFILER
+#ifdef FEATURE_RENDER_IMPROVED
+	FlushOpaquePolys();
+#endif // FEATURE_RENDER_IMPROVED
 
 	HWR_EnableZBuffer(false, true);
 	for( DWORD i=0; i<SurfaceCount; ++i ) {
@@ -281,6 +634,9 @@ void __cdecl HWR_DrawPolyList() {
 			UINT16 bar = *(bufPtr++);
 			UINT16 pixel = *(bufPtr++);
 			UINT16 alpha = *(bufPtr++);
+#ifdef FEATURE_RENDER_IMPROVED
+			FlushBatch();
+#endif // FEATURE_RENDER_IMPROVED
 			if( polyType == POLY_HWR_healthbar ) {
 				PSX_DrawHealthBar(x0, y0, x1, y1, bar, pixel, alpha);
 			} else {
@@ -317,6 +673,12 @@ void __cdecl HWR_DrawPolyList() {
 			case POLY_HWR_WGTmapAdd: // triangle fan (texture + colorkey + PSX additive blend)
 			case POLY_HWR_WGTmapSub: // triangle fan (texture + colorkey + PSX subtractive blend)
 			case POLY_HWR_WGTmapQrt: // triangle fan (texture + colorkey + PSX quarter blend)
+#ifdef FEATURE_RENDER_IMPROVED
+				DrawFan(texPage == (UINT16)~0 ? GetEnvmapTextureHandle() : HWR_PageHandles[texPage],
+						polyType != POLY_HWR_GTmap,
+						( TextureFormat.bpp < 16 || AlphaBlendMode == 0 || polyType == POLY_HWR_GTmap || polyType == POLY_HWR_WGTmap ) ? HWR_BLEND_NONE : polyType-POLY_HWR_WGTmapHalf,
+						vtxPtr, vtxCount);
+#else // FEATURE_RENDER_IMPROVED
 				HWR_TexSource(texPage == (UINT16)~0 ? GetEnvmapTextureHandle() : HWR_PageHandles[texPage]);
 				HWR_EnableColorKey(polyType != POLY_HWR_GTmap);
 				if( TextureFormat.bpp < 16 || AlphaBlendMode == 0 || polyType == POLY_HWR_GTmap || polyType == POLY_HWR_WGTmap ) {
@@ -324,10 +686,15 @@ void __cdecl HWR_DrawPolyList() {
 				} else {
 					DrawAlphaBlended(vtxPtr, vtxCount, polyType-POLY_HWR_WGTmapHalf);
 				}
+#endif // FEATURE_RENDER_IMPROVED
 #else // !FEATURE_VIDEOFX_IMPROVED
+#ifdef FEATURE_RENDER_IMPROVED
+				DrawFan(HWR_PageHandles[texPage], polyType == POLY_HWR_WGTmap, HWR_BLEND_NONE, vtxPtr, vtxCount);
+#else // FEATURE_RENDER_IMPROVED
 				HWR_TexSource(HWR_PageHandles[texPage]);
 				HWR_EnableColorKey(polyType == POLY_HWR_WGTmap);
 				HWR_DrawPrimitive(D3DPT_TRIANGLEFAN, vtxPtr, vtxCount, true);
+#endif // FEATURE_RENDER_IMPROVED
 #endif // !FEATURE_VIDEOFX_IMPROVED
 				break;
 
@@ -337,6 +704,11 @@ void __cdecl HWR_DrawPolyList() {
 			case POLY_HWR_add: // triangle fan (color + PSX additive blend)
 			case POLY_HWR_sub: // triangle fan (color + PSX subtractive blend)
 			case POLY_HWR_qrt: // triangle fan (color + PSX quarter blend)
+#ifdef FEATURE_RENDER_IMPROVED
+				DrawFan(0, polyType != POLY_HWR_gouraud,
+						( TextureFormat.bpp < 16 || AlphaBlendMode == 0 || polyType == POLY_HWR_gouraud ) ? HWR_BLEND_NONE : polyType-POLY_HWR_half,
+						vtxPtr, vtxCount);
+#else // FEATURE_RENDER_IMPROVED
 				HWR_TexSource(0);
 				HWR_EnableColorKey(polyType != POLY_HWR_gouraud);
 				if( TextureFormat.bpp < 16 || AlphaBlendMode == 0 || polyType == POLY_HWR_gouraud ) {
@@ -344,29 +716,179 @@ void __cdecl HWR_DrawPolyList() {
 				} else {
 					DrawAlphaBlended(vtxPtr, vtxCount, polyType-POLY_HWR_half);
 				}
+#endif // FEATURE_RENDER_IMPROVED
 #else // !FEATURE_VIDEOFX_IMPROVED
+#ifdef FEATURE_RENDER_IMPROVED
+				DrawFan(0, false, HWR_BLEND_NONE, vtxPtr, vtxCount);
+#else // FEATURE_RENDER_IMPROVED
 				HWR_TexSource(0);
 				HWR_EnableColorKey(false);
 				HWR_DrawPrimitive(D3DPT_TRIANGLEFAN, vtxPtr, vtxCount, true);
+#endif // FEATURE_RENDER_IMPROVED
 #endif // !FEATURE_VIDEOFX_IMPROVED
 				break;
 
 			case POLY_HWR_line: // line strip (color)
+#ifdef FEATURE_RENDER_IMPROVED
+				FlushBatch();
+#endif // FEATURE_RENDER_IMPROVED
 				HWR_TexSource(0);
 				HWR_EnableColorKey(false);
 				HWR_DrawPrimitive(D3DPT_LINESTRIP, vtxPtr, vtxCount, true);
 				break;
 
 			case POLY_HWR_trans: // triangle fan (color + semitransparent)
+#ifdef FEATURE_RENDER_IMPROVED
+				DrawFan(0, false, HWR_BLEND_TRANS, vtxPtr, vtxCount);
+#else // FEATURE_RENDER_IMPROVED
 				HWR_TexSource(0);
 				D3DDev->GetRenderState(AlphaBlendEnabler, &alphaState);
 				D3DDev->SetRenderState(AlphaBlendEnabler, TRUE);
 				HWR_DrawPrimitive(D3DPT_TRIANGLEFAN, vtxPtr, vtxCount, true);
 				D3DDev->SetRenderState(AlphaBlendEnabler, alphaState);
+#endif // FEATURE_RENDER_IMPROVED
 				break;
 		}
 	}
+#ifdef FEATURE_RENDER_IMPROVED
+	FlushBatch();
+#endif // FEATURE_RENDER_IMPROVED
+#ifdef FEATURE_PROFILER
+	ProfilerDrawCalls(DrawCallCount, StateChangeCount);
+#if (DIRECT3D_VERSION >= 0x900)
+	EndOverdrawQuery();
+#endif // (DIRECT3D_VERSION >= 0x900)
+#endif // FEATURE_PROFILER
+}
+
+#ifdef FEATURE_RENDER_IMPROVED
+bool HwrTextureAtlasEnabled = true;
+
+#define HWR_ATLAS_MAX_SIDE	(2048)
+#define HWR_ATLAS_PADDING	(8)
+#define HWR_ATLAS_CELL		(256 + HWR_ATLAS_PADDING * 2)
+#define HWR_ATLAS_RESERVED	(2) // page slots for the background pattern and button sprites
+
+typedef struct {
+	int slot; // HWR page slot of the atlas, or -1 if the page is not packed
+	int x;
+	int y;
+} ATLAS_CELL;
+
+static ATLAS_CELL AtlasCells[ARRAY_SIZE(HWR_TexturePageIndexes)];
+static int AtlasSide = 0;
+static int AtlasCount = 0;
+
+static void ResetTextureAtlases() {
+	for( DWORD i=0; i<ARRAY_SIZE(AtlasCells); ++i ) {
+		AtlasCells[i].slot = -1;
+	}
+	AtlasSide = 0;
+	AtlasCount = 0;
+}
+
+// Edge texels of the page are repeated into the padding, so the filtering does not bleed from neighbours
+static void FillAtlasPadding(BYTE *atlas, int side, int x, int y, int bytesPerPixel) {
+	int pitch = side * bytesPerPixel;
+	BYTE *row = atlas + y * pitch + x * bytesPerPixel;
+	for( int i = 0; i < 256; ++i, row += pitch ) {
+		BYTE *left = row;
+		BYTE *right = row + 255 * bytesPerPixel;
+		for( int j = 1; j <= HWR_ATLAS_PADDING; ++j ) {
+			memcpy(left - j * bytesPerPixel, left, bytesPerPixel);
+			memcpy(right + j * bytesPerPixel, right, bytesPerPixel);
+		}
+	}
+	BYTE *top = atlas + y * pitch + (x - HWR_ATLAS_PADDING) * bytesPerPixel;
+	BYTE *bottom = top + 255 * pitch;
+	for( int j = 1; j <= HWR_ATLAS_PADDING; ++j ) {
+		memcpy(top - j * pitch, top, HWR_ATLAS_CELL * bytesPerPixel);
+		memcpy(bottom + j * pitch, bottom, HWR_ATLAS_CELL * bytesPerPixel);
+	}
+}
+
+/*
+ * Level texture pages are packed into a few large textures, so the most of
+ * the frame is drawn with a single texture bound. Original pages are kept
+ * for the sprites, since sprite offsets cannot address the large textures.
+ * PhdTextureInfo UVs are remapped to the atlases by HWR_AtlasTextureUV().
+ */
+static void LoadTextureAtlases(int pagesCount, LPVOID pagesBuffer, bool isIndexed) {
+	int bytesPerPixel = isIndexed ? 1 : 2;
+	int maxSide = MIN((int)GetMaxTextureSize(), HWR_ATLAS_MAX_SIDE);
+	int side, perRow;
+
+	if( !HwrTextureAtlasEnabled || pagesCount < 2 ) return;
+	for( int i=0; i<pagesCount; ++i ) {
+		if( HWR_TexturePageIndexes[i] < 0 ) return;
+#if (DIRECT3D_VERSION >= 0x900)
+		// HD textures may have any size, so they are not packed
+		if( IsExternalTexture(i) ) return;
+#endif // (DIRECT3D_VERSION >= 0x900)
+	}
+
+	// get the smallest atlas side for all pages, or the largest one if they don't fit
+	for( side = 1024; side < maxSide && SQR(side / HWR_ATLAS_CELL) < pagesCount; side *= 2 );
+	if( side > maxSide ) return;
+	perRow = side / HWR_ATLAS_CELL;
+	int perAtlas = SQR(perRow);
+	int atlasCount = (pagesCount + perAtlas - 1) / perAtlas;
+	if( pagesCount + atlasCount + HWR_ATLAS_RESERVED > (int)ARRAY_SIZE(HWR_TexturePageIndexes) ) return;
+
+	BYTE *atlas = (BYTE *)malloc(SQR(side) * bytesPerPixel);
+	if( atlas == NULL ) return;
+
+	for( int i=0; i<atlasCount; ++i ) {
+		int slot = pagesCount + i;
+		int first = i * perAtlas;
+		int last = MIN(first + perAtlas, pagesCount);
+		memset(atlas, 0, SQR(side) * bytesPerPixel);
+		for( int j=first; j<last; ++j ) {
+			int x = (j - first) % perRow * HWR_ATLAS_CELL + HWR_ATLAS_PADDING;
+			int y = (j - first) / perRow * HWR_ATLAS_CELL + HWR_ATLAS_PADDING;
+			BYTE *src = (BYTE *)pagesBuffer + j * 256*256 * bytesPerPixel;
+			BYTE *dst = atlas + (y * side + x) * bytesPerPixel;
+			for( int k=0; k<256; ++k ) {
+				memcpy(dst, src, 256 * bytesPerPixel);
+				src += 256 * bytesPerPixel;
+				dst += side * bytesPerPixel;
+			}
+			FillAtlasPadding(atlas, side, x, y, bytesPerPixel);
+			AtlasCells[j].slot = slot;
+			AtlasCells[j].x = x;
+			AtlasCells[j].y = y;
+		}
+		int pageIndex = isIndexed ? AddTexturePage8(side, side, atlas, PaletteIndex) : AddTexturePage16(side, side, atlas);
+		if( pageIndex < 0 ) {
+			// the atlas cannot be created, so the pages are used as is
+			for( int j=first; j<last; ++j ) {
+				AtlasCells[j].slot = -1;
+			}
+			break;
+		}
+		HWR_TexturePageIndexes[slot] = pageIndex;
+		AtlasCount = i + 1;
+	}
+	AtlasSide = side;
+	free(atlas);
+}
+
+int HWR_GetAtlasCount() {
+	return AtlasCount;
+}
+
+void HWR_AtlasTextureUV(PHD_TEXTURE *texture) {
+	if( texture->tpage >= ARRAY_SIZE(AtlasCells) ) return;
+	ATLAS_CELL *cell = &AtlasCells[texture->tpage];
+	if( cell->slot < 0 ) return;
+
+	for( int i=0; i<4; ++i ) {
+		texture->uv[i].u = (cell->x * 256 + texture->uv[i].u) * 256 / AtlasSide;
+		texture->uv[i].v = (cell->y * 256 + texture->uv[i].v) * 256 / AtlasSide;
+	}
+	texture->tpage = cell->slot;
 }
+#endif // FEATURE_RENDER_IMPROVED
 
 void __cdecl HWR_LoadTexturePages(int pagesCount, LPVOID pagesBuffer, RGB888 *palette) {
 	int pageIndex = -1;
@@ -403,6 +925,9 @@ void __cdecl HWR_LoadTexturePages(int pagesCount, LPVOID pagesBuffer, RGB888 *pa
 		}
 		HWR_TexturePageIndexes[i] = (pageIndex < 0) ? -1 : pageIndex;
 	}
+#ifdef FEATURE_RENDER_IMPROVED
+	LoadTextureAtlases(pagesCount, pagesBuffer, palette != NULL);
+#endif // FEATURE_RENDER_IMPROVED
 	HWR_GetPageHandles();
 }
 
@@ -418,6 +943,9 @@ void __cdecl HWR_FreeTexturePages() {
 	if( PaletteIndex >= 0 ) {
 		SafeFreePalette(PaletteIndex);
 	}
+#ifdef FEATURE_RENDER_IMPROVED
+	ResetTextureAtlases();
+#endif // FEATURE_RENDER_IMPROVED
 }
 
 void __cdecl HWR_GetPageHandles() {
@@ -430,13 +958,20 @@ void __cdecl HWR_GetPageHandles() {
 }
 
 bool __cdecl HWR_VertexBufferFull() {
+#ifdef FEATURE_RENDER_IMPROVED
+	return false; // the vertex buffer grows in phd_ReservePolyList()
+#else // FEATURE_RENDER_IMPROVED
 	DWORD index = ((DWORD)HWR_VertexPtr - (DWORD)HWR_VertexBuffer) / sizeof(D3DTLVERTEX);
 	return (index >= ARRAY_SIZE(HWR_VertexBuffer) - 0x200);
+#endif // FEATURE_RENDER_IMPROVED
 }
 
 bool __cdecl HWR_Init() {
 	memset(HWR_VertexBuffer, 0, sizeof(HWR_VertexBuffer));
 	memset(HWR_TexturePageIndexes, 0xFF, sizeof(HWR_TexturePageIndexes)); // fill indexes by -1
+#ifdef FEATURE_RENDER_IMPROVED
+	ResetTextureAtlases();
+#endif // FEATURE_RENDER_IMPROVED
 	return true;
 }
 
@@ -29,6 +29,15 @@
  */
 // NOTE: this function is absent in the original code
 HRESULT HWR_DrawPrimitive(D3DPRIMITIVETYPE primitiveType, LPVOID vertices, DWORD vertexCount, bool isNoClip);
+#ifdef FEATURE_RENDER_IMPROVED
+// NOTE: this function is absent in the original code
+HRESULT HWR_DrawIndexedPrimitive(D3DPRIMITIVETYPE primitiveType, LPVOID vertices, DWORD vertexCount, LPWORD indices, DWORD indexCount, bool isNoClip);
+// NOTE: this function is absent in the original code
+void HWR_DrawTexturedPoly(HWR_TEXHANDLE texSource, bool colorKey, D3DTLVERTEX *vertices, DWORD vtxCount);
+#endif // FEATURE_RENDER_IMPROVED
+#if defined(FEATURE_PROFILER) && (DIRECT3D_VERSION >= 0x900)
+void HWR_ReleaseOverdrawQuery();
+#endif // defined(FEATURE_PROFILER) && (DIRECT3D_VERSION >= 0x900)
 
 void __cdecl HWR_InitState(); // 0x0044D0B0
 void __cdecl HWR_ResetTexSource(); // 0x0044D1E0
@@ -45,4 +54,9 @@ void __cdecl HWR_GetPageHandles(); // 0x0044D640
 bool __cdecl HWR_VertexBufferFull(); // 0x0044D680
 bool __cdecl HWR_Init(); // 0x0044D6B0
 
+#ifdef FEATURE_RENDER_IMPROVED
+int HWR_GetAtlasCount();
+void HWR_AtlasTextureUV(PHD_TEXTURE *texture);
+#endif // FEATURE_RENDER_IMPROVED
+
 #endif // HWR_INCLUDED
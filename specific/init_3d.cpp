@@ -21,6 +21,7 @@
 
 #include "global/precompiled.h"
 #include "specific/init_3d.h"
+#include "specific/hwr.h"
 #include "global/vars.h"
 
 #if (DIRECT3D_VERSION >= 0x900)
@@ -142,6 +143,9 @@ void __cdecl D3DDeviceCreate(LPDDS lpBackBuffer) {
 			D3DVtx->Release();
 			D3DVtx = NULL;
 		}
+#ifdef FEATURE_PROFILER
+		HWR_ReleaseOverdrawQuery();
+#endif // FEATURE_PROFILER
 		HRESULT res = D3D_OK;
 		do {
 			res = D3DDev->TestCooperativeLevel();
@@ -199,6 +203,9 @@ void __cdecl Direct3DRelease() {
 		D3DVtx->Release();
 		D3DVtx = NULL;
 	}
+#ifdef FEATURE_PROFILER
+	HWR_ReleaseOverdrawQuery();
+#endif // FEATURE_PROFILER
 #else // (DIRECT3D_VERSION >= 0x900)
 	if( D3DMaterial != NULL ) {
 		D3DMaterial->Release();
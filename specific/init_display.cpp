@@ -39,6 +39,10 @@ extern DWORD BGND_PictureWidth;
 extern DWORD BGND_PictureHeight;
 #endif // FEATURE_BACKGROUND_IMPROVED
 
+#ifdef FEATURE_RENDER_IMPROVED
+#include "3dsystem/3d_out.h"
+#endif // FEATURE_RENDER_IMPROVED
+
 // Related to ERROR_CODE enum
 static LPCTSTR ErrorStringTable[] = {
 	"OK",
@@ -725,6 +729,10 @@ void __cdecl RenderStart(bool isReset) {
 }
 
 void __cdecl RenderFinish(bool needToClearTextures) {
+#ifdef FEATURE_RENDER_IMPROVED
+	// the band threads and edge buffers are created again on the next drawing
+	FreeBandsSWR();
+#endif // FEATURE_RENDER_IMPROVED
 #if (DIRECT3D_VERSION >= 0x900)
 	S_DontDisplayPicture();
 	HWR_FreeTexturePages();
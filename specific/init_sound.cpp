@@ -23,6 +23,28 @@
 #include "specific/init_sound.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_LOADING_IMPROVED
+#include "modding/level_loader.h"
+#include "modding/sample_bank.h"
+
+typedef struct {
+	DWORD sampleIdx;
+	LPWAVEFORMATEX format;
+	LPVOID data;
+	DWORD dataSize;
+} MAKE_SAMPLE_ARGS;
+
+static int __cdecl FreeAllSamplesCall(LPVOID param) {
+	WinSndFreeAllSamples();
+	return TRUE;
+}
+
+static int __cdecl MakeSampleCall(LPVOID param) {
+	MAKE_SAMPLE_ARGS *args = (MAKE_SAMPLE_ARGS *)param;
+	return WinSndMakeSample(args->sampleIdx, args->format, args->data, args->dataSize);
+}
+#endif // FEATURE_LOADING_IMPROVED
+
 extern void __thiscall FlaggedStringCreate(STRING_FLAGGED *item, DWORD dwSize);
 extern void __thiscall FlaggedStringDelete(STRING_FLAGGED *item);
 extern bool FlaggedStringCopy(STRING_FLAGGED *dst, STRING_FLAGGED *src);
@@ -47,6 +69,13 @@ SOUND_ADAPTER_NODE *__cdecl GetSoundAdapter(GUID *lpGuid) {
 void __cdecl WinSndFreeAllSamples() {
 	if( !IsSoundEnabled )
 		return;
+#ifdef FEATURE_LOADING_IMPROVED
+	// DirectSound buffers are released and created by the main thread only
+	if( IsLevelLoaderThread() ) {
+		CallOnMainThread(FreeAllSamplesCall, NULL);
+		return;
+	}
+#endif // FEATURE_LOADING_IMPROVED
 
 	for( DWORD i=0; i<ARRAY_SIZE(SampleBuffers); ++i ) {
 		if( SampleBuffers[i] != NULL ) {
@@ -63,6 +92,12 @@ bool __cdecl WinSndMakeSample(DWORD sampleIdx, LPWAVEFORMATEX format, const LPVO
 
 	if( DSound == NULL || !IsSoundEnabled || sampleIdx >= ARRAY_SIZE(SampleBuffers) )
 		return false;
+#ifdef FEATURE_LOADING_IMPROVED
+	if( IsLevelLoaderThread() ) {
+		MAKE_SAMPLE_ARGS args = {sampleIdx, format, data, dataSize};
+		return CallOnMainThread(MakeSampleCall, &args);
+	}
+#endif // FEATURE_LOADING_IMPROVED
 
 	// NOTE: this check is absent in the original game
 	if( SampleBuffers[sampleIdx] != NULL ) {
@@ -297,6 +332,9 @@ bool __cdecl DSoundBufferTest() {
 
 void __cdecl WinSndFinish() {
 	WinSndFreeAllSamples();
+#ifdef FEATURE_LOADING_IMPROVED
+	SampleBankRelease();
+#endif // FEATURE_LOADING_IMPROVED
 	if( DSound != NULL ) {
 		DSound->Release();
 		DSound = NULL;
@@ -31,6 +31,14 @@
 #include "specific/winvid.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_PROFILER
+#include "modding/profiler.h"
+#endif // FEATURE_PROFILER
+
+#ifdef FEATURE_DEMO_IMPROVED
+#include "modding/demo_stream.h"
+#endif // FEATURE_DEMO_IMPROVED
+
 #ifdef FEATURE_INPUT_IMPROVED
 bool WalkToSidestep = false;
 #endif // FEATURE_INPUT_IMPROVED
@@ -84,6 +92,9 @@ bool __cdecl S_UpdateInput() {
 	static bool isF4KeyPressed = false;
 	static bool isF7KeyPressed = false;
 	static bool isF8KeyPressed = false;
+#ifdef FEATURE_PROFILER
+	static bool isF9KeyPressed = false; // +
+#endif // FEATURE_PROFILER
 	static bool isF11KeyPressed = false;
 	static bool isF12KeyPressed = false; // +
 	static BYTE mediPackCooldown = 0;
@@ -205,7 +216,11 @@ bool __cdecl S_UpdateInput() {
 
 	// NOTE: this check is absent in the original game
 	// it fixes a bug, when the player could interfere with the demo level
+#ifdef FEATURE_DEMO_IMPROVED
+	if( !IsDemoLevelType && !IsDemoStreamActive() ) {
+#else // FEATURE_DEMO_IMPROVED
 	if( !IsDemoLevelType ) {
+#endif // FEATURE_DEMO_IMPROVED
 		// Weapon requests
 		if( KEY_DOWN(DIK_1) && Inv_RequestItem(ID_PISTOL_OPTION) ) {
 			Lara.request_gun_type = LGT_Pistols;
@@ -309,6 +324,23 @@ bool __cdecl S_UpdateInput() {
 	// Shift Key check
 	isShiftKeyPressed = KEY_DOWN(DIK_LSHIFT) || KEY_DOWN(DIK_RSHIFT);
 
+#ifdef FEATURE_PROFILER
+	if( KEY_DOWN(DIK_F9) ) {
+		if( !isF9KeyPressed ) {
+			isF9KeyPressed = true;
+			if( isShiftKeyPressed ) {
+				// Save profiler frames as CSV (Shift + F9)
+				if( ProfilerSaveCSV() ) DisplayModeInfo((char *)"Profiler frames saved");
+			} else {
+				// Profiler overlay (F9)
+				ProfilerToggle();
+			}
+		}
+	} else {
+		isF9KeyPressed = false;
+	}
+#endif // FEATURE_PROFILER
+
 	// Graphics option toggles
 	if( SavedAppSettings.RenderMode == RM_Software ) {
 
@@ -37,6 +37,10 @@
 #include "specific/winvid.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_PROFILER
+#include "modding/profiler.h"
+#endif // FEATURE_PROFILER
+
 #ifdef FEATURE_HUD_IMPROVED
 #include "modding/psx_bar.h"
 
@@ -281,6 +285,10 @@ void __cdecl S_InitialiseScreen(GF_LEVEL_TYPE levelType) {
 
 void __cdecl S_OutputPolyList() {
 	DDSDESC desc;
+#ifdef FEATURE_PROFILER
+	PROFILER_SCOPE(PROF_OutputPolyList);
+	ProfilerRenderQueue();
+#endif // FEATURE_PROFILER
 
 	if( SavedAppSettings.RenderMode == RM_Software ) {
 		// Software renderer
@@ -497,6 +505,163 @@ void __cdecl S_PrintShadow(__int16 radius, __int16 *bPtr, ITEM_INFO *item) {
 	phd_PopMatrix();
 }
 
+#ifdef FEATURE_RENDER_IMPROVED
+// Static room lights never change, so the brightest static light is sampled
+// on level loading at every sector centre on a few heights, and the items
+// interpolate these probes. Rooms with flickering lights are not sampled.
+#define LIGHT_PROBE_HEIGHTS	(4)
+#define LIGHT_PROBE_MAX_ERROR	(0x100) // rooms with worse probes are lit exactly
+
+typedef struct {
+	__int16 shade;
+	__int16 light; // index of the brightest light, or -1
+} LIGHT_PROBE;
+
+typedef struct {
+	LIGHT_INFO *light; // flipped rooms swap their contents, so the lights are checked
+	LIGHT_PROBE *probes;
+} ROOM_LIGHT_PROBES;
+
+bool LightProbesEnabled = false;
+
+static ROOM_LIGHT_PROBES *RoomLightProbes = NULL;
+static int RoomLightProbesCount = 0;
+
+// the same as the static light code of S_CalculateLight for rooms without flickering
+static int GetStaticLightShade(ROOM_INFO *room, int x, int y, int z, int *brightestLight) {
+	int xDist, yDist, zDist, distance, falloff, intensity, shade;
+	int brightest = 0;
+
+	*brightestLight = -1;
+	for( int i = 0; i < room->numLights; ++i ) {
+		xDist = x - room->light[i].x;
+		yDist = y - room->light[i].y;
+		zDist = z - room->light[i].z;
+		falloff = room->light[i].fallOff1;
+		intensity = room->light[i].intensity1;
+
+		falloff = SQR(falloff) >> 12;
+		distance = (SQR(xDist) + SQR(yDist) + SQR(zDist)) >> 12;
+
+		shade = falloff * intensity / (falloff + distance);
+		if( shade > brightest ) {
+			brightest = shade;
+			*brightestLight = i;
+		}
+	}
+	return brightest;
+}
+
+static int GetProbeY(ROOM_INFO *room, int level) {
+	return room->maxCeiling + (room->minFloor - room->maxCeiling) * level / (LIGHT_PROBE_HEIGHTS - 1);
+}
+
+static LIGHT_PROBE *GetLightProbe(ROOM_INFO *room, LIGHT_PROBE *probes, int cx, int cz, int level) {
+	return &probes[(cz + cx * room->xSize) * LIGHT_PROBE_HEIGHTS + level];
+}
+
+static bool InterpolateLightProbes(ROOM_INFO *room, int x, int y, int z, int *brightest, int *brightestLight) {
+	if( !LightProbesEnabled || RoomLightProbes == NULL || room->lightMode != 0 ) return false;
+
+	int roomNumber = room - RoomInfo;
+	if( roomNumber < 0 || roomNumber >= RoomLightProbesCount ) return false;
+	ROOM_LIGHT_PROBES *roomProbes = &RoomLightProbes[roomNumber];
+	if( roomProbes->light != room->light && room->flippedRoom >= 0 && room->flippedRoom < RoomLightProbesCount ) {
+		roomProbes = &RoomLightProbes[room->flippedRoom];
+	}
+	if( roomProbes->probes == NULL || roomProbes->light != room->light ) return false;
+
+	// probes are at the sector centres, so the coordinates are shifted by half of sector
+	double fx = (double)(x - room->x - 0x200) / 0x400;
+	double fz = (double)(z - room->z - 0x200) / 0x400;
+	double fy = (double)(y - room->maxCeiling) * (LIGHT_PROBE_HEIGHTS - 1) / MAX(room->minFloor - room->maxCeiling, 1);
+	CLAMP(fx, 0.0, (double)(room->ySize - 1));
+	CLAMP(fz, 0.0, (double)(room->xSize - 1));
+	CLAMP(fy, 0.0, (double)(LIGHT_PROBE_HEIGHTS - 1));
+
+	int cx0 = (int)fx, cz0 = (int)fz, level0 = (int)fy;
+	int cx1 = MIN(cx0 + 1, room->ySize - 1);
+	int cz1 = MIN(cz0 + 1, room->xSize - 1);
+	int level1 = MIN(level0 + 1, LIGHT_PROBE_HEIGHTS - 1);
+	double tx = fx - cx0, tz = fz - cz0, ty = fy - level0;
+
+	double shade = 0.0;
+	for( int i = 0; i < 8; ++i ) {
+		LIGHT_PROBE *probe = GetLightProbe(room, roomProbes->probes,
+			CHK_ANY(i, 1) ? cx1 : cx0, CHK_ANY(i, 2) ? cz1 : cz0, CHK_ANY(i, 4) ? level1 : level0);
+		double weight = (CHK_ANY(i, 1) ? tx : 1.0 - tx) * (CHK_ANY(i, 2) ? tz : 1.0 - tz) * (CHK_ANY(i, 4) ? ty : 1.0 - ty);
+		shade += probe->shade * weight;
+	}
+	*brightest = (int)(shade + 0.5);
+	// the light direction is taken from the nearest probe
+	*brightestLight = GetLightProbe(room, roomProbes->probes,
+		(tx < 0.5) ? cx0 : cx1, (tz < 0.5) ? cz0 : cz1, (ty < 0.5) ? level0 : level1)->light;
+	if( *brightestLight < 0 ) *brightest = 0;
+	return true;
+}
+
+void FreeRoomLightProbes() {
+	if( RoomLightProbes != NULL ) {
+		for( int i = 0; i < RoomLightProbesCount; ++i ) {
+			free(RoomLightProbes[i].probes);
+		}
+		free(RoomLightProbes);
+		RoomLightProbes = NULL;
+	}
+	RoomLightProbesCount = 0;
+}
+
+void BuildRoomLightProbes() {
+	FreeRoomLightProbes();
+	if( !LightProbesEnabled || RoomCount <= 0 ) return;
+
+	RoomLightProbes = (ROOM_LIGHT_PROBES *)calloc(RoomCount, sizeof(ROOM_LIGHT_PROBES));
+	if( RoomLightProbes == NULL ) return;
+	RoomLightProbesCount = RoomCount;
+
+	for( int i = 0; i < RoomCount; ++i ) {
+		ROOM_INFO *room = &RoomInfo[i];
+		int light;
+		int cellsCount = room->xSize * room->ySize;
+		if( room->lightMode != 0 || room->numLights == 0 || cellsCount <= 0 ) continue;
+
+		LIGHT_PROBE *probes = (LIGHT_PROBE *)malloc(sizeof(LIGHT_PROBE) * cellsCount * LIGHT_PROBE_HEIGHTS);
+		if( probes == NULL ) continue;
+		for( int cx = 0; cx < room->ySize; ++cx ) {
+			for( int cz = 0; cz < room->xSize; ++cz ) {
+				for( int level = 0; level < LIGHT_PROBE_HEIGHTS; ++level ) {
+					LIGHT_PROBE *probe = GetLightProbe(room, probes, cx, cz, level);
+					probe->shade = GetStaticLightShade(room, room->x + cx * 0x400 + 0x200, GetProbeY(room, level), room->z + cz * 0x400 + 0x200, &light);
+					probe->light = light;
+				}
+			}
+		}
+		RoomLightProbes[i].light = room->light;
+		RoomLightProbes[i].probes = probes;
+
+		// compare the probes with the exact lighting between them
+		int maxError = 0;
+		for( int cx = 0; cx < room->ySize - 1; ++cx ) {
+			for( int cz = 0; cz < room->xSize - 1; ++cz ) {
+				for( int level = 0; level < LIGHT_PROBE_HEIGHTS - 1; ++level ) {
+					int x = room->x + cx * 0x400 + 0x400;
+					int y = (GetProbeY(room, level) + GetProbeY(room, level + 1)) / 2;
+					int z = room->z + cz * 0x400 + 0x400;
+					int exact = GetStaticLightShade(room, x, y, z, &light);
+					int interpolated = 0;
+					InterpolateLightProbes(room, x, y, z, &interpolated, &light);
+					maxError = MAX(maxError, ABS(exact - interpolated));
+				}
+			}
+		}
+		if( maxError > LIGHT_PROBE_MAX_ERROR ) {
+			RoomLightProbes[i].probes = NULL;
+			free(probes);
+		}
+	}
+}
+#endif // FEATURE_RENDER_IMPROVED
+
 void __cdecl S_CalculateLight(int x, int y, int z, __int16 roomNumber) {
 	ROOM_INFO *room;
 	int xDist, yDist, zDist, distance, radius, depth;
@@ -512,6 +677,16 @@ void __cdecl S_CalculateLight(int x, int y, int z, __int16 roomNumber) {
 	brightest = 0;
 
 	// Static light calculation
+#ifdef FEATURE_RENDER_IMPROVED
+	int probeLight;
+	if( InterpolateLightProbes(room, x, y, z, &brightest, &probeLight) ) {
+		if( probeLight >= 0 ) {
+			xBrightest = x - room->light[probeLight].x;
+			yBrightest = y - room->light[probeLight].y;
+			zBrightest = z - room->light[probeLight].z;
+		}
+	} else
+#endif // FEATURE_RENDER_IMPROVED
 	if( room->lightMode != 0 ) {
 		lightShade = RoomLightShades[room->lightMode];
 		for( int i = 0; i < room->numLights; ++i ) {
@@ -662,10 +837,126 @@ void __cdecl S_CalculateStaticMeshLight(int x, int y, int z, int shade1, int sha
 	S_CalculateStaticLight(adder);
 }
 
+#ifdef FEATURE_RENDER_IMPROVED
+// Room vertex indices are binned into a grid of sectors on level loading,
+// so dynamic lights visit only the vertices of the sectors they touch
+typedef struct {
+	__int16 *data; // flipped rooms swap their contents, so the mesh is checked
+	int *cellStart;
+	int *indices;
+} ROOM_LIGHT_GRID;
+
+bool RoomLightGridEnabled = true;
+
+static ROOM_LIGHT_GRID *RoomLightGrids = NULL;
+static int RoomLightGridsCount = 0;
+
+static int GetLightGridCell(ROOM_INFO *room, int x, int z) {
+	int cx = x >> WALL_SHIFT;
+	int cz = z >> WALL_SHIFT;
+	CLAMP(cx, 0, room->ySize - 1);
+	CLAMP(cz, 0, room->xSize - 1);
+	return cz + cx * room->xSize;
+}
+
+void FreeRoomLightGrids() {
+	if( RoomLightGrids != NULL ) {
+		for( int i = 0; i < RoomLightGridsCount; ++i ) {
+			free(RoomLightGrids[i].cellStart);
+			free(RoomLightGrids[i].indices);
+		}
+		free(RoomLightGrids);
+		RoomLightGrids = NULL;
+	}
+	RoomLightGridsCount = 0;
+}
+
+void BuildRoomLightGrids() {
+	FreeRoomLightGrids();
+	if( !RoomLightGridEnabled || RoomCount <= 0 ) return;
+
+	RoomLightGrids = (ROOM_LIGHT_GRID *)calloc(RoomCount, sizeof(ROOM_LIGHT_GRID));
+	if( RoomLightGrids == NULL ) return;
+	RoomLightGridsCount = RoomCount;
+
+	for( int i = 0; i < RoomCount; ++i ) {
+		ROOM_INFO *room = &RoomInfo[i];
+		ROOM_LIGHT_GRID *grid = &RoomLightGrids[i];
+		int cellsCount = room->xSize * room->ySize;
+		int vtxCount = *room->data;
+		ROOM_VERTEX_INFO *roomVtx = (ROOM_VERTEX_INFO *)(room->data + 1);
+		if( cellsCount <= 0 || vtxCount <= 0 ) continue;
+
+		grid->cellStart = (int *)calloc(cellsCount + 1, sizeof(int));
+		grid->indices = (int *)malloc(sizeof(int) * vtxCount);
+		if( grid->cellStart == NULL || grid->indices == NULL ) {
+			free(grid->cellStart);
+			free(grid->indices);
+			grid->cellStart = NULL;
+			grid->indices = NULL;
+			continue;
+		}
+
+		// counting sort of the vertices by their cells
+		for( int j = 0; j < vtxCount; ++j ) {
+			++grid->cellStart[GetLightGridCell(room, roomVtx[j].x, roomVtx[j].z) + 1];
+		}
+		for( int j = 0; j < cellsCount; ++j ) {
+			grid->cellStart[j+1] += grid->cellStart[j];
+		}
+		for( int j = 0; j < vtxCount; ++j ) {
+			int cell = GetLightGridCell(room, roomVtx[j].x, roomVtx[j].z);
+			grid->indices[grid->cellStart[cell]++] = j;
+		}
+		// the starts were moved to the ends, so shift them back
+		for( int j = cellsCount; j > 0; --j ) {
+			grid->cellStart[j] = grid->cellStart[j-1];
+		}
+		grid->cellStart[0] = 0;
+		grid->data = room->data;
+	}
+}
+
+static ROOM_LIGHT_GRID *GetRoomLightGrid(ROOM_INFO *room) {
+	if( !RoomLightGridEnabled || RoomLightGrids == NULL ) return NULL;
+	int roomNumber = room - RoomInfo;
+	if( roomNumber < 0 || roomNumber >= RoomLightGridsCount ) return NULL;
+	if( RoomLightGrids[roomNumber].data == room->data ) return &RoomLightGrids[roomNumber];
+	if( room->flippedRoom >= 0 && room->flippedRoom < RoomLightGridsCount
+		&& RoomLightGrids[room->flippedRoom].data == room->data )
+	{
+		return &RoomLightGrids[room->flippedRoom];
+	}
+	return NULL;
+}
+#endif // FEATURE_RENDER_IMPROVED
+
+static inline void LightRoomVertex(ROOM_VERTEX_INFO *roomVtx, int xPos, int yPos, int zPos, int radius, int falloff, int intensity) {
+	int xDist, yDist, zDist, distance, shade;
+
+	if( roomVtx->lightAdder != 0 ) {
+		xDist = roomVtx->x - xPos;
+		yDist = roomVtx->y - yPos;
+		zDist = roomVtx->z - zPos;
+		if( (xDist >= -radius && xDist <= radius) &&
+			(yDist >= -radius && yDist <= radius) &&
+			(zDist >= -radius && zDist <= radius) )
+		{
+			distance = SQR(xDist) + SQR(yDist) + SQR(zDist);
+			if( distance <= SQR(radius) ) {
+				shade = (1 << intensity) - (distance >> (2 * falloff - intensity));
+				roomVtx->lightAdder -= shade;
+				if( roomVtx->lightAdder < 0 )
+					roomVtx->lightAdder = 0;
+			}
+		}
+	}
+}
+
 void __cdecl S_LightRoom(ROOM_INFO *room) {
-	int shade, falloff, intensity;
+	int falloff, intensity;
 	int xPos, yPos, zPos;
-	int xDist, yDist, zDist, distance, radius;
+	int radius;
 	int roomVtxCount;
 	ROOM_VERTEX_INFO *roomVtx;
 
@@ -692,6 +983,9 @@ void __cdecl S_LightRoom(ROOM_INFO *room) {
 	int zMin = 0x400;
 	int xMax = 0x400 * (room->ySize - 1);
 	int zMax = 0x400 * (room->xSize - 1);
+#ifdef FEATURE_RENDER_IMPROVED
+	ROOM_LIGHT_GRID *grid = ( DynamicLightCount > 0 ) ? GetRoomLightGrid(room) : NULL;
+#endif // FEATURE_RENDER_IMPROVED
 
 	for( DWORD i = 0; i < DynamicLightCount; ++i ) {
 		xPos = DynamicLights[i].x - room->x;
@@ -706,24 +1000,25 @@ void __cdecl S_LightRoom(ROOM_INFO *room) {
 			room->flags |= 0x10;
 			roomVtxCount = *room->data;
 			roomVtx = (ROOM_VERTEX_INFO *)(room->data + 1);
-			for( int j = 0; j < roomVtxCount; ++j ) {
-				if( roomVtx[j].lightAdder != 0 ) {
-					xDist = roomVtx[j].x - xPos;
-					yDist = roomVtx[j].y - yPos;
-					zDist = roomVtx[j].z - zPos;
-					if( (xDist >= -radius && xDist <= radius) &&
-						(yDist >= -radius && yDist <= radius) &&
-						(zDist >= -radius && zDist <= radius) )
-					{
-						distance = SQR(xDist) + SQR(yDist) + SQR(zDist);
-						if( distance <= SQR(radius) ) {
-							shade = (1 << intensity) - (distance >> (2 * falloff - intensity));
-							roomVtx[j].lightAdder -= shade;
-							if( roomVtx[j].lightAdder < 0 )
-								roomVtx[j].lightAdder = 0;
-						}
+#ifdef FEATURE_RENDER_IMPROVED
+			if( grid != NULL ) {
+				int cell0 = GetLightGridCell(room, xPos - radius, zPos - radius);
+				int cell1 = GetLightGridCell(room, xPos + radius, zPos + radius);
+				int cx0 = cell0 / room->xSize, cz0 = cell0 % room->xSize;
+				int cx1 = cell1 / room->xSize, cz1 = cell1 % room->xSize;
+				for( int cx = cx0; cx <= cx1; ++cx ) {
+					// the cells of the same row are adjacent in the index list
+					int start = grid->cellStart[cz0 + cx * room->xSize];
+					int end = grid->cellStart[cz1 + cx * room->xSize + 1];
+					for( int j = start; j < end; ++j ) {
+						LightRoomVertex(&roomVtx[grid->indices[j]], xPos, yPos, zPos, radius, falloff, intensity);
 					}
 				}
+				continue;
+			}
+#endif // FEATURE_RENDER_IMPROVED
+			for( int j = 0; j < roomVtxCount; ++j ) {
+				LightRoomVertex(&roomVtx[j], xPos, yPos, zPos, radius, falloff, intensity);
 			}
 		}
 	}
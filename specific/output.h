@@ -41,9 +41,17 @@ int __cdecl S_GetObjectBounds(__int16 *bPtr); // 0x00450D80
 void __cdecl S_InsertBackPolygon(int x0, int y0, int x1, int y1); // 0x00450FF0
 void __cdecl S_PrintShadow(__int16 radius, __int16 *bPtr, ITEM_INFO *item); // 0x00451040
 void __cdecl S_CalculateLight(int x, int y, int z, __int16 roomNumber); // 0x00451240
+#ifdef FEATURE_RENDER_IMPROVED
+void BuildRoomLightProbes();
+void FreeRoomLightProbes();
+#endif // FEATURE_RENDER_IMPROVED
 void __cdecl S_CalculateStaticLight(__int16 adder); // 0x00451540
 void __cdecl S_CalculateStaticMeshLight(int x, int y, int z, int shade1, int shade2, ROOM_INFO *room); // 0x00451580
 void __cdecl S_LightRoom(ROOM_INFO *room); // 0x004516B0
+#ifdef FEATURE_RENDER_IMPROVED
+void BuildRoomLightGrids();
+void FreeRoomLightGrids();
+#endif // FEATURE_RENDER_IMPROVED
 void __cdecl S_DrawHealthBar(int percent); // 0x004518C0
 void __cdecl S_DrawAirBar(int percent); // 0x00451A90
 void __cdecl AnimateTextures(int nTicks); // 0x00451C90
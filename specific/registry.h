@@ -67,6 +67,7 @@
 #define REG_SCREENSHOT_FORMAT	"ScreenshotFormat"
 #define REG_JOYSTICK_BTN_STYLE	"JoystickButtonStyle"
 #define REG_PAUSEBGND_MODE		"PauseBackgroundMode"
+#define REG_SWR_THREADS			"SoftwareRenderThreads"
 
 // BOOL value names
 #define REG_PERSPECTIVE			"PerspectiveCorrect"
@@ -84,6 +85,21 @@
 #define REG_FMV_DISABLE			"DisableFMV"
 #define REG_PSXBARPOS_ENABLE	"EnablePsxBarPos"
 #define REG_PSXFOV_ENABLE		"EnablePsxFov"
+#define REG_RADIX_SORT_ENABLE	"EnableRadixSort"
+#define REG_SIMD_ENABLE			"EnableSIMD"
+#define REG_HWR_BATCHING_ENABLE	"EnableHardwareBatching"
+#define REG_TEXTURE_ATLAS_ENABLE	"EnableTextureAtlas"
+#define REG_FRONT_TO_BACK_ENABLE	"EnableFrontToBack"
+#define REG_ROOM_CACHE_ENABLE	"EnableRoomVertexCache"
+#define REG_ROOM_PVS_ENABLE		"EnableRoomPVS"
+#define REG_LIGHT_GRID_ENABLE	"EnableRoomLightGrid"
+#define REG_LIGHT_PROBES_ENABLE	"EnableLightProbes"
+#define REG_ANIM_CACHE_ENABLE	"EnableAnimFrameCache"
+#define REG_LEVEL_STREAM_ENABLE	"EnableLevelStream"
+#define REG_ASYNC_LOADING_ENABLE	"EnableAsyncLoading"
+#define REG_PREFETCH_BUDGET		"LevelPrefetchBudget"
+#define REG_SAMPLE_BANK_ENABLE	"EnableSampleBank"
+#define REG_LEVEL_SNAPSHOT_ENABLE	"EnableLevelSnapshot"
 #define REG_BAREFOOT_SFX_ENABLE	"BarefootSFX"
 #define REG_REMASTER_PIX_ENABLE	"RemasteredPictures"
 #define REG_WALK_TO_SIDESTEP	"WalkToSidestep"
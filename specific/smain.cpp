@@ -46,6 +46,10 @@
 #include "modding/background_new.h"
 #include "global/vars.h"
 
+#ifdef FEATURE_BENCHMARK
+#include "modding/benchmark.h"
+#endif // FEATURE_BENCHMARK
+
 #ifdef FEATURE_HUD_IMPROVED
 extern DWORD DemoTextMode;
 extern DWORD JoystickButtonStyle;
@@ -106,6 +110,29 @@ extern double WaterFogBeginFactor;
 extern double WaterFogEndFactor;
 #endif // FEATURE_VIEW_IMPROVED
 
+#ifdef FEATURE_RENDER_IMPROVED
+extern bool RadixSortEnabled;
+extern bool SimdEnabled;
+extern DWORD SwrThreadsCount;
+extern bool HwrBatchingEnabled;
+extern bool HwrTextureAtlasEnabled;
+extern bool HwrFrontToBackEnabled;
+extern bool RoomVertexCacheEnabled;
+extern bool RoomPvsEnabled;
+extern bool RoomLightGridEnabled;
+extern bool LightProbesEnabled;
+extern bool AnimFrameCacheEnabled;
+#endif // FEATURE_RENDER_IMPROVED
+
+#ifdef FEATURE_LOADING_IMPROVED
+#include "modding/level_prefetch.h"
+extern bool LevelStreamEnabled;
+extern bool AsyncLoadingEnabled;
+extern DWORD LevelPrefetchBudget;
+extern bool SampleBankEnabled;
+extern bool LevelSnapshotEnabled;
+#endif // FEATURE_LOADING_IMPROVED
+
 #ifdef FEATURE_GAMEPLAY_FIXES
 extern bool IsRunningM16fix;
 extern bool IsLowCeilingJumpFix;
@@ -164,6 +191,12 @@ BOOL __cdecl GameMain() {
 		return FALSE;
 	}
 
+#ifdef FEATURE_BENCHMARK
+	if( IsBenchmarkRequested() ) {
+		return BenchmarkRun();
+	}
+#endif // FEATURE_BENCHMARK
+
 	HiRes = 0;
 	TempVideoAdjust(1, 1.0);
 	S_UpdateInput();
@@ -258,6 +291,10 @@ BOOL __cdecl GameMain() {
 
 			case GF_EXIT_TO_TITLE :
 			case GF_EXIT_TO_OPTION :
+#ifdef FEATURE_LOADING_IMPROVED
+				// the next level of the left game is not needed anymore
+				CancelLevelPrefetch();
+#endif // FEATURE_LOADING_IMPROVED
 				if( (GF_GameFlow.flags & GFF_TitleDisabled) != 0 ) {
 					gfOption = GF_GameFlow.titleReplace;
 					if( gfOption == GF_EXIT_TO_TITLE || gfOption < 0 ) {
@@ -646,6 +683,28 @@ void __cdecl S_LoadSettings() {
 	GetRegistryBoolValue(REG_PSXFOV_ENABLE, &PsxFovEnabled, false);
 #endif // FEATURE_VIEW_IMPROVED
 
+#ifdef FEATURE_RENDER_IMPROVED
+	GetRegistryBoolValue(REG_RADIX_SORT_ENABLE, &RadixSortEnabled, true);
+	GetRegistryBoolValue(REG_SIMD_ENABLE, &SimdEnabled, true);
+	GetRegistryDwordValue(REG_SWR_THREADS, &SwrThreadsCount, 0);
+	GetRegistryBoolValue(REG_HWR_BATCHING_ENABLE, &HwrBatchingEnabled, true);
+	GetRegistryBoolValue(REG_TEXTURE_ATLAS_ENABLE, &HwrTextureAtlasEnabled, true);
+	GetRegistryBoolValue(REG_FRONT_TO_BACK_ENABLE, &HwrFrontToBackEnabled, true);
+	GetRegistryBoolValue(REG_ROOM_CACHE_ENABLE, &RoomVertexCacheEnabled, true);
+	GetRegistryBoolValue(REG_ROOM_PVS_ENABLE, &RoomPvsEnabled, true);
+	GetRegistryBoolValue(REG_LIGHT_GRID_ENABLE, &RoomLightGridEnabled, true);
+	GetRegistryBoolValue(REG_LIGHT_PROBES_ENABLE, &LightProbesEnabled, false);
+	GetRegistryBoolValue(REG_ANIM_CACHE_ENABLE, &AnimFrameCacheEnabled, true);
+#endif // FEATURE_RENDER_IMPROVED
+
+#ifdef FEATURE_LOADING_IMPROVED
+	GetRegistryBoolValue(REG_LEVEL_STREAM_ENABLE, &LevelStreamEnabled, true);
+	GetRegistryBoolValue(REG_ASYNC_LOADING_ENABLE, &AsyncLoadingEnabled, true);
+	GetRegistryDwordValue(REG_PREFETCH_BUDGET, &LevelPrefetchBudget, 32);
+	GetRegistryBoolValue(REG_SAMPLE_BANK_ENABLE, &SampleBankEnabled, true);
+	GetRegistryBoolValue(REG_LEVEL_SNAPSHOT_ENABLE, &LevelSnapshotEnabled, true);
+#endif // FEATURE_LOADING_IMPROVED
+
 #ifdef FEATURE_MOD_CONFIG
 	GetRegistryBoolValue(REG_BAREFOOT_SFX_ENABLE, &BarefootSfxEnabled, true);
 #endif // FEATURE_MOD_CONFIG